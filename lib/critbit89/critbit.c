@@ -25,13 +25,39 @@
 #endif
 
 
+/* The fields compared during traversal come first */
 typedef struct {
-	void *child[2];
 	uint32_t byte;
 	uint8_t otherbits;
+	void *child[2];
 } cb_node_t;
 
 
+/* Size of arena slabs */
+#define CB_SLAB_SIZE 65536
+
+/* Arena slab, followed by its data */
+typedef struct cb_slab_t {
+	struct cb_slab_t *next;
+	size_t size;
+} cb_slab_t;
+
+/* Bump allocator on a list of slabs */
+typedef struct {
+	cb_slab_t *first;
+	cb_slab_t *current;
+	char *ptr;
+	char *end;
+} cb_region_t;
+
+/* Arena with separate regions for nodes and keys, so nodes are packed
+   densely */
+typedef struct {
+	cb_region_t nodes;
+	cb_region_t keys;
+} cb_arena_t;
+
+
 /* Standard memory allocation functions */
 static void *malloc_align_std(size_t alignment, size_t size, void *baton) {
 	void *ptr;
@@ -58,7 +84,91 @@ static void free_std(void *ptr, void *baton) {
 #endif
 }
 
+/* Arena memory allocation functions */
+static void *cbt_region_alloc(cb_region_t *r, size_t size, size_t alignment)
+{
+	cb_slab_t *slab;
+	char *p;
+
+	if (r->ptr != NULL) {
+		size_t pad = (alignment - ((size_t)(intptr_t)r->ptr & (alignment - 1))) & (alignment - 1);
+		if (pad + size <= (size_t)(r->end - r->ptr)) {
+			p = r->ptr + pad;
+			r->ptr = p + size;
+			return p;
+		}
+	}
+
+	/* Continue with the next slab, reusing slabs from before the last reset */
+	slab = (r->current != NULL ? r->current->next : r->first);
+	if (slab == NULL || slab->size < size) {
+		size_t slab_size = (size > CB_SLAB_SIZE ? size : CB_SLAB_SIZE);
+		cb_slab_t *s = malloc(sizeof(cb_slab_t) + slab_size);
+		if (s == NULL) {
+			return NULL;
+		}
+		s->size = slab_size;
+		s->next = slab;
+		if (r->current != NULL) {
+			r->current->next = s;
+		} else {
+			r->first = s;
+		}
+		slab = s;
+	}
+
+	r->current = slab;
+	p = (char *)(slab + 1);
+	r->ptr = p + size;
+	r->end = p + slab->size;
+	return p;
+}
+
+static void cbt_region_reset(cb_region_t *r)
+{
+	r->current = NULL;
+	r->ptr = NULL;
+	r->end = NULL;
+}
+
+static void cbt_region_free(cb_region_t *r)
+{
+	while (r->first != NULL) {
+		cb_slab_t *next = r->first->next;
+		free(r->first);
+		r->first = next;
+	}
+	cbt_region_reset(r);
+}
+
+static void *malloc_align_arena(size_t alignment, size_t size, void *baton) {
+	return cbt_region_alloc(&((cb_arena_t *)baton)->keys, size, alignment);
+}
+
+static void free_arena(void *ptr, void *baton) {
+	/* Memory is reclaimed when clearing the tree */
+	(void)ptr; /* Prevent compiler warnigns */
+	(void)baton;
+}
+
 /* Static helper functions */
+static cb_node_t *cbt_alloc_node(cb_tree_t *tree)
+{
+	if (tree->free == &free_arena) {
+		return cbt_region_alloc(&((cb_arena_t *)tree->baton)->nodes, sizeof(cb_node_t), sizeof(void *));
+	}
+	return (tree->malloc_align)(sizeof(void *), sizeof(cb_node_t), tree->baton);
+}
+
+static uint8_t *cbt_alloc_key(cb_tree_t *tree, size_t size)
+{
+	if (tree->free == &free_arena) {
+		/* Leaves only need to be distinguishable from tagged nodes */
+		return cbt_region_alloc(&((cb_arena_t *)tree->baton)->keys, size, 2);
+	}
+	return (tree->malloc_align)(sizeof(void *), size, tree->baton);
+}
+
 static void cbt_traverse_delete(cb_tree_t *tree, void *top)
 {
 	uint8_t *p = top;
@@ -105,6 +215,19 @@ cb_tree_t cb_tree_make()
 	return tree;
 }
 
+/*! Creates an new, empty critbit tree that allocates from an arena */
+cb_tree_t cb_tree_make_arena()
+{
+	cb_tree_t tree = cb_tree_make();
+	cb_arena_t *arena = calloc(1, sizeof(cb_arena_t));
+	if (arena != NULL) {
+		tree.malloc_align = &malloc_align_arena;
+		tree.free = &free_arena;
+		tree.baton = arena;
+	}
+	return tree;
+}
+
 /*! Returns non-zero if tree contains str */
 int cb_tree_contains(cb_tree_t *tree, const char *str)
 {
@@ -146,7 +269,7 @@ int cb_tree_insert(cb_tree_t *tree, const char *str)
 	void **wherep;
 
 	if (p == NULL) {
-		x = (tree->malloc_align)(sizeof(void *), ulen + 1, tree->baton);
+		x = cbt_alloc_key(tree, ulen + 1);
 		if (x == NULL) {
 			return ENOMEM;
 		}
@@ -187,13 +310,12 @@ different_byte_found:
 	c = p[newbyte];
 	newdirection = (1 + (newotherbits | c)) >> 8;
 
-	newnode =
-		(tree->malloc_align)(sizeof(void *), sizeof(cb_node_t), tree->baton);
+	newnode = cbt_alloc_node(tree);
 	if (newnode == NULL) {
 		return ENOMEM;
 	}
 
-	x = (tree->malloc_align)(sizeof(void *), ulen + 1, tree->baton);
+	x = cbt_alloc_key(tree, ulen + 1);
 	if (x == NULL) {
 		(tree->free)(newnode, tree->baton);
 		return ENOMEM;
@@ -234,6 +356,104 @@ different_byte_found:
 	return 0;
 }
 
+/*! Builds an empty tree from n strings in ascending strcmp() order,
+    returns 0 on success */
+int cb_tree_build_sorted(cb_tree_t *tree, const char *const *strs, size_t n)
+{
+	cb_node_t **stack;
+	size_t i, depth = 0;
+	void *pending;
+	int ret = 0;
+
+	if (tree->root != NULL) {
+		return EINVAL;
+	}
+	if (n == 0) {
+		return 0;
+	}
+
+	stack = malloc(n * sizeof(cb_node_t *));
+	if (stack == NULL) {
+		return ENOMEM;
+	}
+
+	/*
+	 * The critical bits of adjacent strings are the internal nodes of the
+	 * tree, as visited by an in-order traversal. The tree is built like a
+	 * Cartesian tree, keeping the nodes on the right spine on a stack.
+	 */
+	pending = NULL;
+	for (i = 0; i < n; i++) {
+		const uint8_t *prev, *cur = (const void *)strs[i];
+		const size_t ulen = strlen(strs[i]);
+		uint32_t newbyte, newotherbits;
+		cb_node_t *newnode = NULL;
+		void *left;
+		uint8_t *x;
+
+		if (i > 0) {
+			prev = (const void *)strs[i-1];
+			for (newbyte = 0; prev[newbyte] == cur[newbyte] && cur[newbyte] != 0; ++newbyte);
+			if (prev[newbyte] == cur[newbyte]) {
+				continue; /* Duplicate */
+			}
+			if (prev[newbyte] > cur[newbyte]) {
+				ret = EINVAL;
+				break;
+			}
+			newotherbits = prev[newbyte] ^ cur[newbyte];
+			newotherbits |= newotherbits >> 1;
+			newotherbits |= newotherbits >> 2;
+			newotherbits |= newotherbits >> 4;
+			newotherbits = (newotherbits & ~(newotherbits >> 1)) ^ 255;
+
+			newnode = cbt_alloc_node(tree);
+			if (newnode == NULL) {
+				ret = ENOMEM;
+				break;
+			}
+			newnode->byte = newbyte;
+			newnode->otherbits = newotherbits;
+		}
+
+		x = cbt_alloc_key(tree, ulen + 1);
+		if (x == NULL) {
+			if (newnode) {
+				(tree->free)(newnode, tree->baton);
+			}
+			ret = ENOMEM;
+			break;
+		}
+		memcpy(x, cur, ulen + 1);
+
+		if (newnode) {
+			/* Nodes with larger critical bits become the left subtree */
+			left = pending;
+			while (depth > 0 && (stack[depth-1]->byte > newnode->byte
+				|| (stack[depth-1]->byte == newnode->byte && stack[depth-1]->otherbits > newnode->otherbits))) {
+				stack[depth-1]->child[1] = left;
+				left = (void *)(1 + (char *)stack[--depth]);
+			}
+			newnode->child[0] = left;
+			stack[depth++] = newnode;
+		}
+		pending = x;
+	}
+
+	/* Close the right spine */
+	while (depth > 0) {
+		stack[depth-1]->child[1] = pending;
+		pending = (void *)(1 + (char *)stack[--depth]);
+	}
+	tree->root = pending;
+	free(stack);
+
+	if (ret != 0) {
+		cb_tree_clear(tree);
+	}
+	return ret;
+}
+
 /*! Deletes str from the tree, returns 0 on suceess */
 int cb_tree_delete(cb_tree_t *tree, const char *str)
 {
@@ -280,12 +500,28 @@ int cb_tree_delete(cb_tree_t *tree, const char *str)
 /*! Clears the given tree */
 void cb_tree_clear(cb_tree_t *tree)
 {
-	if (tree->root) {
+	if (tree->free == &free_arena) {
+		/* Slabs are kept for reuse */
+		cbt_region_reset(&((cb_arena_t *)tree->baton)->nodes);
+		cbt_region_reset(&((cb_arena_t *)tree->baton)->keys);
+	} else if (tree->root) {
 		cbt_traverse_delete(tree, tree->root);
 	}
 	tree->root = NULL;
 }
 
+/*! Clears the given tree and releases all memory held by it */
+void cb_tree_free(cb_tree_t *tree)
+{
+	cb_tree_clear(tree);
+	if (tree->free == &free_arena) {
+		cbt_region_free(&((cb_arena_t *)tree->baton)->nodes);
+		cbt_region_free(&((cb_arena_t *)tree->baton)->keys);
+		free(tree->baton);
+		*tree = cb_tree_make();
+	}
+}
+
 /*! Calls callback for all strings in tree with the given prefix  */
 int cb_tree_walk_prefixed(cb_tree_t *tree, const char *prefix,
 	int (*callback)(const char *, void *), void *baton)
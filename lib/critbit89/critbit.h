@@ -25,18 +25,30 @@ typedef struct {
 /*! Creates an new, empty critbit tree */
 extern cb_tree_t cb_tree_make();
 
+/*! Creates an new, empty critbit tree that allocates from an arena.
+    Clearing it is cheap, but memory of deleted strings is only reused
+    after clearing. Use cb_tree_free() to release the memory */
+extern cb_tree_t cb_tree_make_arena();
+
 /*! Returns non-zero if tree contains str */
 extern int cb_tree_contains(cb_tree_t *tree, const char *str);
 
 /*! Inserts str into tree, returns 0 on suceess */
 extern int cb_tree_insert(cb_tree_t *tree, const char *str);
 
+/*! Builds an empty tree from n strings in ascending strcmp() order,
+    returns 0 on success */
+extern int cb_tree_build_sorted(cb_tree_t *tree, const char *const *strs, size_t n);
+
 /*! Deletes str from the tree, returns 0 on suceess */
 extern int cb_tree_delete(cb_tree_t *tree, const char *str);
 
 /*! Clears the given tree */
 extern void cb_tree_clear(cb_tree_t *tree);
 
+/*! Clears the given tree and releases all memory held by it */
+extern void cb_tree_free(cb_tree_t *tree);
+
 /*! Calls callback for all strings in tree with the given prefix  */
 extern int cb_tree_walk_prefixed(cb_tree_t *tree, const char *prefix,
 	int (*callback)(const char *, void *), void *baton);
@@ -33,15 +33,22 @@
 #include <apr_hash.h>
 #include <apr_md5.h>
 
+#include "critbit89/critbit.h"
+
 #include "main.h"
 #include "dump.h"
+#include "filter.h"
+#include "load.h"
 #include "log.h"
 #include "logger.h"
 #include "path_repo.h"
 #include "property.h"
 #include "rhash.h"
 #include "session.h"
+#include "stats.h"
+#include "text_store.h"
 #include "utils.h"
+#include "workers.h"
 
 #include "delta.h"
 
@@ -50,14 +57,16 @@
  #define SVN_REPOS_DUMPFILE_TEXT_CONTENT_MD5 SVN_REPOS_DUMPFILE_TEXT_CONTENT_CHECKSUM
 #endif
 
-#define ERRBUFFER_SIZE 512
-
 
 /*---------------------------------------------------------------------------*/
 /* Local data structures                                                     */
 /*---------------------------------------------------------------------------*/
 
 
+/* Texts larger than this are deltified on demand by the dumping thread */
+#define DELTIFY_JOB_MAX_SIZE (4*1024*1024)
+
+
 /* Copy info enumeration */
 typedef enum {
 	CPI_NONE = 0x01,
@@ -79,21 +88,41 @@ typedef struct {
 	void              *root_node;
 	path_repo_t       *path_repo;
 	property_storage_t *prop_store;
+	load_t            *loader;         /* Direct loading, if any */
+	apr_array_header_t *deltify_jobs;  /* Submitted in this revision */
+	apr_hash_t        *prop_blocks;    /* Property ID to serialized block */
 } de_baton_t;
 
 
+/* Background deltification job. The job itself is allocated from the
+   revision pool, and everything needed by the worker from the job's own
+   root pool */
+typedef struct {
+	apr_pool_t        *pool;
+	svn_stringbuf_t   *source, *target;  /* Contents in memory, or */
+	const char        *source_file, *target_file;  /* files on disk */
+	int               version, level;  /* svndiff format */
+	svn_stringbuf_t   *result;
+	svn_error_t       *err;
+	workers_job_t     *job;
+	char              collected;
+} de_deltify_job_t;
+
+
 /* Node baton */
 typedef struct {
 	de_baton_t        *de_baton;
 	apr_pool_t        *pool;
 	const char        *path;
-	char              *filename;
+	char              *filename;        /* Names in the text store */
 	char              *old_filename;
 	char              *delta_filename;
 	char              action;
 	svn_node_kind_t   kind;
 	apr_hash_t        *properties;
 	apr_hash_t        *del_properties; /* Value is always 0x1 */
+	unsigned char     props_id[APR_MD5_DIGESTSIZE];  /* As in the storage */
+	char              has_props_id;
 	unsigned char     md5sum[APR_MD5_DIGESTSIZE];
 	char              *copyfrom_path;
 	svn_revnum_t      copyfrom_revision;
@@ -102,6 +131,7 @@ typedef struct {
 	char              applied_delta;
 	char              dump_needed;
 	char              props_changed;
+	de_deltify_job_t  *deltify_job;
 	void              *parent;
 	apr_array_header_t *children;
 } de_node_baton_t;
@@ -117,14 +147,14 @@ typedef struct {
  * every file in the repository. The delta_hash hash defines a mapping of
  * repository paths to temporary files for this purpose. The md5_hash is
  * used to store the md5-sums of the file contents.
+ * Every path stored in one of the hashes is also added to path_index,
+ * which is used to find the children of deleted directories without
+ * scanning the whole hashes. It may contain a few stale paths.
  */
 static char hashes_created = 0;
 static rhash_t *delta_hash = NULL;
 static rhash_t *md5_hash = NULL;
-#ifdef USE_TIMING
- static float tm_de_apply_textdelta = 0.0f;
-#endif
-
+static cb_tree_t path_index;
 
 /*---------------------------------------------------------------------------*/
 /* Static functions                                                          */
@@ -135,6 +165,37 @@ static rhash_t *md5_hash = NULL;
 static svn_error_t *delta_dump_node(de_node_baton_t *node);
 
 
+/* Creates the global hashes if needed */
+static void delta_create_hashes(apr_pool_t *pool)
+{
+	if (!hashes_created) {
+		apr_pool_t *hash_pool = svn_pool_create(pool);
+
+		md5_hash = rhash_make(hash_pool);
+		delta_hash = rhash_make(hash_pool);
+		path_index = cb_tree_make();
+
+		hashes_created = 1;
+	}
+}
+
+
+/* Baton for delta_collect_path() */
+typedef struct {
+	apr_array_header_t *paths;
+	apr_pool_t *pool;
+} de_collect_baton_t;
+
+
+/* cb_tree_walk_prefixed() callback for collecting indexed paths */
+static int delta_collect_path(const char *path, void *baton)
+{
+	de_collect_baton_t *b = (de_collect_baton_t *)baton;
+	APR_ARRAY_PUSH(b->paths, const char *) = apr_pstrdup(b->pool, path);
+	return 0;
+}
+
+
 /* Creates a new node baton */
 static de_node_baton_t *delta_create_node(const char *path, de_node_baton_t *parent)
 {
@@ -153,6 +214,8 @@ static de_node_baton_t *delta_create_node(const char *path, de_node_baton_t *par
 	node->applied_delta = 0;
 	node->dump_needed = 0;
 	node->props_changed = 0;
+	node->deltify_job = NULL;
+	node->has_props_id = 0;
 	node->parent = parent;
 	node->children = apr_array_make(node->pool, 0, (sizeof(de_node_baton_t *)));
 	memset(node->md5sum, 0x00, sizeof(node->md5sum));
@@ -181,6 +244,8 @@ static de_node_baton_t *delta_create_node_no_parent(const char *path, de_baton_t
 	node->applied_delta = 0;
 	node->dump_needed = 0;
 	node->props_changed = 0;
+	node->deltify_job = NULL;
+	node->has_props_id = 0;
 	node->parent = NULL;
 	node->children = apr_array_make(node->pool, 0, (sizeof(de_node_baton_t *)));
 	memset(node->md5sum, 0x00, sizeof(node->md5sum));
@@ -196,6 +261,7 @@ static void delta_mark_node(de_node_baton_t *node)
 	apr_hash_set(de_baton->dumped_entries, node->path, APR_HASH_KEY_STRING, node);
 	if (node->kind == svn_node_file) {
 		rhash_set(md5_hash, node->path, APR_HASH_KEY_STRING, node->md5sum, APR_MD5_DIGESTSIZE);
+		cb_tree_insert(&path_index, node->path);
 		DEBUG_MSG("md5_hash += %s : %s\n", node->path, svn_md5_digest_to_cstring(node->md5sum, node->pool));
 	}
 	node->dump_needed = 0;
@@ -215,6 +281,7 @@ static char delta_check_copy(de_node_baton_t *node)
 {
 	session_t *session = node->de_baton->session;
 	dump_options_t *opts = node->de_baton->opts;
+	const char *copyfrom_path;
 
 	/* Propagated copies should have been checked already */
 	if ((node->cp_info == CPI_COPY) && (node->copyfrom_path == NULL)) {
@@ -232,6 +299,15 @@ static char delta_check_copy(de_node_baton_t *node)
 		return 0;
 	}
 
+	/* If excluded paths are involved, the copy can't be reproduced.
+	   Simulate it just like copies from outside of the session root. */
+	copyfrom_path = delta_get_local_copyfrom_path(session->prefix, node->copyfrom_path);
+	if (copyfrom_path != NULL && filter_affects_copy(session->filter, copyfrom_path, node->path, node->pool)) {
+		node->cp_info = CPI_FAILED_OUTSIDE;
+		DEBUG_MSG("delta_check_copy: copy affected by the filter\n");
+		return 0;
+	}
+
 	/* Check if we can use the information we already have */
 	if ((strlen(session->prefix) == 0) && ((opts->start == 0) || (opts->flags & DF_INCREMENTAL))) {
 		node->copyfrom_rev_local = node->copyfrom_revision;
@@ -453,55 +529,197 @@ static svn_error_t *delta_propagate_copy(de_node_baton_t *parent, de_node_baton_
 }
 
 
-/* Deltifies a node, i.e. generates a svndiff that can be dumped */
-static svn_error_t *delta_deltify_node(de_node_baton_t *node)
+/* Writes a svndiff of target against source to dest */
+static svn_error_t *delta_write_svndiff(svn_stream_t *source, svn_stream_t *target, svn_stream_t *dest, int version, int level, apr_pool_t *pool)
 {
 	svn_txdelta_stream_t *stream;
 	svn_txdelta_window_handler_t handler;
 	void *handler_baton;
-	svn_stream_t *source, *target, *dest;
-	apr_file_t *source_file = NULL, *target_file = NULL, *dest_file = NULL;
+
+	svn_txdelta(&stream, source, target, pool);
+#if (SVN_VER_MAJOR == 1) && (SVN_VER_MINOR >= 7)
+	svn_txdelta_to_svndiff3(&handler, &handler_baton, dest, version, level, pool);
+#else
+	svn_txdelta_to_svndiff2(&handler, &handler_baton, dest, version, pool);
+#endif
+	return svn_txdelta_send_txstream(stream, handler, handler_baton, pool);
+}
+
+
+/* Opens an input of a deltification job, either from memory or from disk */
+static svn_error_t *delta_job_stream(svn_stream_t **stream, svn_stringbuf_t *data, const char *filename, apr_pool_t *pool)
+{
+	apr_file_t *file;
 	apr_status_t status;
-	dump_options_t *opts = node->de_baton->opts;
+
+	if (data != NULL) {
+		*stream = svn_stream_from_stringbuf(data, pool);
+		return SVN_NO_ERROR;
+	}
+
+	status = apr_file_open(&file, filename, APR_READ, 0600, pool);
+	if (status) {
+		return svn_error_wrap_apr(status, "Unable to open %s", filename);
+	}
+	*stream = svn_stream_from_aprfile2(file, FALSE, pool);
+	return SVN_NO_ERROR;
+}
+
+
+/* Worker function: deltifies a node in the background */
+static void delta_deltify_job(void *baton)
+{
+	de_deltify_job_t *job = (de_deltify_job_t *)baton;
+	svn_stream_t *source, *target;
+
+	job->result = svn_stringbuf_create("", job->pool);
+	job->err = delta_job_stream(&source, job->source, job->source_file, job->pool);
+	if (job->err == SVN_NO_ERROR) {
+		job->err = delta_job_stream(&target, job->target, job->target_file, job->pool);
+	}
+	if (job->err == SVN_NO_ERROR) {
+		job->err = delta_write_svndiff(source, target, svn_stream_from_stringbuf(job->result, job->pool), job->version, job->level, job->pool);
+	}
+}
+
+
+/* Starts deltifying a node in the background if worker threads are
+   available and the texts are small enough */
+static svn_error_t *delta_submit_deltify(de_node_baton_t *node)
+{
+#if APR_HAS_THREADS
+	de_deltify_job_t *job;
+	apr_off_t size, old_size = 0;
+	apr_pool_t *pool;
+	svn_error_t *err;
+
+	if (!workers_running()) {
+		return SVN_NO_ERROR;
+	}
+
+	SVN_ERR(text_store_size(&size, node->filename, node->pool));
+	if (node->old_filename) {
+		SVN_ERR(text_store_size(&old_size, node->old_filename, node->pool));
+	}
+	if (size > DELTIFY_JOB_MAX_SIZE || old_size > DELTIFY_JOB_MAX_SIZE) {
+		return SVN_NO_ERROR;
+	}
+
+	/* The text store must not be accessed by the workers */
+	if ((pool = utils_thread_pool_create(NULL, NULL, NULL)) == NULL) {
+		return SVN_NO_ERROR;
+	}
+	job = apr_pcalloc(node->de_baton->revision_pool, sizeof(de_deltify_job_t));
+	job->pool = pool;
+	job->version = node->de_baton->opts->delta_version;
+	job->level = node->de_baton->opts->delta_level;
+	err = text_store_locate(node->filename, &job->target, &job->target_file, pool);
+	if (err == SVN_NO_ERROR) {
+		if (node->old_filename) {
+			err = text_store_locate(node->old_filename, &job->source, &job->source_file, pool);
+		} else {
+			job->source = svn_stringbuf_create("", pool);
+		}
+	}
+	if (err) {
+		svn_pool_destroy(pool);
+		return err;
+	}
+
+	DEBUG_MSG("delta_submit_deltify(%s): %s -> %s\n", node->path, node->old_filename, node->filename);
+
+	job->job = workers_submit(delta_deltify_job, job);
+	node->deltify_job = job;
+	APR_ARRAY_PUSH(node->de_baton->deltify_jobs, de_deltify_job_t *) = job;
+	return SVN_NO_ERROR;
+#else
+	(void)node; /* Prevent compiler warnings */
+	return SVN_NO_ERROR;
+#endif
+}
+
+
+/* Waits for a background job and discards its result */
+static void delta_release_job(de_deltify_job_t *job)
+{
+	if (job->collected) {
+		return;
+	}
+	workers_wait(job->job);
+	if (job->err) {
+		svn_error_clear(job->err);
+	}
+	svn_pool_destroy(job->pool);
+	job->collected = 1;
+}
+
+
+/* Waits for all background jobs of the current revision that haven't
+   been collected, e.g. because the node didn't need to be dumped */
+static void delta_discard_jobs(de_baton_t *de_baton)
+{
+	int i;
+
+	for (i = 0; i < de_baton->deltify_jobs->nelts; i++) {
+		delta_release_job(APR_ARRAY_IDX(de_baton->deltify_jobs, i, de_deltify_job_t *));
+	}
+	apr_array_clear(de_baton->deltify_jobs);
+}
+
+
+/* Deltifies a node, i.e. generates a svndiff that can be dumped */
+static svn_error_t *delta_deltify_node(de_node_baton_t *node)
+{
+	de_deltify_job_t *job = node->deltify_job;
+	svn_stream_t *source, *target, *dest;
+	const char *name;
 	apr_pool_t *pool = svn_pool_create(node->pool);
 	svn_error_t *err;
 
+	/* Create output text */
+	SVN_ERR(text_store_write(&dest, &name, pool));
+	node->delta_filename = apr_pstrdup(node->pool, name);
+
+	/* Use the result of the background job if there is one */
+	if (job != NULL) {
+		apr_size_t len;
+
+		DEBUG_MSG("delta_deltify_node(%s): collecting background job\n", node->path);
+		workers_wait(job->job);
+		job->collected = 1;
+		node->deltify_job = NULL;
+
+		err = job->err;
+		if (err == SVN_NO_ERROR) {
+			len = job->result->len;
+			err = svn_stream_write(dest, job->result->data, &len);
+		}
+		svn_pool_destroy(job->pool);
+		if (err == SVN_NO_ERROR) {
+			err = svn_stream_close(dest);
+		}
+		svn_pool_destroy(pool);
+		if (err) {
+			DEBUG_MSG("delta_delify_node(%s): Error creating svndiff\n", node->path);
+			return err;
+		}
+		return SVN_NO_ERROR;
+	}
+
 	DEBUG_MSG("delta_deltify_node(%s): %s -> %s\n", node->path, node->old_filename, node->filename);
 
 	/* Open source and target */
-	status = apr_file_open(&target_file, node->filename, APR_READ, 0600, pool);
-	if (status) {
-		DEBUG_MSG("delta_deltify_node(%s): Error opening %s\n", node->path, node->filename);
-		return svn_error_wrap_apr(status, "Unable to open %s", node->filename);
-	}
-	target = svn_stream_from_aprfile2(target_file, FALSE, pool);
+	SVN_ERR(text_store_read(&target, node->filename, pool));
 	if (node->old_filename) {
-		status = apr_file_open(&source_file, node->old_filename, APR_READ, 0600, pool);
-		if (status) {
-			DEBUG_MSG("delta_deltify_node(%s): Error opening %s\n", node->path, node->old_filename);
-			return svn_error_wrap_apr(status, "Unable to open %s", node->old_filename);
-		}
-		source = svn_stream_from_aprfile2(source_file, FALSE, pool);
+		SVN_ERR(text_store_read(&source, node->old_filename, pool));
 	} else {
 		source = svn_stream_empty(pool);
 	}
 
-	/* Open temporary output file */
-	node->delta_filename = apr_psprintf(node->pool, "%s/df/XXXXXX", opts->temp_dir);
-	status = utils_mkstemp(&dest_file, node->delta_filename, pool);
-	if (status) {
-		DEBUG_MSG("delta_deltify_node(%s): Error creating temporary file in %s\n", node->path, opts->temp_dir);
-		return svn_error_wrap_apr(status, "Unable to create temporary file in %s", opts->temp_dir);
-	}
-	dest = svn_stream_from_aprfile2(dest_file, FALSE, pool);
-
 	DEBUG_MSG("delta_deltify_node(%s): writing to %s\n", node->path, node->delta_filename);
 
 	/* Produce delta in svndiff format */
-	svn_txdelta(&stream, source, target, pool);
-	svn_txdelta_to_svndiff2(&handler, &handler_baton, dest, 0, pool);
-
-	err = svn_txdelta_send_txstream(stream, handler, handler_baton, pool);
+	err = delta_write_svndiff(source, target, dest, node->de_baton->opts->delta_version, node->de_baton->opts->delta_level, pool);
 	if (err) {
 		DEBUG_MSG("delta_delify_node(%s): Error creating svndiff\n", node->path);
 		return err;
@@ -511,21 +729,93 @@ static svn_error_t *delta_deltify_node(de_node_baton_t *node)
 }
 
 
-/* Dumps the contents of a file to stdout */
-static svn_error_t *delta_cat_file(apr_pool_t *pool, const char *path)
+/* Records the ID of the properties that have just been stored for a node */
+static void delta_remember_props_id(de_node_baton_t *node)
+{
+	const unsigned char *id = property_id(node->de_baton->prop_store, node->path);
+	if (id != NULL) {
+		memcpy(node->props_id, id, APR_MD5_DIGESTSIZE);
+		node->has_props_id = 1;
+	} else {
+		node->has_props_id = 0;
+	}
+}
+
+
+/* Returns the serialized properties of a node. Identical property sets
+   are serialized only once per revision */
+static svn_stringbuf_t *delta_property_block(de_node_baton_t *node)
+{
+	de_baton_t *de_baton = node->de_baton;
+	svn_stringbuf_t *block;
+	unsigned char *id;
+
+	if (!node->has_props_id) {
+		return property_block_create(node->properties, node->pool);
+	}
+
+	block = apr_hash_get(de_baton->prop_blocks, node->props_id, APR_MD5_DIGESTSIZE);
+	if (block == NULL) {
+		block = property_block_create(node->properties, de_baton->revision_pool);
+		id = apr_pmemdup(de_baton->revision_pool, node->props_id, APR_MD5_DIGESTSIZE);
+		apr_hash_set(de_baton->prop_blocks, id, APR_MD5_DIGESTSIZE, block);
+	}
+	return block;
+}
+
+
+/* Checks whether a copied node has the same properties as its source */
+static char delta_copied_props(de_node_baton_t *node, const char *copyfrom_path)
+{
+	property_storage_t *store = node->de_baton->prop_store;
+	const unsigned char *id;
+	svn_revnum_t changed;
+
+	if (!node->has_props_id || apr_hash_count(node->del_properties) > 0) {
+		return 0;
+	}
+
+	/*
+	 * The storage only knows the current properties of the source, so
+	 * they must not have been changed after the copy source revision.
+	 */
+	id = property_id(store, copyfrom_path);
+	changed = property_changed_rev(store, copyfrom_path);
+	if (id == NULL || changed < 0 || changed > node->copyfrom_revision) {
+		return 0;
+	}
+	return !memcmp(id, node->props_id, APR_MD5_DIGESTSIZE);
+}
+
+
+/* Dumps a node header, or adds it to the given hash when loading directly */
+static void delta_header(apr_hash_t *headers, const char *key, const char *value)
+{
+	if (headers != NULL) {
+		apr_hash_set(headers, key, APR_HASH_KEY_STRING, value);
+	} else {
+		printf("%s: %s\n", key, value);
+	}
+}
+
+
+/* Returns the dumped path of a node, including the user prefix */
+static const char *delta_dump_path(dump_options_t *opts, const char *path, apr_pool_t *pool)
+{
+	if (opts->prefix != NULL) {
+		return apr_pstrcat(pool, opts->prefix, path, NULL);
+	}
+	return path;
+}
+
+
+/* Dumps the contents of a text to stdout */
+static svn_error_t *delta_cat_file(apr_pool_t *pool, const char *name)
 {
 	svn_error_t *err;
-	apr_status_t status;
-	apr_file_t *in_file = NULL;
 	svn_stream_t *in, *out;
 
-	status = apr_file_open(&in_file, path, APR_READ, 0600, pool);
-	if (status) {
-		apr_pool_t *epool = svn_pool_create(NULL);
-		char *errbuf = apr_palloc(epool, ERRBUFFER_SIZE);
-		return svn_error_create(status, NULL, apr_strerror(status, errbuf, ERRBUFFER_SIZE));
-	}
-	in = svn_stream_from_aprfile2(in_file, FALSE, pool);
+	SVN_ERR(text_store_read(&in, name, pool));
 	if ((err = svn_stream_for_stdout(&out, pool))) {
 		svn_stream_close(in);
 		return err;
@@ -547,20 +837,20 @@ static svn_error_t *delta_dump_replace(de_node_baton_t *node)
 {
 	de_baton_t *de_baton = node->de_baton;
 	dump_options_t *opts = de_baton->opts;
-	const char *path = node->path;
+	apr_hash_t *headers = (de_baton->loader != NULL ? apr_hash_make(node->pool) : NULL);
 
 	/*
 	 * A replacement implies deleting and adding the node
 	 */
 
 	/* Dump the deletion */
-	if (opts->prefix != NULL) {
-		printf("%s: %s%s\n", SVN_REPOS_DUMPFILE_NODE_PATH, opts->prefix, path);
+	delta_header(headers, SVN_REPOS_DUMPFILE_NODE_PATH, delta_dump_path(opts, node->path, node->pool));
+	delta_header(headers, SVN_REPOS_DUMPFILE_NODE_ACTION, "delete");
+	if (headers != NULL) {
+		SVN_ERR(load_node(de_baton->loader, headers, NULL, NULL, NULL, node->pool));
 	} else {
-		printf("%s: %s\n", SVN_REPOS_DUMPFILE_NODE_PATH, path);
+		printf("\n\n");
 	}
-	printf("%s: delete\n", SVN_REPOS_DUMPFILE_NODE_ACTION);
-	printf("\n\n");
 
 	/* Don't use the copy information of the parent */
 	node->cp_info = CPI_NONE;
@@ -577,7 +867,10 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 	dump_options_t *opts = de_baton->opts;
 	const char *path = node->path;
 	unsigned long prop_len, content_len;
-	char dump_content = 0, dump_props = 0;
+	svn_stringbuf_t *props_block = NULL;
+	char dump_content = 0, dump_props = 0, copied_props = 0;
+	const char *fpath = NULL;
+	apr_hash_t *headers = NULL, *load_props = NULL, *load_del_props = NULL;
 	apr_hash_index_t *hi;
 	svn_error_t *err;
 
@@ -626,37 +919,37 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 		return delta_dump_replace(node);
 	}
 
-	/* Dump node path */
-	if (opts->prefix != NULL) {
-		printf("%s: %s%s\n", SVN_REPOS_DUMPFILE_NODE_PATH, opts->prefix, path);
-	} else {
-		printf("%s: %s\n", SVN_REPOS_DUMPFILE_NODE_PATH, path);
+	/* When loading directly, the headers are collected instead */
+	if (de_baton->loader != NULL) {
+		headers = apr_hash_make(node->pool);
 	}
 
+	/* Dump node path */
+	delta_header(headers, SVN_REPOS_DUMPFILE_NODE_PATH, delta_dump_path(opts, path, node->pool));
+
 	/* Dump node kind */
 	if (node->action != 'D') {
-		printf("%s: %s\n", SVN_REPOS_DUMPFILE_NODE_KIND, node->kind == svn_node_file ? "file" : "dir");
+		delta_header(headers, SVN_REPOS_DUMPFILE_NODE_KIND, node->kind == svn_node_file ? "file" : "dir");
 	}
 
 	/* Dump action */
-	printf("%s: ", SVN_REPOS_DUMPFILE_NODE_ACTION);
 	switch (node->action) {
 		case 'M':
-			printf("change\n");
+			delta_header(headers, SVN_REPOS_DUMPFILE_NODE_ACTION, "change");
 			if (!(de_baton->opts->flags & DF_INITIAL_DRY_RUN)) {
 				L1(_("     * editing path : %s ... "), path);
 			}
 			break;
 
 		case 'A':
-			printf("add\n");
+			delta_header(headers, SVN_REPOS_DUMPFILE_NODE_ACTION, "add");
 			if (!(de_baton->opts->flags & DF_INITIAL_DRY_RUN)) {
 				L1(_("     * adding path : %s ... "), path);
 			}
 			break;
 
 		case 'D':
-			printf("delete\n");
+			delta_header(headers, SVN_REPOS_DUMPFILE_NODE_ACTION, "delete");
 			if (!(de_baton->opts->flags & DF_INITIAL_DRY_RUN)) {
 				L1(_("     * deleting path : %s ... "), path);
 			}
@@ -666,7 +959,7 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 			goto finish;
 
 		case 'R':
-			printf("replace\n");
+			delta_header(headers, SVN_REPOS_DUMPFILE_NODE_ACTION, "replace");
 			break;
 	}
 
@@ -686,12 +979,8 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 	if (node->cp_info == CPI_COPY && node->copyfrom_path) {
 		const char *copyfrom_path = delta_get_local_copyfrom_path(session->prefix, node->copyfrom_path);
 
-		printf("%s: %ld\n", SVN_REPOS_DUMPFILE_NODE_COPYFROM_REV, node->copyfrom_rev_local);
-		if (opts->prefix != NULL) {
-			printf("%s: %s%s\n", SVN_REPOS_DUMPFILE_NODE_COPYFROM_PATH, opts->prefix, copyfrom_path);
-		} else {
-			printf("%s: %s\n", SVN_REPOS_DUMPFILE_NODE_COPYFROM_PATH, copyfrom_path);
-		}
+		delta_header(headers, SVN_REPOS_DUMPFILE_NODE_COPYFROM_REV, apr_psprintf(node->pool, "%ld", node->copyfrom_rev_local));
+		delta_header(headers, SVN_REPOS_DUMPFILE_NODE_COPYFROM_PATH, delta_dump_path(opts, copyfrom_path, node->pool));
 
 		/* Maybe we don't need to dump the contents */
 		if ((node->action == 'A') && (node->kind == svn_node_file)) {
@@ -711,6 +1000,14 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 			}
 		}
 
+		/* The same applies to the properties */
+		if (delta_copied_props(node, copyfrom_path)) {
+			DEBUG_MSG("properties match copy source\n");
+			node->props_changed = 0;
+			dump_props = 0;
+			copied_props = 1;
+		}
+
 		if (!dump_content && !node->props_changed) {
 			goto finish;
 		} else if (node->kind == svn_node_dir) {
@@ -720,9 +1017,11 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 
 	/* Deltify? */
 	if (dump_content && (opts->flags & DF_USE_DELTAS)) {
+		apr_time_t start = stats_timer_start();
 		if ((err = delta_deltify_node(node))) {
 			return err;
 		}
+		stats_timer_stop(ST_TEMP_IO, start);
 	}
 
 #ifdef DUMP_DEBUG
@@ -742,70 +1041,70 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 	prop_len = 0;
 	content_len = 0;
 
-	/* Dump property size */
-	for (hi = apr_hash_first(node->pool, node->properties); hi; hi = apr_hash_next(hi)) {
-		const char *key;
-		svn_string_t *value;
-		apr_hash_this(hi, (const void **)&key, NULL, (void **)&value);
-		/* Don't dump the property if it has been deleted */
-		if (apr_hash_get(node->del_properties, key, APR_HASH_KEY_STRING) != NULL) {
-			continue;
+	/* Dump property size, unless the properties are inherited from the copy source */
+	if (!copied_props && headers != NULL) {
+		/* The loader takes the property hashes as they are */
+		if (apr_hash_count(node->properties) > 0 || (opts->dump_format == 3 && apr_hash_count(node->del_properties) > 0)) {
+			dump_props = 1;
 		}
-		prop_len += property_strlen(node->pool, key, value->data);
-	}
-	/* In dump format version 3, deleted properties should be dumped, too */
-	if (opts->dump_format == 3) {
-		for (hi = apr_hash_first(node->pool, node->del_properties); hi; hi = apr_hash_next(hi)) {
-			const char *key;
-			apr_hash_this(hi, (const void **)&key, NULL, NULL);
-			prop_len += property_del_strlen(node->pool, key);
+	} else if (!copied_props) {
+		props_block = delta_property_block(node);
+		prop_len += props_block->len;
+		/* In dump format version 3, deleted properties should be dumped, too */
+		if (opts->dump_format == 3) {
+			for (hi = apr_hash_first(node->pool, node->del_properties); hi; hi = apr_hash_next(hi)) {
+				const char *key;
+				apr_hash_this(hi, (const void **)&key, NULL, NULL);
+				prop_len += property_del_strlen(node->pool, key);
+			}
+		}
+		if ((prop_len > 0)) {
+			dump_props = 1;
 		}
-	}
-	if ((prop_len > 0)) {
-		dump_props = 1;
 	}
 	if (dump_props) {
 		if (opts->dump_format == 3) {
-			printf("%s: true\n", SVN_REPOS_DUMPFILE_PROP_DELTA);
+			delta_header(headers, SVN_REPOS_DUMPFILE_PROP_DELTA, "true");
 		}
 
-		prop_len += PROPS_END_LEN;
-		printf("%s: %lu\n", SVN_REPOS_DUMPFILE_PROP_CONTENT_LENGTH, prop_len);
+		if (headers == NULL) {
+			prop_len += PROPS_END_LEN;
+			printf("%s: %lu\n", SVN_REPOS_DUMPFILE_PROP_CONTENT_LENGTH, prop_len);
+		}
 	}
 
 	/* Dump content size */
 	if (dump_content) {
-		char *fpath = (opts->flags & DF_USE_DELTAS) ? node->delta_filename : node->filename;
-		apr_finfo_t *info = apr_pcalloc(node->pool, sizeof(apr_finfo_t));
-		if (apr_stat(info, fpath, APR_FINFO_SIZE, node->pool) != APR_SUCCESS) {
-			DEBUG_MSG("delta_dump_node: FATAL: cannot stat %s\n", node->filename);
-			return svn_error_create(1, NULL, apr_psprintf(session->pool, "Cannot stat %s", node->filename));
-		}
-		content_len = (unsigned long)info->size;
+		fpath = (opts->flags & DF_USE_DELTAS) ? node->delta_filename : node->filename;
 
 		if (opts->flags & DF_USE_DELTAS) {
-			printf("%s: true\n", SVN_REPOS_DUMPFILE_TEXT_DELTA);
+			delta_header(headers, SVN_REPOS_DUMPFILE_TEXT_DELTA, "true");
+		}
+		if (headers == NULL) {
+			apr_off_t size;
+			SVN_ERR(text_store_size(&size, fpath, node->pool));
+			content_len = (unsigned long)size;
+			printf("%s: %lu\n", SVN_REPOS_DUMPFILE_TEXT_CONTENT_LENGTH, content_len);
 		}
-		printf("%s: %lu\n", SVN_REPOS_DUMPFILE_TEXT_CONTENT_LENGTH, content_len);
 
 		if (*node->md5sum != 0x00) {
-			printf("%s: %s\n", SVN_REPOS_DUMPFILE_TEXT_CONTENT_MD5, svn_md5_digest_to_cstring(node->md5sum, node->pool));
+			delta_header(headers, SVN_REPOS_DUMPFILE_TEXT_CONTENT_MD5, svn_md5_digest_to_cstring(node->md5sum, node->pool));
+		}
+	}
+
+	/* The loader receives properties and content along with the headers */
+	if (headers != NULL) {
+		if (dump_props) {
+			load_props = node->properties;
+			load_del_props = (opts->dump_format == 3 ? node->del_properties : NULL);
 		}
+		goto finish;
 	}
 	printf("%s: %lu\n\n", SVN_REPOS_DUMPFILE_CONTENT_LENGTH, (unsigned long)prop_len+content_len);
 
 	/* Dump properties */
 	if (dump_props) {
-		for (hi = apr_hash_first(node->pool, node->properties); hi; hi = apr_hash_next(hi)) {
-			const char *key;
-			svn_string_t *value;
-			apr_hash_this(hi, (const void **)&key, NULL, (void **)&value);
-			/* Don't dump the property if it has been deleted */
-			if (apr_hash_get(node->del_properties, key, APR_HASH_KEY_STRING) != NULL) {
-				continue;
-			}
-			property_dump(key, value->data);
-		}
+		fwrite(props_block->data, 1, props_block->len, stdout);
 		/* In dump format version 3, deleted properties should be dumped, too */
 		if (opts->dump_format == 3) {
 			for (hi = apr_hash_first(node->pool, node->del_properties); hi; hi = apr_hash_next(hi)) {
@@ -821,36 +1120,43 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 	if (dump_content) {
 		svn_error_t *err;
 		apr_pool_t *pool = svn_pool_create(node->pool);
-		const char *fpath = (opts->flags & DF_USE_DELTAS) ? node->delta_filename : node->filename;
+		apr_time_t start = stats_timer_start();
 
 		fflush(stdout);
 		if ((err = delta_cat_file(pool, fpath))) {
 			return err;
 		}
 		fflush(stdout);
+		stats_timer_stop(ST_TEMP_IO, start);
 
 		svn_pool_destroy(pool);
-#ifndef DUMP_DEBUG
-		if (opts->flags & DF_USE_DELTAS) {
-			DEBUG_MSG("delta_dump_node(%s): Removing delta file %s\n", node->path, node->delta_filename);
-			if (apr_file_remove(node->delta_filename, node->pool) != APR_SUCCESS) {
-				DEBUG_MSG("delta_dump_node(%s): Cannot remove file %s\n", node->path, node->delta_filename);
-			}
-		}
-#endif
 	}
 
 finish:
-	printf("\n\n");
+	if (headers != NULL) {
+		SVN_ERR(load_node(de_baton->loader, headers, load_props, load_del_props, fpath, node->pool));
+	} else {
+		printf("\n\n");
+	}
+#ifndef DUMP_DEBUG
+	if (dump_content && (opts->flags & DF_USE_DELTAS)) {
+		DEBUG_MSG("delta_dump_node(%s): Removing delta %s\n", node->path, node->delta_filename);
+		text_store_remove(node->delta_filename);
+	}
+#endif
 	delta_mark_node(node);
 
+	/* The texts may still be read by an unused background job */
+	if (node->deltify_job != NULL) {
+		delta_release_job(node->deltify_job);
+		node->deltify_job = NULL;
+	}
+
 	/* Remove the old file if any - it's not needed any more */
 #ifndef DUMP_DEBUG
 	if (node->old_filename) {
-		DEBUG_MSG("de_close_file(%s): Removing old file %s\n", node->path, node->old_filename);
-		if (apr_file_remove(node->old_filename, node->pool) != APR_SUCCESS) {
-			DEBUG_MSG("de_close_file(%s): Cannot remove old file %s\n", node->path, node->old_filename);
-		}
+		DEBUG_MSG("de_close_file(%s): Removing old text %s\n", node->path, node->old_filename);
+		text_store_remove(node->old_filename);
 	}
 #endif
 
@@ -918,9 +1224,6 @@ static svn_error_t *de_open_root(void *edit_baton, svn_revnum_t base_revision, a
 	de_baton->root_node = node;
 
 	*root_baton = node;
-#ifdef USE_TIMING
-	tm_de_apply_textdelta = 0.0f;
-#endif
 	return SVN_NO_ERROR;
 }
 
@@ -930,8 +1233,8 @@ static svn_error_t *de_delete_entry(const char *path, svn_revnum_t revision, voi
 {
 	de_node_baton_t *node;
 	de_node_baton_t *parent = (de_node_baton_t *)parent_baton;
-	apr_hash_index_t *hi;
-	int pathlen;
+	de_collect_baton_t collect;
+	int i;
 
 	path = session_obfuscate(parent->de_baton->session, pool, path);
 	DEBUG_MSG("de_delete_entry(%s@%ld)\n", path, revision);
@@ -947,19 +1250,22 @@ static svn_error_t *de_delete_entry(const char *path, svn_revnum_t revision, voi
 	}
 #endif
 
-	/* This node might be a directory, so clear the data of all children */
-	pathlen = strlen(node->path);
-	for (hi = rhash_first(pool, delta_hash); hi; hi = rhash_next(hi)) {
-		const char *npath;
-		char *filename;
-		rhash_this(hi, (const void **)&npath, NULL, (void **)&filename);
-		/* TODO: This is a small hack to make sure the node is a directory */
-		if (!strncmp(node->path, npath, pathlen) && (npath[pathlen] == '/')) {
+	/*
+	 * This node might be a directory, so clear the data of all children.
+	 * The paths are collected first since the index can't be modified
+	 * while walking it.
+	 */
+	collect.paths = apr_array_make(pool, 0, sizeof(const char *));
+	collect.pool = pool;
+	cb_tree_walk_prefixed(&path_index, apr_pstrcat(pool, node->path, "/", NULL), delta_collect_path, &collect);
+	for (i = 0; i < collect.paths->nelts; i++) {
+		const char *npath = APR_ARRAY_IDX(collect.paths, i, const char *);
+		char *filename = rhash_get(delta_hash, npath, APR_HASH_KEY_STRING);
+
+		if (filename != NULL) {
 #ifndef DUMP_DEBUG
-			DEBUG_MSG("de_delete_entry(%s): Removing file %s\n", node->path, filename);
-			if (apr_file_remove(filename, node->pool) != APR_SUCCESS) {
-				DEBUG_MSG("de_delete_entry(%s): Cannot remove file %s\n", node->path, filename);
-			}
+			DEBUG_MSG("de_delete_entry(%s): Removing text %s\n", node->path, filename);
+			text_store_remove(filename);
 #endif
 
 			/* Delete property data */
@@ -969,16 +1275,10 @@ static svn_error_t *de_delete_entry(const char *path, svn_revnum_t revision, voi
 			DEBUG_MSG("de_delete_entry(%s): deleting %s from delta_hash\n", node->path, npath);
 			rhash_set(delta_hash, npath, APR_HASH_KEY_STRING, NULL, 0);
 		}
-	}
 
-	for (hi = rhash_first(pool, md5_hash); hi; hi = rhash_next(hi)) {
-		const char *npath;
-		char *md5sum;
-		rhash_this(hi, (const void **)&npath, NULL, (void **)&md5sum);
-		if (!strncmp(node->path, npath, pathlen) && (npath[pathlen] == '/')) {
-			DEBUG_MSG("deleting %s from md5_hash\n", npath);
-			rhash_set(md5_hash, npath, APR_HASH_KEY_STRING, NULL, 0);
-		}
+		DEBUG_MSG("deleting %s from md5_hash\n", npath);
+		rhash_set(md5_hash, npath, APR_HASH_KEY_STRING, NULL, 0);
+		cb_tree_delete(&path_index, npath);
 	}
 
 	property_delete(node->de_baton->prop_store, node->path, pool);
@@ -1086,7 +1386,9 @@ static svn_error_t *de_change_dir_prop(void *dir_baton, const char *name, const
 
 	if (value != NULL) {
 		apr_hash_set(node->properties, apr_pstrdup(node->pool, name), APR_HASH_KEY_STRING, svn_string_dup(value, node->pool));
+		apr_hash_set(node->del_properties, name, APR_HASH_KEY_STRING, NULL);
 	} else {
+		apr_hash_set(node->properties, name, APR_HASH_KEY_STRING, NULL);
 		apr_hash_set(node->del_properties, apr_pstrdup(node->pool, name), APR_HASH_KEY_STRING, (void *)0x1);
 	}
 	node->props_changed = 1;
@@ -1105,10 +1407,11 @@ static svn_error_t *de_close_directory(void *dir_baton, apr_pool_t *pool)
 	DEBUG_MSG("de_close_directory(%s): dump_needed = %d\n", node->path, (int)node->dump_needed);
 
 	/* Save properties for next time */
-	ret = property_store(node->de_baton->prop_store, node->path, node->properties, pool);
+	ret = property_store(node->de_baton->prop_store, node->path, node->properties, node->de_baton->log_revision->revision, pool);
 	if (ret != 0) {
 		return svn_error_createf(1, NULL, _("Unable to store properties for %s (%d)\n"), node->path, ret);
 	}
+	delta_remember_props_id(node);
 	return SVN_NO_ERROR;
 }
 
@@ -1217,53 +1520,36 @@ static svn_error_t *de_open_file(const char *path, void *parent_baton, svn_revnu
 /* Subversion delta editor callback */
 static svn_error_t *de_apply_textdelta(void *file_baton, const char *base_checksum, apr_pool_t *pool, svn_txdelta_window_handler_t *handler, void **handler_baton)
 {
-	apr_file_t *src_file = NULL, *dest_file = NULL;
-	apr_status_t status;
 	svn_stream_t *src_stream, *dest_stream;
 	de_node_baton_t *node = (de_node_baton_t *)file_baton;
-	dump_options_t *opts = node->de_baton->opts;
-#ifdef USE_TIMING
-	stopwatch_t watch = stopwatch_create();
-#endif
+	const char *name;
 	char *filename;
 
 	DEBUG_MSG("de_apply_textdelta(%s)\n", node->path);
 
-	/* Create a new temporary file to write to */
-	node->filename = apr_psprintf(node->pool, "%s/td/XXXXXX", opts->temp_dir);
-	status = utils_mkstemp(&dest_file, node->filename, pool);
-	if (status) {
-		DEBUG_MSG("de_apply_textdelta(%s): Error creating temporary file in %s\n", node->path, opts->temp_dir);
-		return svn_error_wrap_apr(status, "Unable to create temporary file in %s", opts->temp_dir);
-	}
-	dest_stream = svn_stream_from_aprfile2(dest_file, FALSE, pool);
+	/* Create a new text to write to */
+	SVN_ERR(text_store_write(&dest_stream, &name, pool));
+	node->filename = apr_pstrdup(node->pool, name);
 
 	/* Update the local copy */
 	filename = rhash_get(delta_hash, node->path, APR_HASH_KEY_STRING);
 	if (filename == NULL) {
 		src_stream = svn_stream_empty(pool);
 	} else {
-		status = apr_file_open(&src_file, filename, APR_READ, 0600, pool);
-		if (status) {
-			DEBUG_MSG("de_apply_textdelta(%s): Error opening %s\n", node->path, filename);
-			return svn_error_wrap_apr(status, "Unable to open %s", filename);
-		}
-		src_stream = svn_stream_from_aprfile2(src_file, FALSE, pool);
+		SVN_ERR(text_store_read(&src_stream, filename, pool));
 	}
 
 	svn_txdelta_apply(src_stream, dest_stream, node->md5sum, node->path, pool, handler, handler_baton);
 
 	node->old_filename = apr_pstrdup(node->pool, filename);
 	rhash_set(delta_hash, node->path, APR_HASH_KEY_STRING, node->filename, RHASH_VAL_STRING);
+	cb_tree_insert(&path_index, node->path);
 
 	DEBUG_MSG("applying delta: %s -> %s\n", node->old_filename, node->filename);
 
 	node->applied_delta = 1;
 	node->dump_needed = 1;
 
-#ifdef USE_TIMING
-	tm_de_apply_textdelta += stopwatch_elapsed(&watch);
-#endif
 	return SVN_NO_ERROR;
 }
 
@@ -1282,7 +1568,9 @@ static svn_error_t *de_change_file_prop(void *file_baton, const char *name, cons
 
 	if (value != NULL) {
 		apr_hash_set(node->properties, apr_pstrdup(node->pool, name), APR_HASH_KEY_STRING, svn_string_dup(value, node->pool));
+		apr_hash_set(node->del_properties, name, APR_HASH_KEY_STRING, NULL);
 	} else {
+		apr_hash_set(node->properties, name, APR_HASH_KEY_STRING, NULL);
 		apr_hash_set(node->del_properties, apr_pstrdup(node->pool, name), APR_HASH_KEY_STRING, (void *)0x1);
 	}
 	node->props_changed = 1;
@@ -1299,10 +1587,20 @@ static svn_error_t *de_close_file(void *file_baton, const char *text_checksum, a
 	int ret;
 
 	/* Save properties for next time */
-	ret = property_store(node->de_baton->prop_store, node->path, node->properties, pool);
+	ret = property_store(node->de_baton->prop_store, node->path, node->properties, node->de_baton->log_revision->revision, pool);
 	if (ret != 0) {
 		return svn_error_createf(1, NULL, _("Unable to store properties for %s (%d)\n"), node->path, ret);
 	}
+	delta_remember_props_id(node);
+
+	/* The text is complete now, so the delta can be computed while the
+	   editor drive continues. Copied files are usually dumped without
+	   their contents, though */
+	if (node->applied_delta && (node->de_baton->opts->flags & DF_USE_DELTAS)
+	    && !(node->de_baton->opts->flags & DF_INITIAL_DRY_RUN)
+	    && !(node->action == 'A' && node->copyfrom_path != NULL)) {
+		SVN_ERR(delta_submit_deltify(node));
+	}
 	return SVN_NO_ERROR;
 }
 
@@ -1331,6 +1629,9 @@ static svn_error_t *de_close_edit(void *edit_baton, apr_pool_t *pool)
 		return err;
 	}
 
+	/* Texts may be removed below, so background jobs must be finished */
+	delta_discard_jobs(de_baton);
+
 	/*
 	 * There are probably some deleted nodes that haven't been dumped yet.
 	 * This will happen if nodes whose parent is a copy destination have been
@@ -1351,9 +1652,7 @@ static svn_error_t *de_close_edit(void *edit_baton, apr_pool_t *pool)
 			if (filename) {
 #ifndef DUMP_DEBUG
 				DEBUG_MSG("de_close_edit(): Removing %s\n", filename);
-				if (apr_file_remove(filename, pool) != APR_SUCCESS) {
-					DEBUG_MSG("de_close_edit(): Cannot remove file %s\n", filename);
-				}
+				text_store_remove(filename);
 #endif
 				rhash_set(delta_hash, path, APR_HASH_KEY_STRING, NULL, 0);
 			}
@@ -1408,9 +1707,6 @@ static svn_error_t *de_close_edit(void *edit_baton, apr_pool_t *pool)
 		}
 	}
 
-#ifdef USE_TIMING
-	DEBUG_MSG("apply_text_delta: %f seconds\n", tm_de_apply_textdelta);
-#endif
 	return SVN_NO_ERROR;
 }
 
@@ -1421,6 +1717,7 @@ static svn_error_t *de_abort_edit(void *edit_baton, apr_pool_t *pool)
 #ifdef DEBUG
 	DEBUG_MSG("abort_edit()\n");
 #endif
+	delta_discard_jobs((de_baton_t *)edit_baton);
 	return SVN_NO_ERROR;
 }
 
@@ -1520,17 +1817,122 @@ void delta_setup_editor(delta_editor_info_t *info, log_revision_t *log_revision,
 	baton->dumped_entries = apr_hash_make(baton->revision_pool);
 	baton->path_repo = info->path_repo;
 	baton->prop_store = info->property_storage;
+	baton->loader = info->loader;
+	baton->deltify_jobs = apr_array_make(baton->revision_pool, 0, sizeof(de_deltify_job_t *));
+	baton->prop_blocks = apr_hash_make(baton->revision_pool);
 	*editor_baton = baton;
 
 	/* Create global hashes if needed */
-	if (!hashes_created) {
-		apr_pool_t *hash_pool = svn_pool_create(info->session->pool);
+	delta_create_hashes(info->session->pool);
+}
 
-		md5_hash = rhash_make(hash_pool);
-		delta_hash = rhash_make(hash_pool);
 
-		hashes_created = 1;
+/* Writes the local file copies and checksums to a stream. The texts are
+   written to the 'td' subdirectory of the given directory */
+int delta_save_state(FILE *out, const char *dir, apr_pool_t *pool)
+{
+	apr_pool_t *subpool = svn_pool_create(pool);
+	apr_hash_index_t *hi;
+	const char *td = apr_psprintf(pool, "%s/td", dir);
+	unsigned long n;
+
+	if (apr_dir_make_recursive(td, APR_OS_DEFAULT, pool) != APR_SUCCESS) {
+		fprintf(stderr, _("ERROR: Unable to create directory %s\n"), td);
+		return -1;
 	}
+
+	n = (hashes_created ? rhash_count(delta_hash) : 0);
+	if (fwrite(&n, sizeof(n), 1, out) != 1) {
+		return -1;
+	}
+	for (hi = (n ? rhash_first(pool, delta_hash) : NULL); hi; hi = rhash_next(hi)) {
+		const char *path, *base, *dest;
+		char *filename;
+		apr_ssize_t klen;
+
+		rhash_this(hi, (const void **)(void *)&path, &klen, (void **)(void *)&filename);
+		base = filename;
+		dest = apr_psprintf(subpool, "%s/%s", td, base);
+
+		if (text_store_export(filename, dest, subpool) != 0) {
+			fprintf(stderr, _("ERROR: Unable to write %s\n"), dest);
+			return -1;
+		}
+		if (utils_write_chunk(out, path, klen) || utils_write_chunk(out, base, strlen(base))) {
+			return -1;
+		}
+		svn_pool_clear(subpool);
+	}
+
+	n = (hashes_created ? rhash_count(md5_hash) : 0);
+	if (fwrite(&n, sizeof(n), 1, out) != 1) {
+		return -1;
+	}
+	for (hi = (n ? rhash_first(pool, md5_hash) : NULL); hi; hi = rhash_next(hi)) {
+		const char *path;
+		unsigned char *md5sum;
+		apr_ssize_t klen;
+
+		rhash_this(hi, (const void **)(void *)&path, &klen, (void **)(void *)&md5sum);
+		if (utils_write_chunk(out, path, klen) || fwrite(md5sum, 1, APR_MD5_DIGESTSIZE, out) != APR_MD5_DIGESTSIZE) {
+			return -1;
+		}
+	}
+
+	svn_pool_destroy(subpool);
+	return 0;
+}
+
+
+/* Restores the local file copies and checksums written by delta_save_state().
+   The texts are copied into the text store */
+int delta_load_state(FILE *in, const char *dir, dump_options_t *opts, apr_pool_t *pool)
+{
+	apr_pool_t *subpool = svn_pool_create(pool);
+	unsigned long i, n;
+
+	delta_create_hashes(pool);
+
+	if (fread(&n, sizeof(n), 1, in) != 1) {
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		char *path, *base;
+		const char *src, *filename;
+		size_t len;
+
+		if (utils_read_chunk(in, &path, &len, subpool) || utils_read_chunk(in, &base, &len, subpool)) {
+			return -1;
+		}
+		src = apr_psprintf(subpool, "%s/td/%s", dir, base);
+		if (text_store_import(&filename, src, subpool) != 0) {
+			fprintf(stderr, _("ERROR: Unable to read %s\n"), src);
+			return -1;
+		}
+
+		rhash_set(delta_hash, path, APR_HASH_KEY_STRING, filename, RHASH_VAL_STRING);
+		cb_tree_insert(&path_index, path);
+		svn_pool_clear(subpool);
+	}
+
+	if (fread(&n, sizeof(n), 1, in) != 1) {
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		unsigned char md5sum[APR_MD5_DIGESTSIZE];
+		char *path;
+		size_t len;
+
+		if (utils_read_chunk(in, &path, &len, subpool) || fread(md5sum, 1, APR_MD5_DIGESTSIZE, in) != APR_MD5_DIGESTSIZE) {
+			return -1;
+		}
+		rhash_set(md5_hash, path, APR_HASH_KEY_STRING, md5sum, APR_MD5_DIGESTSIZE);
+		cb_tree_insert(&path_index, path);
+		svn_pool_clear(subpool);
+	}
+
+	svn_pool_destroy(subpool);
+	return 0;
 }
 
 
@@ -1540,6 +1942,7 @@ void delta_cleanup()
 	if (hashes_created) {
 		rhash_clear(md5_hash);
 		rhash_clear(delta_hash);
+		cb_tree_clear(&path_index);
 
 		hashes_created = 0;
 	}
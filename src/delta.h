@@ -25,6 +25,8 @@
 #define DELTA_H_
 
 
+#include <stdio.h>
+
 #include <svn_types.h>
 
 #include <apr_tables.h>
@@ -40,6 +42,7 @@ typedef struct {
 	dump_options_t *options;
 	struct path_repo_t *path_repo;
 	struct property_storage_t *property_storage;
+	struct load_t *loader;
 	apr_array_header_t *logs;
 } delta_editor_info_t;
 
@@ -53,6 +56,13 @@ svn_revnum_t delta_get_local_copyfrom_rev(svn_revnum_t original, dump_options_t
 /* Sets up a delta editor for dumping a revision */
 extern void delta_setup_editor(delta_editor_info_t *info, log_revision_t *log_revision, svn_revnum_t local_revnum, svn_delta_editor_t **editor, void **editor_baton, apr_pool_t *pool);
 
+/* Writes the local file copies and checksums to a stream. The files are
+   moved into the 'td' subdirectory of the given directory */
+extern int delta_save_state(FILE *out, const char *dir, apr_pool_t *pool);
+
+/* Restores the local file copies and checksums written by delta_save_state() */
+extern int delta_load_state(FILE *in, const char *dir, dump_options_t *opts, apr_pool_t *pool);
+
 /* Cleans up global resources */
 extern void delta_cleanup();
 
@@ -23,6 +23,7 @@
 
 #include <stdio.h>
 
+#include <svn_fs.h>
 #include <svn_pools.h>
 #include <svn_ra.h>
 #include <svn_repos.h>
@@ -32,10 +33,18 @@
 
 #include "main.h"
 #include "delta.h"
+#include "filter.h"
+#include "load.h"
 #include "log.h"
 #include "logger.h"
 #include "path_repo.h"
+#include "progress.h"
 #include "property.h"
+#include "reaper.h"
+#include "state.h"
+#include "stats.h"
+#include "text_store.h"
+#include "utils.h"
 
 #include "dump.h"
 
@@ -45,11 +54,38 @@
 /*---------------------------------------------------------------------------*/
 
 
+/* Prints an error returned by the loader */
+static char dump_load_error(svn_error_t *err)
+{
+	if (err) {
+		utils_handle_error(err, stderr, FALSE, "ERROR: ");
+		svn_error_clear(err);
+		return 1;
+	}
+	return 0;
+}
+
+
 /* Dumps a revision header using the given properties */
-static void dump_revision_header(apr_pool_t *pool, log_revision_t *revision, svn_revnum_t local_revnum, dump_options_t *opts)
+static char dump_revision_header(apr_pool_t *pool, log_revision_t *revision, svn_revnum_t local_revnum, dump_options_t *opts, load_t *loader)
 {
 	int props_length = 0;
 
+	/* Start a new revision when loading directly */
+	if (loader != NULL) {
+		apr_hash_t *props = apr_hash_make(pool);
+		if (revision->message != NULL) {
+			apr_hash_set(props, "svn:log", APR_HASH_KEY_STRING, revision->message);
+		}
+		if (revision->author != NULL) {
+			apr_hash_set(props, "svn:author", APR_HASH_KEY_STRING, revision->author);
+		}
+		if (revision->date != NULL) {
+			apr_hash_set(props, "svn:date", APR_HASH_KEY_STRING, revision->date);
+		}
+		return dump_load_error(load_revision(loader, local_revnum, props));
+	}
+
 	/* Determine length of revision properties */
 	if (revision->message != NULL) {
 		props_length += property_strlen(pool, "svn:log", revision->message);
@@ -81,15 +117,22 @@ static void dump_revision_header(apr_pool_t *pool, log_revision_t *revision, svn
 
 		printf(PROPS_END"\n");
 	}
+	return 0;
 }
 
 
 /* Dumps an empty revision for padding the given number */
-static void dump_padding_revision(apr_pool_t *pool, svn_revnum_t rev)
+static char dump_padding_revision(apr_pool_t *pool, svn_revnum_t rev, load_t *loader)
 {
 	int props_length = 0;
 	const char *message = "This is an empty revision for padding.";
 
+	if (loader != NULL) {
+		apr_hash_t *props = apr_hash_make(pool);
+		apr_hash_set(props, "svn:log", APR_HASH_KEY_STRING, message);
+		return dump_load_error(load_revision(loader, rev, props));
+	}
+
 	props_length += property_strlen(pool, "svn:log", message);
 	props_length += PROPS_END_LEN;
 
@@ -99,16 +142,17 @@ static void dump_padding_revision(apr_pool_t *pool, svn_revnum_t rev)
 
 	property_dump("svn:log", message);
 	printf(PROPS_END"\n");
+	return 0;
 }
 
 
 /* Creates (and possibly cleans up) the user prefix path.
    The new prefix will be allocated in the given pool. */
-static void dump_create_user_prefix(dump_options_t *opts, apr_pool_t *pool)
+static char dump_create_user_prefix(dump_options_t *opts, load_t *loader, apr_pool_t *pool)
 {
 	char *new_prefix, *s, *e;
 	if (opts->prefix == NULL) {
-		return;
+		return 0;
 	}
 
 	new_prefix = apr_pcalloc(pool, strlen(opts->prefix)+1);
@@ -123,9 +167,19 @@ static void dump_create_user_prefix(dump_options_t *opts, apr_pool_t *pool)
 		/* Append to new prefix and dump */
 		strncat(new_prefix, s, e - s);
 
-		printf("%s: %s\n", SVN_REPOS_DUMPFILE_NODE_PATH, new_prefix);
-		printf("%s: dir\n", SVN_REPOS_DUMPFILE_NODE_KIND);
-		printf("%s: add\n\n", SVN_REPOS_DUMPFILE_NODE_ACTION);
+		if (loader != NULL) {
+			apr_hash_t *headers = apr_hash_make(pool);
+			apr_hash_set(headers, SVN_REPOS_DUMPFILE_NODE_PATH, APR_HASH_KEY_STRING, new_prefix);
+			apr_hash_set(headers, SVN_REPOS_DUMPFILE_NODE_KIND, APR_HASH_KEY_STRING, "dir");
+			apr_hash_set(headers, SVN_REPOS_DUMPFILE_NODE_ACTION, APR_HASH_KEY_STRING, "add");
+			if (dump_load_error(load_node(loader, headers, NULL, NULL, NULL, pool))) {
+				return 1;
+			}
+		} else {
+			printf("%s: %s\n", SVN_REPOS_DUMPFILE_NODE_PATH, new_prefix);
+			printf("%s: dir\n", SVN_REPOS_DUMPFILE_NODE_KIND);
+			printf("%s: add\n\n", SVN_REPOS_DUMPFILE_NODE_ACTION);
+		}
 
 		strcat(new_prefix, "/");
 		s = e + 1;
@@ -133,21 +187,79 @@ static void dump_create_user_prefix(dump_options_t *opts, apr_pool_t *pool)
 
 	strcat(new_prefix, s);
 	opts->prefix = new_prefix;
+	return 0;
+}
+
+
+/* Runs a diff against two revisions by reading a local repository directly.
+   'done' is set to 0 if the RA layer needs to be used instead */
+static svn_error_t *dump_do_native_diff(session_t *session, dump_options_t *opts, svn_revnum_t src, svn_revnum_t dest, int start_empty, const svn_delta_editor_t *editor, void *editor_baton, char *done, apr_pool_t *pool)
+{
+	svn_fs_t *fs = svn_repos_fs(session->repos);
+	svn_fs_root_t *src_root, *tgt_root;
+	svn_node_kind_t src_kind, tgt_kind;
+
+	*done = 0;
+
+	/* Revision 0 is empty, which is only useful if dumping the root */
+	if (start_empty) {
+		if (strcmp(session->repos_path, "/")) {
+			return SVN_NO_ERROR;
+		}
+		src = 0;
+	}
+
+	SVN_ERR(svn_fs_revision_root(&src_root, fs, src, pool));
+	SVN_ERR(svn_fs_revision_root(&tgt_root, fs, dest, pool));
+
+	/* Anchoring the delta at a file or a missing path isn't possible */
+	SVN_ERR(svn_fs_check_path(&src_kind, src_root, session->repos_path, pool));
+	SVN_ERR(svn_fs_check_path(&tgt_kind, tgt_root, session->repos_path, pool));
+	if (src_kind != svn_node_dir || tgt_kind != svn_node_dir) {
+		return SVN_NO_ERROR;
+	}
+
+	/* Entry props are ignored by the delta editor */
+	SVN_ERR(svn_repos_dir_delta(src_root, session->repos_path, "", tgt_root, session->repos_path, editor, editor_baton, NULL, NULL, !(opts->flags & DF_DRY_RUN), TRUE, FALSE, TRUE, pool));
+	*done = 1;
+	return SVN_NO_ERROR;
 }
 
 
-/* Runs a diff against two revisions */
-static char dump_do_diff(session_t *session, dump_options_t *opts, svn_revnum_t src, svn_revnum_t dest, int start_empty, const svn_delta_editor_t *editor, void *editor_baton, apr_pool_t *pool)
+/* Runs a diff against two revisions, skipping excluded paths */
+static char dump_do_diff(session_t *session, dump_options_t *opts, svn_revnum_t src, svn_revnum_t dest, int start_empty, apr_hash_t *excluded, const svn_delta_editor_t *editor, void *editor_baton, apr_pool_t *pool)
 {
 	const svn_ra_reporter2_t *reporter;
 	void *report_baton;
 	svn_error_t *err;
 	apr_pool_t *subpool = svn_pool_create(pool);
-#ifdef USE_TIMING
-	stopwatch_t watch = stopwatch_create();
-#endif
+	apr_time_t start = stats_timer_start();
 
 	DEBUG_MSG("diffing %d against %d (start_empty = %d)\n", dest, src, start_empty);
+	filter_wrap_editor(&editor, &editor_baton, session->filter, subpool);
+	stats_wrap_editor(&editor, &editor_baton, subpool);
+
+	/* Bypass the RA layer for local repositories if possible */
+#ifdef USE_SINGLEFILE_DUMP
+	if (session->repos != NULL && session->file == NULL) {
+#else
+	if (session->repos != NULL) {
+#endif
+		char done;
+		err = dump_do_native_diff(session, opts, src, dest, start_empty, editor, editor_baton, &done, subpool);
+		if (err) {
+			utils_handle_error(err, stderr, FALSE, "ERROR: ");
+			svn_error_clear(err);
+			svn_pool_destroy(subpool);
+			return 1;
+		}
+		if (done) {
+			svn_pool_destroy(subpool);
+			stats_timer_stop(ST_DIFF, start);
+			return 0;
+		}
+	}
+
 #ifdef USE_SINGLEFILE_DUMP
 	err = svn_ra_do_diff2(session->ra, &reporter, &report_baton, dest, (session->file ? session->file : ""), TRUE, TRUE, TRUE, session->encoded_url, editor, editor_baton, subpool);
 #else
@@ -168,6 +280,22 @@ static char dump_do_diff(session_t *session, dump_options_t *opts, svn_revnum_t
 		return 1;
 	}
 
+	/* Claim that excluded subtrees are up-to-date, so the server won't send them */
+	if (session->filter != NULL) {
+		apr_array_header_t *paths = filter_report_paths(session->filter, excluded, subpool);
+		int i;
+
+		for (i = 0; i < paths->nelts; i++) {
+			err = reporter->set_path(report_baton, APR_ARRAY_IDX(paths, i, const char *), dest, FALSE, NULL, subpool);
+			if (err) {
+				utils_handle_error(err, stderr, FALSE, "ERROR: ");
+				svn_error_clear(err);
+				svn_pool_destroy(subpool);
+				return 1;
+			}
+		}
+	}
+
 	err = reporter->finish_report(report_baton, subpool);
 	if (err) {
 		utils_handle_error(err, stderr, FALSE, "ERROR: ");
@@ -177,9 +305,7 @@ static char dump_do_diff(session_t *session, dump_options_t *opts, svn_revnum_t
 	}
 
 	svn_pool_destroy(subpool);
-#ifdef USE_TIMING
-	DEBUG_MSG("dump_do_diff done in %f seconds\n", stopwatch_elapsed(&watch));
-#endif
+	stats_timer_stop(ST_DIFF, start);
 	return 0;
 }
 
@@ -263,8 +389,16 @@ dump_options_t dump_options_create()
 
 	opts.temp_dir = NULL;
 	opts.prefix = NULL;
+	opts.load_state_dir = NULL;
+	opts.save_state_dir = NULL;
+	opts.load_into = NULL;
 	opts.flags = 0x00;
 	opts.dump_format = 2;
+	opts.text_cache_size = 64 * 1024 * 1024;
+	opts.text_cache_threshold = 8 * 1024;
+	opts.threads = 2;
+	opts.delta_version = -1;
+	opts.delta_level = 5;
 
 	opts.start = 0;
 	opts.end = -1; /* HEAD */
@@ -287,9 +421,12 @@ char dump(session_t *session, dump_options_t *opts)
 	char logs_fetched = 0, ret = 0;
 	char start_mid = 0, show_local_rev = 1;
 	svn_revnum_t global_rev, local_rev = -1;
+	svn_revnum_t state_rev = -1, state_local_rev = -1;
+	svn_revnum_t resume_rev = -1;
 	int list_idx;
 	path_repo_t *path_repo;
 	property_storage_t *property_storage;
+	load_t *loader = NULL;
 	delta_editor_info_t delta_info;
 
 	/* Dumping with deltas requires dump format version 3 */
@@ -297,6 +434,15 @@ char dump(session_t *session, dump_options_t *opts)
 		opts->dump_format = 3;
 	}
 
+	/*
+	 * Uncompressed deltas are the default. The text deltas themselves are
+	 * usually small, so compressing them rarely saves more time on output
+	 * than it takes, and the dump can be loaded by any Subversion version.
+	 */
+	if (opts->delta_version < 0) {
+		opts->delta_version = 0;
+	}
+
 	/*
 	 * If start_mid is set, it is assumed we start somewhere (not at the beginning)
 	 * of the history and don't need information about prior revisions inside
@@ -306,11 +452,23 @@ char dump(session_t *session, dump_options_t *opts)
 		start_mid = 1;
 	}
 
+	/* A saved state determines where to continue */
+	if (opts->load_state_dir != NULL) {
+		if (state_check(opts->load_state_dir, session, opts, &state_rev, &state_local_rev, session->pool)) {
+			return 1;
+		}
+		start_mid = 1;
+	}
+
 	/* Determine the correct revision range */
 	DEBUG_MSG("initial range: %ld:%ld\n", opts->start, opts->end);
 	if (dump_determine_end(session, &opts->end)) {
 		return 1;
 	}
+	if ((opts->load_state_dir != NULL) && (opts->start > opts->end)) {
+		L0(_("* No new revisions since revision %ld.\n"), state_rev);
+		return 0;
+	}
 	if ((opts->start == 0) && (strlen(session->prefix) > 0)) {
 		if (log_get_range(session, &opts->start, &opts->end)) {
 			return 1;
@@ -345,6 +503,7 @@ char dump(session_t *session, dump_options_t *opts)
 		dummy.date = NULL;
 		dummy.message = NULL;
 		dummy.changed_paths = NULL;
+		dummy.excluded = NULL;
 		APR_ARRAY_PUSH(logs, log_revision_t) = dummy;
 	}
 
@@ -356,6 +515,15 @@ char dump(session_t *session, dump_options_t *opts)
 	if (path_repo == NULL) {
 		return 1;
 	}
+	if (text_store_init(opts->temp_dir, opts->text_cache_threshold, opts->text_cache_size, session->pool) != 0) {
+		return 1;
+	}
+	if (opts->load_into != NULL) {
+		loader = load_create(opts->load_into, session->pool);
+		if (loader == NULL) {
+			return 1;
+		}
+	}
 
 	/*
 	 * Decide whether the whole repository log should be fetched
@@ -369,34 +537,87 @@ char dump(session_t *session, dump_options_t *opts)
 		}
 		logs_fetched = 1;
 
-		/* Jump to local revision and fill the path hash for previous revisions */
-		L1(_("Preparing tree history... "));
-		local_rev = 0;
-		while ((local_rev < (long int)logs->nelts) && (APR_ARRAY_IDX(logs, local_rev, log_revision_t).revision < opts->start)) {
-			svn_revnum_t phrev = ((opts->flags & DF_KEEP_REVNUMS) ? APR_ARRAY_IDX(logs, local_rev, log_revision_t).revision : local_rev);
-			if (path_repo_commit_log(path_repo, session, opts, &APR_ARRAY_IDX(logs, local_rev, log_revision_t), phrev, logs, log_pool) != 0) {
+		if (opts->load_state_dir != NULL) {
+			/* Jump to local revision and restore the state of the previous run */
+			int state_idx = 0;
+			L1(_("Loading saved state... "));
+			while ((state_idx < logs->nelts) && (APR_ARRAY_IDX(logs, state_idx, log_revision_t).revision <= state_rev)) {
+				++state_idx;
+			}
+			local_rev = state_idx;
+			while ((local_rev < (long int)logs->nelts) && (APR_ARRAY_IDX(logs, local_rev, log_revision_t).revision < opts->start)) {
+				++local_rev;
+			}
+			if (state_idx == 0 || state_local_rev != ((opts->flags & DF_KEEP_REVNUMS) ? APR_ARRAY_IDX(logs, state_idx-1, log_revision_t).revision : state_idx-1)) {
+				L1(_("failed\n"));
+				fprintf(stderr, _("ERROR: The saved state does not match the repository history.\n"));
 				return 1;
 			}
-			L2("\r\033[0K%s%ld", _("Preparing tree history... "), local_rev);
-			if (loglevel >= 2) {
-				fflush(stderr);
+			if (state_load(opts->load_state_dir, opts, path_repo, property_storage, session->pool)) {
+				L1(_("failed\n"));
+				return 1;
 			}
-			++local_rev;
-		}
-		if (loglevel == 2) {
-			L2("\r\033[0K%s%s", _("Preparing tree history... "), _("done\n"));
-		} else  {
 			L1(_("done\n"));
-		}
 
-		/* The first revision is a dry run.
-		   This is because we need to get the data of the previous
-		   revision first in order to properly apply the received deltas. */
-		opts->flags |= DF_INITIAL_DRY_RUN;
-		if (local_rev > 1 || strlen(session->prefix) == 0) {
-			--local_rev;
+			if (state_idx < local_rev) {
+				/*
+				 * There are revisions between the saved state and the start
+				 * revision. Their tree history is built from the log, and the
+				 * file contents are updated by a dry run against the saved
+				 * state, so only deltas need to be transferred.
+				 */
+				while (state_idx < local_rev) {
+					svn_revnum_t phrev = ((opts->flags & DF_KEEP_REVNUMS) ? APR_ARRAY_IDX(logs, state_idx, log_revision_t).revision : state_idx);
+					if (path_repo_commit_log(path_repo, session, opts, &APR_ARRAY_IDX(logs, state_idx, log_revision_t), phrev, logs, log_pool) != 0) {
+						return 1;
+					}
+					++state_idx;
+				}
+				opts->flags |= DF_INITIAL_DRY_RUN;
+				--local_rev;
+				opts->start = APR_ARRAY_IDX(logs, local_rev, log_revision_t).revision;
+				resume_rev = state_rev;
+			} else {
+				/* The last revision of the previous run is the diff base */
+				opts->start = APR_ARRAY_IDX(logs, local_rev-1, log_revision_t).revision;
+				if (local_rev >= (long int)logs->nelts) {
+					L0(_("* No new revisions since revision %ld.\n"), state_rev);
+					svn_pool_destroy(log_pool);
+					delta_cleanup();
+					text_store_cleanup();
+					return 0;
+				}
+			}
+		} else {
+			/* Jump to local revision and fill the path hash for previous revisions */
+			L1(_("Preparing tree history... "));
+			local_rev = 0;
+			while ((local_rev < (long int)logs->nelts) && (APR_ARRAY_IDX(logs, local_rev, log_revision_t).revision < opts->start)) {
+				svn_revnum_t phrev = ((opts->flags & DF_KEEP_REVNUMS) ? APR_ARRAY_IDX(logs, local_rev, log_revision_t).revision : local_rev);
+				if (path_repo_commit_log(path_repo, session, opts, &APR_ARRAY_IDX(logs, local_rev, log_revision_t), phrev, logs, log_pool) != 0) {
+					return 1;
+				}
+				L2("\r\033[0K%s%ld", _("Preparing tree history... "), local_rev);
+				if (loglevel >= 2) {
+					fflush(stderr);
+				}
+				++local_rev;
+			}
+			if (loglevel == 2) {
+				L2("\r\033[0K%s%s", _("Preparing tree history... "), _("done\n"));
+			} else  {
+				L1(_("done\n"));
+			}
+
+			/* The first revision is a dry run.
+			   This is because we need to get the data of the previous
+			   revision first in order to properly apply the received deltas. */
+			opts->flags |= DF_INITIAL_DRY_RUN;
+			if (local_rev > 1 || strlen(session->prefix) == 0) {
+				--local_rev;
+			}
+			opts->start = APR_ARRAY_IDX(logs, local_rev, log_revision_t).revision;
 		}
-		opts->start = APR_ARRAY_IDX(logs, local_rev, log_revision_t).revision;
 
 		svn_pool_destroy(log_pool);
 	} else {
@@ -408,13 +629,21 @@ char dump(session_t *session, dump_options_t *opts)
 
 	/* Write dumpfile header */
 	if (!(opts->flags & DF_NO_INCREMENTAL_HEADER) || !start_mid) {
-		printf("%s: %d\n\n", SVN_REPOS_DUMPFILE_MAGIC_HEADER, opts->dump_format);
+		if (loader == NULL) {
+			printf("%s: %d\n\n", SVN_REPOS_DUMPFILE_MAGIC_HEADER, opts->dump_format);
+		}
 		if ((opts->prefix == NULL) && (strlen(session->prefix) == 0)) {
 			const char *uuid;
 			if (dump_fetch_uuid(session, &uuid)) {
 				return 1;
 			}
-			printf("UUID: %s\n\n", uuid);
+			if (loader != NULL) {
+				if (dump_load_error(load_uuid(loader, uuid))) {
+					return 1;
+				}
+			} else {
+				printf("UUID: %s\n\n", uuid);
+			}
 		}
 	}
 
@@ -423,6 +652,7 @@ char dump(session_t *session, dump_options_t *opts)
 		opts->end = APR_ARRAY_IDX(logs, logs->nelts-1, log_revision_t).revision;
 		DEBUG_MSG("logs_fetched, opts->end set to %ld\n", opts->end);
 	}
+	progress_set_range(opts->start, opts->end);
 
 	/* Pre-dumping initialization */
 	global_rev = opts->start;
@@ -434,6 +664,13 @@ char dump(session_t *session, dump_options_t *opts)
 		if (opts->flags & DF_KEEP_REVNUMS) {
 			local_rev = opts->start;
 		}
+		/* With a restored state, there's no dry run for the diff base */
+		if (opts->load_state_dir != NULL && resume_rev < 0) {
+			++global_rev;
+			if (opts->flags & DF_KEEP_REVNUMS) {
+				++local_rev;
+			}
+		}
 	}
 	DEBUG_MSG("start_mid = %d, list_idx = %d\n", start_mid, list_idx);
 
@@ -446,6 +683,7 @@ char dump(session_t *session, dump_options_t *opts)
 	delta_info.options = opts;
 	delta_info.path_repo = path_repo;
 	delta_info.property_storage = property_storage;
+	delta_info.loader = loader;
 	delta_info.logs = logs;
 
 	/* Start dumping */
@@ -453,7 +691,9 @@ char dump(session_t *session, dump_options_t *opts)
 		svn_delta_editor_t *editor;
 		void *editor_baton;
 		svn_revnum_t diff_rev;
+		int start_empty;
 		apr_pool_t *revpool = svn_pool_create(session->pool);
+		apr_time_t rev_start = stats_timer_start();
 
 		DEBUG_MSG("dump loop start: local_rev = %ld, global_rev = %ld, list_idx = %d\n", local_rev, global_rev, list_idx);
 
@@ -477,7 +717,10 @@ char dump(session_t *session, dump_options_t *opts)
 
 			/* Padd with empty revisions if neccessary */
 			while (local_rev < APR_ARRAY_IDX(logs, list_idx, log_revision_t).revision) {
-				dump_padding_revision(padpool, local_rev);
+				if (dump_padding_revision(padpool, local_rev, loader)) {
+					ret = 1;
+					break;
+				}
 				if (path_repo_commit(path_repo, local_rev, padpool) != 0) {
 					ret = 1;
 					break;
@@ -488,8 +731,13 @@ char dump(session_t *session, dump_options_t *opts)
 					L1(_("------ Padded revision %ld <<<\n\n"), local_rev);
 				}
 				/* The first revision sets up the user prefix */
-				if (local_rev == 1) {
-					dump_create_user_prefix(opts, session->pool);
+				if (local_rev == 1 && dump_create_user_prefix(opts, loader, session->pool)) {
+					ret = 1;
+					break;
+				}
+				if (loader != NULL && dump_load_error(load_close_revision(loader))) {
+					ret = 1;
+					break;
 				}
 				++local_rev;
 
@@ -503,11 +751,15 @@ char dump(session_t *session, dump_options_t *opts)
 
 		/* Dump the revision header */
 		if (!(opts->flags & DF_INITIAL_DRY_RUN)) {
-			dump_revision_header(revpool, &APR_ARRAY_IDX(logs, list_idx, log_revision_t), local_rev, opts);
+			if (dump_revision_header(revpool, &APR_ARRAY_IDX(logs, list_idx, log_revision_t), local_rev, opts, loader)) {
+				ret = 1;
+				break;
+			}
 
 			/* The first revision sets up the user prefix */
-			if (local_rev == 1) {
-				dump_create_user_prefix(opts, session->pool);
+			if (local_rev == 1 && dump_create_user_prefix(opts, loader, session->pool)) {
+				ret = 1;
+				break;
 			}
 		}
 
@@ -529,6 +781,13 @@ char dump(session_t *session, dump_options_t *opts)
 			diff_rev = opts->start;
 #endif
 		}
+		start_empty = (global_rev == opts->start);
+
+		/* The saved state is the base for the initial dry run */
+		if ((opts->flags & DF_INITIAL_DRY_RUN) && resume_rev >= 0) {
+			diff_rev = resume_rev;
+			start_empty = 0;
+		}
 		DEBUG_MSG("global = %ld, diff = %ld, start = %ld\n", global_rev, diff_rev, opts->start);
 
 		if (!(opts->flags & DF_INITIAL_DRY_RUN)) {
@@ -539,7 +798,7 @@ char dump(session_t *session, dump_options_t *opts)
 
 		/* Setup the delta editor and run a diff */
 		delta_setup_editor(&delta_info, &APR_ARRAY_IDX(logs, list_idx, log_revision_t), local_rev, &editor, &editor_baton, revpool);
-		if (dump_do_diff(session, opts, diff_rev, APR_ARRAY_IDX(logs, list_idx, log_revision_t).revision, (global_rev == opts->start), editor, editor_baton, revpool)) {
+		if (dump_do_diff(session, opts, diff_rev, APR_ARRAY_IDX(logs, list_idx, log_revision_t).revision, start_empty, APR_ARRAY_IDX(logs, list_idx, log_revision_t).excluded, editor, editor_baton, revpool)) {
 			ret = 1;
 			break;
 		}
@@ -570,6 +829,14 @@ char dump(session_t *session, dump_options_t *opts)
 			break;
 		}
 
+		/* Commit the revision to the target repository */
+		if (loader != NULL && !(opts->flags & DF_INITIAL_DRY_RUN)) {
+			if (dump_load_error(load_close_revision(loader))) {
+				ret = 1;
+				break;
+			}
+		}
+
 		if (loglevel == 0 && !(opts->flags & DF_INITIAL_DRY_RUN)) {
 			if (show_local_rev) {
 				L0(_("* Dumped revision %ld (local %ld).\n"), APR_ARRAY_IDX(logs, list_idx, log_revision_t).revision, local_rev);
@@ -583,6 +850,10 @@ char dump(session_t *session, dump_options_t *opts)
 				L1(_("done\n"));
 			}
 		}
+		if (!(opts->flags & DF_INITIAL_DRY_RUN)) {
+			stats_revision_done(APR_ARRAY_IDX(logs, list_idx, log_revision_t).revision, rev_start);
+			progress_update(APR_ARRAY_IDX(logs, list_idx, log_revision_t).revision, local_rev);
+		}
 
 		global_rev = APR_ARRAY_IDX(logs, list_idx, log_revision_t).revision+1;
 		++local_rev;
@@ -591,15 +862,32 @@ char dump(session_t *session, dump_options_t *opts)
 		   are dumped dry */
 		opts->flags &= ~DF_INITIAL_DRY_RUN;
 
+		/* Let the reaper remove files that aren't needed anymore */
+		reaper_flush();
+
 		apr_pool_destroy(revpool);
 	} while (global_rev <= opts->end);
 
 #ifdef DEBUG_PATH_REPO
-	if (!strlen(session->prefix) || (opts->flags & DF_KEEP_REVNUMS)) {
-		path_repo_test_all(path_repo, session, session->pool);
+	if (ret == 0 && (!strlen(session->prefix) || (opts->flags & DF_KEEP_REVNUMS))) {
+		if (path_repo_test_all(path_repo, session, session->pool) != 0) {
+			ret = 1;
+		}
 	}
 #endif
 
+	/* Save the state for the next incremental run */
+	if (ret == 0 && opts->save_state_dir != NULL) {
+		L1(_("Saving state... "));
+		if (state_save(opts->save_state_dir, session, opts, path_repo, property_storage, opts->end, local_rev-1, session->pool)) {
+			L1(_("failed\n"));
+			ret = 1;
+		} else {
+			L1(_("done\n"));
+		}
+	}
+
 	delta_cleanup();
+	text_store_cleanup();
 	return ret;
 }
@@ -47,10 +47,18 @@ enum dump_flags {
 typedef struct {
 	char          *temp_dir;
 	char          *prefix;
+	char          *load_state_dir;
+	char          *save_state_dir;
+	char          *load_into;            /* Local repository to load into */
 	svn_revnum_t  start;
 	svn_revnum_t  end;
 	int           flags;
 	int           dump_format;
+	apr_size_t    text_cache_size;       /* Memory budget for local copies */
+	apr_size_t    text_cache_threshold;  /* Maximum size of cached copies */
+	int           threads;               /* Worker threads for deltas */
+	int           delta_version;         /* svndiff version, -1 for default */
+	int           delta_level;           /* Compression level for svndiff1 */
 } dump_options_t;
 
 
@@ -0,0 +1,509 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-present Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: filter.c
+ *      desc: Include and exclude path patterns
+ *
+ *      Patterns are shell globs that are matched against paths relative to
+ *      the dumped URL, with wildcards not matching a '/'. A path is excluded
+ *      if it or one of its parents matches an exclude pattern. If there are
+ *      include patterns, a path is excluded as well unless it or one of its
+ *      parents matches one of them, or it is a parent of possible matches.
+ *      Thus, the children of an excluded path are always excluded, which
+ *      makes it possible to skip whole subtrees.
+ */
+
+
+#include <string.h>
+
+#include <svn_delta.h>
+
+#include <apr_fnmatch.h>
+#include <apr_hash.h>
+#include <apr_strings.h>
+#include <apr_tables.h>
+
+#include "main.h"
+#include "utils.h"
+
+#include "filter.h"
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+struct filter_t {
+	apr_array_header_t *include;
+	apr_array_header_t *exclude;
+	apr_pool_t *pool;
+};
+
+/* Baton for the wrapping editor, NULL for skipped nodes */
+typedef struct {
+	const svn_delta_editor_t *editor;
+	void *baton;
+	const filter_t *filter;
+} fe_baton_t;
+
+
+/*---------------------------------------------------------------------------*/
+/* Static functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Checks whether a pattern contains wildcards */
+static char filter_is_literal(const char *pattern)
+{
+	return (strpbrk(pattern, "*?[\\") == NULL);
+}
+
+
+/* Checks whether a path matches one of the patterns */
+static char filter_match(const apr_array_header_t *patterns, const char *path)
+{
+	int i;
+
+	for (i = 0; i < patterns->nelts; i++) {
+		if (apr_fnmatch(APR_ARRAY_IDX(patterns, i, const char *), path, APR_FNM_PATHNAME) == APR_SUCCESS) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/* Checks whether a path or one of its parents matches one of the patterns */
+static char filter_match_tree(const apr_array_header_t *patterns, const char *path, apr_pool_t *pool)
+{
+	char *buf, *sep;
+
+	if (patterns->nelts == 0) {
+		return 0;
+	}
+
+	buf = apr_pstrdup(pool, path);
+	sep = buf;
+	while ((sep = strchr(sep, '/')) != NULL) {
+		*sep = '\0';
+		if (filter_match(patterns, buf)) {
+			return 1;
+		}
+		*sep++ = '/';
+	}
+	return filter_match(patterns, buf);
+}
+
+
+/* Checks whether a path is a parent of possible matches of the patterns,
+   i.e. whether it matches the leading components of one of them */
+static char filter_match_parent(const apr_array_header_t *patterns, const char *path, apr_pool_t *pool)
+{
+	const char *p;
+	int i, n = 1;
+
+	for (p = path; *p; p++) {
+		if (*p == '/') {
+			++n;
+		}
+	}
+
+	for (i = 0; i < patterns->nelts; i++) {
+		const char *pattern = APR_ARRAY_IDX(patterns, i, const char *);
+		int j = n;
+
+		for (p = pattern; *p; p++) {
+			if (*p == '/' && --j == 0) {
+				break;
+			}
+		}
+		if (*p && apr_fnmatch(apr_pstrndup(pool, pattern, p - pattern), path, APR_FNM_PATHNAME) == APR_SUCCESS) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/* Checks whether a path without leading slashes is excluded */
+static char filter_check(const filter_t *filter, const char *path, apr_pool_t *pool)
+{
+	if (filter_match_tree(filter->exclude, path, pool)) {
+		return 1;
+	}
+	if (filter->include->nelts == 0) {
+		return 0;
+	}
+	return !(filter_match_tree(filter->include, path, pool) || filter_match_parent(filter->include, path, pool));
+}
+
+
+/* Editor functions */
+static svn_error_t *fe_open_root(void *edit_baton, svn_revnum_t base_revision, apr_pool_t *dir_pool, void **root_baton)
+{
+	fe_baton_t *eb = edit_baton, *b = apr_palloc(dir_pool, sizeof(fe_baton_t));
+	*b = *eb;
+	*root_baton = b;
+	return eb->editor->open_root(eb->baton, base_revision, dir_pool, &b->baton);
+}
+
+static svn_error_t *fe_delete_entry(const char *path, svn_revnum_t revision, void *parent_baton, apr_pool_t *pool)
+{
+	fe_baton_t *pb = parent_baton;
+	if (pb == NULL || filter_excluded(pb->filter, path, pool)) {
+		return SVN_NO_ERROR;
+	}
+	return pb->editor->delete_entry(path, revision, pb->baton, pool);
+}
+
+static svn_error_t *fe_add_directory(const char *path, void *parent_baton, const char *copyfrom_path, svn_revnum_t copyfrom_revision, apr_pool_t *dir_pool, void **child_baton)
+{
+	fe_baton_t *pb = parent_baton, *b;
+	*child_baton = NULL;
+	if (pb == NULL || filter_excluded(pb->filter, path, dir_pool)) {
+		return SVN_NO_ERROR;
+	}
+	b = apr_palloc(dir_pool, sizeof(fe_baton_t));
+	*b = *pb;
+	*child_baton = b;
+	return pb->editor->add_directory(path, pb->baton, copyfrom_path, copyfrom_revision, dir_pool, &b->baton);
+}
+
+static svn_error_t *fe_open_directory(const char *path, void *parent_baton, svn_revnum_t base_revision, apr_pool_t *dir_pool, void **child_baton)
+{
+	fe_baton_t *pb = parent_baton, *b;
+	*child_baton = NULL;
+	if (pb == NULL || filter_excluded(pb->filter, path, dir_pool)) {
+		return SVN_NO_ERROR;
+	}
+	b = apr_palloc(dir_pool, sizeof(fe_baton_t));
+	*b = *pb;
+	*child_baton = b;
+	return pb->editor->open_directory(path, pb->baton, base_revision, dir_pool, &b->baton);
+}
+
+static svn_error_t *fe_change_dir_prop(void *dir_baton, const char *name, const svn_string_t *value, apr_pool_t *pool)
+{
+	fe_baton_t *b = dir_baton;
+	return (b ? b->editor->change_dir_prop(b->baton, name, value, pool) : SVN_NO_ERROR);
+}
+
+static svn_error_t *fe_close_directory(void *dir_baton, apr_pool_t *pool)
+{
+	fe_baton_t *b = dir_baton;
+	return (b ? b->editor->close_directory(b->baton, pool) : SVN_NO_ERROR);
+}
+
+static svn_error_t *fe_absent_directory(const char *path, void *parent_baton, apr_pool_t *pool)
+{
+	fe_baton_t *pb = parent_baton;
+	if (pb == NULL || filter_excluded(pb->filter, path, pool)) {
+		return SVN_NO_ERROR;
+	}
+	return pb->editor->absent_directory(path, pb->baton, pool);
+}
+
+static svn_error_t *fe_add_file(const char *path, void *parent_baton, const char *copyfrom_path, svn_revnum_t copyfrom_revision, apr_pool_t *file_pool, void **file_baton)
+{
+	fe_baton_t *pb = parent_baton, *b;
+	*file_baton = NULL;
+	if (pb == NULL || filter_excluded(pb->filter, path, file_pool)) {
+		return SVN_NO_ERROR;
+	}
+	b = apr_palloc(file_pool, sizeof(fe_baton_t));
+	*b = *pb;
+	*file_baton = b;
+	return pb->editor->add_file(path, pb->baton, copyfrom_path, copyfrom_revision, file_pool, &b->baton);
+}
+
+static svn_error_t *fe_open_file(const char *path, void *parent_baton, svn_revnum_t base_revision, apr_pool_t *file_pool, void **file_baton)
+{
+	fe_baton_t *pb = parent_baton, *b;
+	*file_baton = NULL;
+	if (pb == NULL || filter_excluded(pb->filter, path, file_pool)) {
+		return SVN_NO_ERROR;
+	}
+	b = apr_palloc(file_pool, sizeof(fe_baton_t));
+	*b = *pb;
+	*file_baton = b;
+	return pb->editor->open_file(path, pb->baton, base_revision, file_pool, &b->baton);
+}
+
+static svn_error_t *fe_apply_textdelta(void *file_baton, const char *base_checksum, apr_pool_t *pool, svn_txdelta_window_handler_t *handler, void **handler_baton)
+{
+	fe_baton_t *b = file_baton;
+	if (b == NULL) {
+		*handler = svn_delta_noop_window_handler;
+		*handler_baton = NULL;
+		return SVN_NO_ERROR;
+	}
+	return b->editor->apply_textdelta(b->baton, base_checksum, pool, handler, handler_baton);
+}
+
+static svn_error_t *fe_change_file_prop(void *file_baton, const char *name, const svn_string_t *value, apr_pool_t *pool)
+{
+	fe_baton_t *b = file_baton;
+	return (b ? b->editor->change_file_prop(b->baton, name, value, pool) : SVN_NO_ERROR);
+}
+
+static svn_error_t *fe_close_file(void *file_baton, const char *text_checksum, apr_pool_t *pool)
+{
+	fe_baton_t *b = file_baton;
+	return (b ? b->editor->close_file(b->baton, text_checksum, pool) : SVN_NO_ERROR);
+}
+
+static svn_error_t *fe_absent_file(const char *path, void *parent_baton, apr_pool_t *pool)
+{
+	fe_baton_t *pb = parent_baton;
+	if (pb == NULL || filter_excluded(pb->filter, path, pool)) {
+		return SVN_NO_ERROR;
+	}
+	return pb->editor->absent_file(path, pb->baton, pool);
+}
+
+static svn_error_t *fe_set_target_revision(void *edit_baton, svn_revnum_t target_revision, apr_pool_t *pool)
+{
+	fe_baton_t *eb = edit_baton;
+	return eb->editor->set_target_revision(eb->baton, target_revision, pool);
+}
+
+static svn_error_t *fe_close_edit(void *edit_baton, apr_pool_t *pool)
+{
+	fe_baton_t *eb = edit_baton;
+	return eb->editor->close_edit(eb->baton, pool);
+}
+
+static svn_error_t *fe_abort_edit(void *edit_baton, apr_pool_t *pool)
+{
+	fe_baton_t *eb = edit_baton;
+	return eb->editor->abort_edit(eb->baton, pool);
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Creates an empty filter */
+filter_t *filter_create(apr_pool_t *pool)
+{
+	filter_t *filter = apr_palloc(pool, sizeof(filter_t));
+	filter->include = apr_array_make(pool, 0, sizeof(const char *));
+	filter->exclude = apr_array_make(pool, 0, sizeof(const char *));
+	filter->pool = pool;
+	return filter;
+}
+
+
+/* Adds an include or exclude pattern */
+void filter_add(filter_t *filter, const char *pattern, char include)
+{
+	char *p;
+	size_t len;
+
+	/* Patterns are relative, and directories are matched without a trailing slash */
+	while (*pattern == '/') {
+		++pattern;
+	}
+	p = apr_pstrdup(filter->pool, pattern);
+	len = strlen(p);
+	while (len > 0 && p[len-1] == '/') {
+		p[--len] = '\0';
+	}
+
+	APR_ARRAY_PUSH((include ? filter->include : filter->exclude), const char *) = p;
+}
+
+
+/* Checks whether a path is excluded from the dump */
+char filter_excluded(const filter_t *filter, const char *path, apr_pool_t *pool)
+{
+	if (filter == NULL) {
+		return 0;
+	}
+	while (*path == '/') {
+		++path;
+	}
+	if (*path == '\0') {
+		return 0;
+	}
+	return filter_check(filter, path, pool);
+}
+
+
+/* Returns the topmost excluded parent of a path, or NULL if the path is
+   not excluded */
+const char *filter_excluded_root(const filter_t *filter, const char *path, apr_pool_t *pool)
+{
+	char *buf, *sep;
+
+	if (!filter_excluded(filter, path, pool)) {
+		return NULL;
+	}
+	while (*path == '/') {
+		++path;
+	}
+
+	buf = apr_pstrdup(pool, path);
+	sep = buf;
+	while ((sep = strchr(sep, '/')) != NULL) {
+		*sep = '\0';
+		if (filter_check(filter, buf, pool)) {
+			return buf;
+		}
+		*sep++ = '/';
+	}
+	return buf;
+}
+
+
+/* Checks whether a path is dumped but parts of its subtree may be excluded */
+char filter_partial(const filter_t *filter, const char *path, apr_pool_t *pool)
+{
+	if (filter == NULL) {
+		return 0;
+	}
+	while (*path == '/') {
+		++path;
+	}
+	if (*path == '\0') {
+		return (filter->include->nelts > 0 || filter->exclude->nelts > 0);
+	}
+	if (filter_check(filter, path, pool)) {
+		return 0;
+	}
+	if (filter_match_parent(filter->exclude, path, pool)) {
+		return 1;
+	}
+	return (filter->include->nelts > 0 && !filter_match_tree(filter->include, path, pool));
+}
+
+
+/* Checks whether the result of a copy differs from the copy source because
+   of the filter, i.e. whether excluded paths are involved */
+char filter_affects_copy(const filter_t *filter, const char *from, const char *to, apr_pool_t *pool)
+{
+	return (filter_excluded(filter, from, pool) || filter_partial(filter, from, pool) || filter_partial(filter, to, pool));
+}
+
+
+/* Returns the sorted list of excluded subtrees that should be reported as
+   up-to-date, i.e. all literal exclude patterns and the given paths */
+apr_array_header_t *filter_report_paths(const filter_t *filter, apr_hash_t *excluded, apr_pool_t *pool)
+{
+	apr_array_header_t *paths, *roots;
+	apr_hash_t *seen;
+	apr_hash_index_t *hi;
+	int i;
+
+	paths = apr_array_make(pool, 0, sizeof(const char *));
+	if (filter != NULL) {
+		for (i = 0; i < filter->exclude->nelts; i++) {
+			const char *pattern = APR_ARRAY_IDX(filter->exclude, i, const char *);
+			if (*pattern != '\0' && filter_is_literal(pattern)) {
+				APR_ARRAY_PUSH(paths, const char *) = pattern;
+			}
+		}
+	}
+	if (excluded != NULL) {
+		for (hi = apr_hash_first(pool, excluded); hi; hi = apr_hash_next(hi)) {
+			const char *path;
+			apr_hash_this(hi, (const void **)&path, NULL, NULL);
+			APR_ARRAY_PUSH(paths, const char *) = path;
+		}
+	}
+	utils_sort(paths);
+
+	/* Only report the topmost paths, each of them once */
+	roots = apr_array_make(pool, paths->nelts, sizeof(const char *));
+	seen = apr_hash_make(pool);
+	for (i = 0; i < paths->nelts; i++) {
+		const char *path = APR_ARRAY_IDX(paths, i, const char *);
+		const char *sep = path;
+		char nested = 0;
+
+		while (!nested && (sep = strchr(sep, '/')) != NULL) {
+			nested = (apr_hash_get(seen, path, sep - path) != NULL);
+			++sep;
+		}
+		if (nested || apr_hash_get(seen, path, APR_HASH_KEY_STRING) != NULL) {
+			continue;
+		}
+		apr_hash_set(seen, path, APR_HASH_KEY_STRING, path);
+		APR_ARRAY_PUSH(roots, const char *) = path;
+	}
+	return roots;
+}
+
+
+/* Returns a description of all patterns, e.g. for comparing filters */
+const char *filter_describe(const filter_t *filter, apr_pool_t *pool)
+{
+	const char *desc = "";
+	int i;
+
+	if (filter == NULL) {
+		return desc;
+	}
+	for (i = 0; i < filter->include->nelts; i++) {
+		desc = apr_psprintf(pool, "%s%s+%s", desc, (*desc ? "\t" : ""), APR_ARRAY_IDX(filter->include, i, const char *));
+	}
+	for (i = 0; i < filter->exclude->nelts; i++) {
+		desc = apr_psprintf(pool, "%s%s-%s", desc, (*desc ? "\t" : ""), APR_ARRAY_IDX(filter->exclude, i, const char *));
+	}
+	return desc;
+}
+
+
+/* Wraps a delta editor in order to skip excluded nodes */
+void filter_wrap_editor(const svn_delta_editor_t **editor, void **edit_baton, const filter_t *filter, apr_pool_t *pool)
+{
+	svn_delta_editor_t *wrapper;
+	fe_baton_t *eb;
+
+	if (filter == NULL) {
+		return;
+	}
+
+	wrapper = svn_delta_default_editor(pool);
+	wrapper->set_target_revision = fe_set_target_revision;
+	wrapper->open_root = fe_open_root;
+	wrapper->delete_entry = fe_delete_entry;
+	wrapper->add_directory = fe_add_directory;
+	wrapper->open_directory = fe_open_directory;
+	wrapper->change_dir_prop = fe_change_dir_prop;
+	wrapper->close_directory = fe_close_directory;
+	wrapper->absent_directory = fe_absent_directory;
+	wrapper->add_file = fe_add_file;
+	wrapper->open_file = fe_open_file;
+	wrapper->apply_textdelta = fe_apply_textdelta;
+	wrapper->change_file_prop = fe_change_file_prop;
+	wrapper->close_file = fe_close_file;
+	wrapper->absent_file = fe_absent_file;
+	wrapper->close_edit = fe_close_edit;
+	wrapper->abort_edit = fe_abort_edit;
+
+	eb = apr_palloc(pool, sizeof(fe_baton_t));
+	eb->editor = *editor;
+	eb->baton = *edit_baton;
+	eb->filter = filter;
+	*editor = wrapper;
+	*edit_baton = eb;
+}
@@ -0,0 +1,69 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-present Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: filter.h
+ *      desc: Include and exclude path patterns
+ */
+
+
+#ifndef FILTER_H_
+#define FILTER_H_
+
+
+#include <svn_delta.h>
+
+#include <apr_hash.h>
+#include <apr_pools.h>
+#include <apr_tables.h>
+
+
+typedef struct filter_t filter_t;
+
+
+/* Creates an empty filter */
+extern filter_t *filter_create(apr_pool_t *pool);
+
+/* Adds an include or exclude pattern */
+extern void filter_add(filter_t *filter, const char *pattern, char include);
+
+/* Checks whether a path is excluded from the dump */
+extern char filter_excluded(const filter_t *filter, const char *path, apr_pool_t *pool);
+
+/* Returns the topmost excluded parent of a path, or NULL if the path is
+   not excluded */
+extern const char *filter_excluded_root(const filter_t *filter, const char *path, apr_pool_t *pool);
+
+/* Checks whether a path is dumped but parts of its subtree may be excluded */
+extern char filter_partial(const filter_t *filter, const char *path, apr_pool_t *pool);
+
+/* Checks whether the result of a copy differs from the copy source because
+   of the filter, i.e. whether excluded paths are involved */
+extern char filter_affects_copy(const filter_t *filter, const char *from, const char *to, apr_pool_t *pool);
+
+/* Returns the sorted list of excluded subtrees that should be reported as
+   up-to-date, i.e. all literal exclude patterns and the given paths */
+extern apr_array_header_t *filter_report_paths(const filter_t *filter, apr_hash_t *excluded, apr_pool_t *pool);
+
+/* Returns a description of all patterns, e.g. for comparing filters */
+extern const char *filter_describe(const filter_t *filter, apr_pool_t *pool);
+
+/* Wraps a delta editor in order to skip excluded nodes */
+extern void filter_wrap_editor(const svn_delta_editor_t **editor, void **edit_baton, const filter_t *filter, apr_pool_t *pool);
+
+
+#endif
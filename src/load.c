@@ -0,0 +1,212 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-present Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: load.c
+ *      desc: Direct loading into a local repository
+ *
+ *      Instead of writing a dumpfile, revisions and nodes are passed to the
+ *      dumpfile parser callbacks of the repository layer, i.e. the same
+ *      code that is run by 'svnadmin load'. Node headers are given as they
+ *      would appear in the dumpfile, and texts and deltas are streamed from
+ *      the text store without serializing them first.
+ */
+
+
+#include <string.h>
+
+#include <svn_delta.h>
+#include <svn_pools.h>
+#include <svn_repos.h>
+
+#include <apr_hash.h>
+
+#include "main.h"
+#include "text_store.h"
+#include "utils.h"
+
+#include "load.h"
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+struct load_t {
+	const svn_repos_parse_fns2_t *parser;
+	void *parse_baton;
+	void *revision_baton;  /* Current revision, if any */
+	apr_pool_t *pool;
+	apr_pool_t *revision_pool;
+};
+
+
+/*---------------------------------------------------------------------------*/
+/* Static functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Checks whether a header is set to "true" */
+static char load_header_true(apr_hash_t *headers, const char *key)
+{
+	const char *value = apr_hash_get(headers, key, APR_HASH_KEY_STRING);
+	return (value != NULL && !strcmp(value, "true"));
+}
+
+
+/* Passes node properties to the parser */
+static svn_error_t *load_node_props(load_t *loader, void *node_baton, apr_hash_t *headers, apr_hash_t *props, apr_hash_t *del_props, apr_pool_t *pool)
+{
+	apr_hash_index_t *hi;
+
+	/* Without a property delta, the properties replace the existing ones */
+	if (!load_header_true(headers, SVN_REPOS_DUMPFILE_PROP_DELTA)) {
+		SVN_ERR(loader->parser->remove_node_props(node_baton));
+	}
+
+	for (hi = apr_hash_first(pool, props); hi; hi = apr_hash_next(hi)) {
+		const char *key;
+		svn_string_t *value;
+		apr_hash_this(hi, (const void **)&key, NULL, (void **)&value);
+		SVN_ERR(loader->parser->set_node_property(node_baton, key, value));
+	}
+	if (del_props != NULL) {
+		for (hi = apr_hash_first(pool, del_props); hi; hi = apr_hash_next(hi)) {
+			const char *key;
+			apr_hash_this(hi, (const void **)&key, NULL, NULL);
+			SVN_ERR(loader->parser->delete_node_property(node_baton, key));
+		}
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Passes the contents of a node to the parser, either as a full text or
+   as a svndiff delta */
+static svn_error_t *load_node_text(load_t *loader, void *node_baton, apr_hash_t *headers, const char *text, apr_pool_t *pool)
+{
+	svn_stream_t *in, *out = NULL;
+
+	if (load_header_true(headers, SVN_REPOS_DUMPFILE_TEXT_DELTA)) {
+		svn_txdelta_window_handler_t handler = NULL;
+		void *handler_baton;
+		SVN_ERR(loader->parser->apply_textdelta(&handler, &handler_baton, node_baton));
+		if (handler != NULL) {
+			out = svn_txdelta_parse_svndiff(handler, handler_baton, TRUE, pool);
+		}
+	} else {
+		SVN_ERR(loader->parser->set_fulltext(&out, node_baton));
+	}
+	if (out == NULL) {
+		return SVN_NO_ERROR;
+	}
+
+	SVN_ERR(text_store_read(&in, text, pool));
+	SVN_ERR(svn_stream_copy(in, out, pool));
+	SVN_ERR(svn_stream_close(in));
+	return svn_stream_close(out);
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Opens a local repository for loading, printing an error on failure */
+load_t *load_create(const char *path, apr_pool_t *pool)
+{
+	load_t *loader = apr_pcalloc(pool, sizeof(load_t));
+	svn_repos_t *repos;
+	svn_error_t *err;
+
+	loader->pool = svn_pool_create(pool);
+	loader->revision_pool = svn_pool_create(loader->pool);
+
+	err = svn_repos_open(&repos, path, loader->pool);
+	if (err == NULL) {
+		err = svn_repos_get_fs_build_parser2(&loader->parser, &loader->parse_baton, repos, TRUE, svn_repos_load_uuid_default, svn_stream_empty(loader->pool), NULL, loader->pool);
+	}
+	if (err) {
+		utils_handle_error(err, stderr, FALSE, "ERROR: ");
+		svn_error_clear(err);
+		return NULL;
+	}
+	return loader;
+}
+
+
+/* Sets the UUID of the repository if it doesn't contain any revisions yet */
+svn_error_t *load_uuid(load_t *loader, const char *uuid)
+{
+	return loader->parser->uuid_record(uuid, loader->parse_baton, loader->pool);
+}
+
+
+/* Starts a new revision with the given properties (const char * values) */
+svn_error_t *load_revision(load_t *loader, svn_revnum_t revnum, apr_hash_t *props)
+{
+	apr_hash_t *headers;
+	apr_hash_index_t *hi;
+
+	SVN_ERR(load_close_revision(loader));
+
+	headers = apr_hash_make(loader->revision_pool);
+	apr_hash_set(headers, SVN_REPOS_DUMPFILE_REVISION_NUMBER, APR_HASH_KEY_STRING, apr_psprintf(loader->revision_pool, "%ld", revnum));
+	SVN_ERR(loader->parser->new_revision_record(&loader->revision_baton, headers, loader->parse_baton, loader->revision_pool));
+
+	for (hi = apr_hash_first(loader->revision_pool, props); hi; hi = apr_hash_next(hi)) {
+		const char *key, *value;
+		apr_hash_this(hi, (const void **)&key, NULL, (void **)&value);
+		SVN_ERR(loader->parser->set_revision_property(loader->revision_baton, key, svn_string_create(value, loader->revision_pool)));
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Adds a node to the current revision. The headers are the ones of a
+   dumpfile node record. Properties (svn_string_t * values) are applied if
+   'props' is non-NULL, and 'text' names the contents in the text store */
+svn_error_t *load_node(load_t *loader, apr_hash_t *headers, apr_hash_t *props, apr_hash_t *del_props, const char *text, apr_pool_t *pool)
+{
+	void *node_baton;
+
+	SVN_ERR(loader->parser->new_node_record(&node_baton, headers, loader->revision_baton, pool));
+	if (props != NULL) {
+		SVN_ERR(load_node_props(loader, node_baton, headers, props, del_props, pool));
+	}
+	if (text != NULL) {
+		SVN_ERR(load_node_text(loader, node_baton, headers, text, pool));
+	}
+	return loader->parser->close_node(node_baton);
+}
+
+
+/* Commits the current revision, if any */
+svn_error_t *load_close_revision(load_t *loader)
+{
+	svn_error_t *err;
+
+	if (loader->revision_baton == NULL) {
+		return SVN_NO_ERROR;
+	}
+	err = loader->parser->close_revision(loader->revision_baton);
+	loader->revision_baton = NULL;
+	svn_pool_clear(loader->revision_pool);
+	return err;
+}
@@ -0,0 +1,55 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-present Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: load.h
+ *      desc: Direct loading into a local repository
+ */
+
+
+#ifndef LOAD_H_
+#define LOAD_H_
+
+
+#include <svn_types.h>
+
+#include <apr_hash.h>
+#include <apr_pools.h>
+
+
+typedef struct load_t load_t;
+
+
+/* Opens a local repository for loading, printing an error on failure */
+extern load_t *load_create(const char *path, apr_pool_t *pool);
+
+/* Sets the UUID of the repository if it doesn't contain any revisions yet */
+extern svn_error_t *load_uuid(load_t *loader, const char *uuid);
+
+/* Starts a new revision with the given properties (const char * values) */
+extern svn_error_t *load_revision(load_t *loader, svn_revnum_t revnum, apr_hash_t *props);
+
+/* Adds a node to the current revision. The headers are the ones of a
+   dumpfile node record. Properties (svn_string_t * values) are applied if
+   'props' is non-NULL, and 'text' names the contents in the text store */
+extern svn_error_t *load_node(load_t *loader, apr_hash_t *headers, apr_hash_t *props, apr_hash_t *del_props, const char *text, apr_pool_t *pool);
+
+/* Commits the current revision, if any */
+extern svn_error_t *load_close_revision(load_t *loader);
+
+
+#endif
@@ -26,6 +26,7 @@
 #include <svn_ra.h>
 
 #include "main.h"
+#include "filter.h"
 #include "logger.h"
 
 #include "log.h"
@@ -67,6 +68,7 @@ typedef struct {
 static svn_error_t *log_receiver(void *baton, apr_hash_t *changed_paths, svn_revnum_t revision, const char *author, const char *date, const char *message, apr_pool_t *pool)
 {
 	apr_hash_index_t *hi;
+	const char *root;
 	log_receiver_baton_t *data = (log_receiver_baton_t *)baton;
 	size_t prefixlen = strlen(data->session->prefix);
 
@@ -75,6 +77,7 @@ static svn_error_t *log_receiver(void *baton, apr_hash_t *changed_paths, svn_rev
 	data->log->date = apr_pstrdup(data->pool, date);
 	data->log->message = session_obfuscate_once(data->session, data->pool, apr_pstrdup(data->pool, message));
 	data->log->changed_paths = apr_hash_make(data->pool);
+	data->log->excluded = NULL;
 
 	DEBUG_MSG("log_receiver: got log for revision %ld\n", revision);
 
@@ -118,6 +121,17 @@ static svn_error_t *log_receiver(void *baton, apr_hash_t *changed_paths, svn_rev
 		if (*key == '/') {
 			key += 1;
 		}
+
+		/* Drop excluded paths, but remember them for the diff report */
+		if ((root = filter_excluded_root(data->session->filter, key, pool)) != NULL) {
+			if (data->log->excluded == NULL) {
+				data->log->excluded = apr_hash_make(data->pool);
+			}
+			root = apr_pstrdup(data->pool, root);
+			apr_hash_set(data->log->excluded, root, APR_HASH_KEY_STRING, root);
+			DEBUG_MSG("%c %s [excluded]\n", dvalue->action, key);
+			continue;
+		}
 		apr_hash_set(data->log->changed_paths, apr_pstrdup(data->pool, key), APR_HASH_KEY_STRING, dvalue);
 
 		/* A little debugging */
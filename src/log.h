@@ -41,6 +41,7 @@ typedef struct {
 	const char		*date;
 	const char		*message;
 	apr_hash_t		*changed_paths;
+	apr_hash_t		*excluded;  /* Topmost changed paths skipped by the filter */
 } log_revision_t;
 
 
@@ -33,11 +33,17 @@
 
 #include <svn_cmdline.h>
 #include <svn_path.h>
+#include <svn_version.h>
 
 #include "main.h"
 #include "dump.h"
+#include "filter.h"
 #include "logger.h"
+#include "progress.h"
+#include "reaper.h"
+#include "stats.h"
 #include "utils.h"
+#include "workers.h"
 
 
 /*---------------------------------------------------------------------------*/
@@ -67,18 +73,35 @@ static void print_usage()
 	printf(_("    -q [--quiet]              be quiet\n"));
 	printf(_("    -v [--verbose]            print extra progress\n"));
 	printf(_("    -n [--dry-run]            don't fetch text deltas\n"));
+	printf(_("    --stats                   print performance statistics when done\n"));
+	printf(_("    --stats-json FILE         write periodic statistics snapshots to FILE\n"));
+	printf(_("    --progress-fd N           write periodic progress reports to file\n" \
+	         "                              descriptor N\n"));
 	printf("\n");
 	printf(_("Dump options:\n"));
 	printf(_("    -r [--revision] ARG       specify revision number (or X:Y range)\n"));
 	printf(_("    --deltas                  use deltas in dump output\n"));
+	printf(_("    --delta-format FORMAT     svndiff format for deltas: svndiff0,\n" \
+	         "                              svndiff1[:LEVEL] or svndiff2 (svndiff0)\n"));
 	printf(_("    --incremental             dump incrementally\n"));
 	printf(_("    --prefix ARG              prepend ARG to the path that is being dumped\n"));
+	printf(_("    --include PATTERN         only dump paths matching PATTERN\n"));
+	printf(_("    --exclude PATTERN         don't dump paths matching PATTERN\n"));
 	printf(_("    --keep-revnums            keep the dumped revision numbers in sync with\n" \
 	         "                              the repository by using empty revisions for\n" \
 	         "                              padding\n"));
 	printf(_("    --no-incremental-header   don't print the dumpfile header when dumping\n"));
 	printf(_("                              with --incremental and not starting at\n"));
 	printf(_("                              revision 0\n"));
+	printf(_("    --save-state DIR          save the internal state to DIR after dumping\n"));
+	printf(_("    --load-state DIR          resume an incremental dump using the state\n"));
+	printf(_("                              saved in DIR\n"));
+	printf(_("    --native-fs               read file:// repositories directly\n"));
+	printf(_("    --load-into PATH          load into the local repository at PATH instead\n" \
+	         "                              of writing a dumpfile\n"));
+	printf(_("    --text-cache MB           memory for local copies of small files (64)\n"));
+	printf(_("    --text-cache-threshold KB maximum size of cached local copies (8)\n"));
+	printf(_("    --threads NUM             compute deltas using NUM threads (2)\n"));
 	printf("\n");
 	printf(_("Subversion compatibility options:\n"));
 	printf(_("    -u [--username] ARG       specify a username ARG\n"));
@@ -156,6 +179,9 @@ int main(int argc, char **argv)
 {
 	char ret = 0;
 	const char *tdir = NULL;
+	char stats_summary = 0;
+	const char *stats_json = NULL;
+	int progress_fd = -1;
 	int i;
 	session_t session;
 	dump_options_t opts;
@@ -204,6 +230,26 @@ int main(int argc, char **argv)
 			loglevel++;
 		} else if (!strcmp(argv[i], "-n") || !strcmp(argv[i], "--dry-run")) {
 			opts.flags |= DF_DRY_RUN;
+		} else if (!strcmp(argv[i], "--stats")) {
+			stats_summary = 1;
+		} else if (!strcmp(argv[i], "--stats-json")) {
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			stats_json = argv[++i];
+		} else if (!strcmp(argv[i], "--progress-fd")) {
+			char eos;
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			if (sscanf(argv[++i], "%d%c", &progress_fd, &eos) != 1 || progress_fd < 0) {
+				fprintf(stderr, _("ERROR: invalid file descriptor '%s'.\n"), argv[i]);
+				goto failure;
+			}
+		} else if (!strcmp(argv[i], "--native-fs")) {
+			session.flags |= SF_NATIVE_FS;
 		} else if (!strcmp(argv[i], "--obfuscate")) {
 			session.flags |= SF_OBFUSCATE;
 		} else if (!strcmp(argv[i], "--no-auth-cache")) {
@@ -216,6 +262,31 @@ int main(int argc, char **argv)
 			opts.flags |= DF_NO_INCREMENTAL_HEADER;
 		} else if (!strcmp(argv[i], "--deltas")) {
 			opts.flags |= DF_USE_DELTAS;
+		} else if (!strcmp(argv[i], "--delta-format")) {
+			char eos;
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			++i;
+			if (!strcmp(argv[i], "svndiff0")) {
+				opts.delta_version = 0;
+			} else if (!strcmp(argv[i], "svndiff1")) {
+				opts.delta_version = 1;
+			} else if (!strncmp(argv[i], "svndiff1:", 9) && sscanf(argv[i] + 9, "%d%c", &opts.delta_level, &eos) == 1
+			           && opts.delta_level >= 0 && opts.delta_level <= 9) {
+				opts.delta_version = 1;
+			} else if (!strcmp(argv[i], "svndiff2")) {
+#if (SVN_VER_MAJOR == 1) && (SVN_VER_MINOR >= 10)
+				opts.delta_version = 2;
+#else
+				fprintf(stderr, _("ERROR: svndiff2 requires Subversion 1.10 or later.\n"));
+				goto failure;
+#endif
+			} else {
+				fprintf(stderr, _("ERROR: invalid delta format '%s'.\n"), argv[i]);
+				goto failure;
+			}
 		} else if (!strcmp(argv[i], "--incremental")) {
 			opts.flags |= DF_INCREMENTAL;
 		} else if (!strcmp(argv[i], "-r") || !strcmp(argv[i], "--revision")) {
@@ -255,6 +326,65 @@ int main(int argc, char **argv)
 				goto failure;
 			}
 			opts.prefix = apr_pstrdup(session.pool, argv[++i]);
+		} else if (!strcmp(argv[i], "--include") || !strcmp(argv[i], "--exclude")) {
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			if (strspn(argv[i+1], "/") == strlen(argv[i+1])) {
+				fprintf(stderr, _("ERROR: Invalid pattern: %s\n"), argv[i+1]);
+				goto failure;
+			}
+			if (session.filter == NULL) {
+				session.filter = filter_create(session.pool);
+			}
+			filter_add(session.filter, argv[i+1], !strcmp(argv[i], "--include"));
+			++i;
+		} else if (!strcmp(argv[i], "--save-state")) {
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			opts.save_state_dir = utils_canonicalize_pstrdup(session.pool, argv[++i]);
+		} else if (!strcmp(argv[i], "--load-state")) {
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			opts.load_state_dir = utils_canonicalize_pstrdup(session.pool, argv[++i]);
+		} else if (!strcmp(argv[i], "--load-into")) {
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			opts.load_into = utils_canonicalize_pstrdup(session.pool, argv[++i]);
+		} else if (!strcmp(argv[i], "--text-cache") || !strcmp(argv[i], "--text-cache-threshold")) {
+			unsigned long size;
+			char eos;
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			if (sscanf(argv[i+1], "%lu%c", &size, &eos) != 1) {
+				fprintf(stderr, _("ERROR: invalid size '%s'.\n"), argv[i+1]);
+				goto failure;
+			}
+			if (!strcmp(argv[i], "--text-cache")) {
+				opts.text_cache_size = (apr_size_t)size * 1024 * 1024;
+			} else {
+				opts.text_cache_threshold = (apr_size_t)size * 1024;
+			}
+			++i;
+		} else if (!strcmp(argv[i], "--threads")) {
+			char eos;
+			if (i+1 >= argc) {
+				print_missing_arg(argv[i]);
+				goto failure;
+			}
+			if (sscanf(argv[++i], "%d%c", &opts.threads, &eos) != 1 || opts.threads < 0) {
+				fprintf(stderr, _("ERROR: invalid number of threads '%s'.\n"), argv[i]);
+				goto failure;
+			}
 
 		/* Deprecated options */
 		} else if (!strcmp(argv[i], "--stop")) {
@@ -302,6 +432,29 @@ int main(int argc, char **argv)
 		goto failure;
 	}
 
+	/* Only dump format version 3 contains deltas */
+	if (opts.delta_version >= 0 && !(opts.flags & DF_USE_DELTAS)) {
+		fprintf(stderr, _("ERROR: --delta-format requires --deltas.\n"));
+		goto failure;
+	}
+
+	/* Obfuscated paths are different in every run */
+	if ((session.flags & SF_OBFUSCATE) && (opts.load_state_dir != NULL || opts.save_state_dir != NULL)) {
+		fprintf(stderr, _("ERROR: --obfuscate can't be combined with --save-state or --load-state.\n"));
+		goto failure;
+	}
+
+	/* The log receiver would match obfuscated paths */
+	if ((session.flags & SF_OBFUSCATE) && session.filter != NULL) {
+		fprintf(stderr, _("ERROR: --obfuscate can't be combined with --include or --exclude.\n"));
+		goto failure;
+	}
+
+	/* Statistics need to be enabled before opening the session */
+	if ((stats_summary || stats_json != NULL || progress_fd >= 0) && stats_enable(stats_summary, stats_json) != 0) {
+		goto failure;
+	}
+
 	/* Generate temporary directory */
 #ifndef WIN32
 	tdir = getenv("TMPDIR");
@@ -332,10 +485,24 @@ int main(int argc, char **argv)
 	}
 #endif /* !WIN32 */
 
+	/* Start progress reporting, which also watches the temporary directory */
+	if (progress_fd >= 0 && progress_start(progress_fd, opts.temp_dir) != 0) {
+		utils_rrmdir(session.pool, opts.temp_dir, 1);
+		goto failure;
+	}
+	reaper_start();
+	if (opts.flags & DF_USE_DELTAS) {
+		workers_start(opts.threads);
+	}
+
 	/* Do the real work */
 	if (session_open(&session) == 0) {
 		ret = dump(&session, &opts);
 		session_close(&session);
+		workers_stop();
+		reaper_stop();
+		progress_stop();
+		stats_finish();
 
 		/* Clean up temporary directory on success */
 #ifndef DUMP_DEBUG
@@ -346,6 +513,9 @@ int main(int argc, char **argv)
 		}
 #endif
 	} else {
+		workers_stop();
+		reaper_stop();
+		progress_stop();
 		utils_rrmdir(session.pool, opts.temp_dir, 1);
 	}
 
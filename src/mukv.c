@@ -18,77 +18,636 @@
  *
  *      file: mukv.c
  *      desc: Small and simple key-value storage
+ *
+ *      Records are appended to segment files of limited size. The number of
+ *      bytes that are still referenced by the index is tracked for every
+ *      segment. Once a segment is sparse enough, its live records are copied
+ *      to a new segment in the background and the index is updated at once.
  */
 
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #ifndef WIN32
 	#include <unistd.h>
 #endif
 
+#include <svn_pools.h>
+
 #include <apr_strings.h>
+#if APR_HAS_THREADS
+ #include <apr_thread_mutex.h>
+ #include <apr_thread_proc.h>
+#endif
 
 #include "main.h"
 #include "rhash.h"
+#include "utils.h"
 
 #include "mukv.h"
 
 
-struct mukv_t {
-	rhash_t *index;
-	char *path;
-	FILE *file;
-};
+/* Size of segments, after which a new one is started */
+#ifndef SEGMENT_SIZE
+	#define SEGMENT_SIZE (1<<22)
+#endif
+
+/* Segments with fewer live bytes than this are compacted (in percent) */
+#ifndef COMPACT_THRESHOLD
+	#define COMPACT_THRESHOLD 50
+#endif
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+typedef struct {
+	FILE *file;      /* NULL for unused slots */
+	long size;
+	long live;       /* Bytes referenced by the index */
+	char reserved;   /* Target of a running compaction */
+} segment_t;
 
 typedef struct {
+	unsigned int seg;
 	long off;
 	size_t size;
 } entry_t;
 
+/* Index entry reference, used for saving */
+typedef struct {
+	const void *key;
+	apr_ssize_t klen;
+	entry_t *entry;
+} entry_ref_t;
+
+/* Record that is moved by a compaction */
+typedef struct {
+	char *key;   /* malloc()'ed */
+	apr_ssize_t klen;
+	long off;
+	size_t size;
+	long new_off;
+} compact_rec_t;
+
+/* Compaction of a single segment. Only plain file I/O is done in the
+   background, so no pools are involved */
+typedef struct {
+	unsigned int src, dst;
+	char *src_path;   /* malloc()'ed */
+	char *dst_path;
+	compact_rec_t *recs;
+	size_t num;
+	long size;
+	int status;       /* 0: running, 1: finished, -1: failed */
+#if APR_HAS_THREADS
+	apr_thread_t *thread;
+#endif
+} compact_job_t;
+
+struct mukv_t {
+	rhash_t *index;
+	char *path;
+	segment_t *segs;
+	unsigned int num_segs;
+	unsigned int active;   /* Segment that records are appended to */
+	compact_job_t *job;
+
+	char batch;            /* Stored records are collected in a buffer */
+	char *buf;
+	size_t buf_len;
+	size_t buf_size;
+#if APR_HAS_THREADS
+	apr_pool_t *pool;
+	apr_thread_mutex_t *mutex;
+#endif
+};
+
+
+/*---------------------------------------------------------------------------*/
+/* Local functions                                                           */
+/*---------------------------------------------------------------------------*/
+
+
+/* Returns the file name of a segment, malloc()'ed */
+static char *mukv_segment_path(mukv_t *kv, unsigned int seg)
+{
+	char *path = malloc(strlen(kv->path) + 16);
+	if (path != NULL) {
+		sprintf(path, "%s.%u", kv->path, seg);
+	}
+	return path;
+}
+
+/* Returns an unused segment slot, reusing slots of removed segments */
+static int mukv_segment_slot(mukv_t *kv, unsigned int *seg)
+{
+	unsigned int i;
+
+	for (i = 0; i < kv->num_segs; i++) {
+		if (kv->segs[i].file == NULL && !kv->segs[i].reserved) {
+			*seg = i;
+			return 0;
+		}
+	}
+
+	{
+		segment_t *tmp = realloc(kv->segs, (kv->num_segs + 1) * sizeof(segment_t));
+		if (tmp == NULL) {
+			return ENOMEM;
+		}
+		kv->segs = tmp;
+		memset(&kv->segs[kv->num_segs], 0, sizeof(segment_t));
+	}
+	*seg = kv->num_segs++;
+	return 0;
+}
+
+/* Creates a new, empty segment and returns its number */
+static int mukv_segment_create(mukv_t *kv, unsigned int *seg)
+{
+	unsigned int i;
+	char *path;
+	int ret;
+
+	if ((ret = mukv_segment_slot(kv, &i)) != 0) {
+		return ret;
+	}
+	if ((path = mukv_segment_path(kv, i)) == NULL) {
+		return ENOMEM;
+	}
+	kv->segs[i].file = fopen(path, "w+b");
+	free(path);
+	if (kv->segs[i].file == NULL) {
+		return errno;
+	}
+	kv->segs[i].size = 0;
+	kv->segs[i].live = 0;
+	*seg = i;
+	return 0;
+}
+
+/* Closes and removes a segment */
+static void mukv_segment_remove(mukv_t *kv, unsigned int seg)
+{
+	char *path = mukv_segment_path(kv, seg);
+
+	fclose(kv->segs[seg].file);
+	kv->segs[seg].file = NULL;
+	if (path != NULL) {
+		unlink(path);
+		free(path);
+	}
+}
+
+/* Writes all buffered records to the active segment */
+static int mukv_flush(mukv_t *kv)
+{
+	segment_t *s = &kv->segs[kv->active];
+	long off = s->size - (long)kv->buf_len;
+
+	if (kv->buf_len == 0) {
+		return 0;
+	}
+	if (fseek(s->file, off, SEEK_SET) != 0) {
+		return errno;
+	}
+	if (fwrite(kv->buf, 1, kv->buf_len, s->file) != kv->buf_len) {
+		return errno;
+	}
+	kv->buf_len = 0;
+	return 0;
+}
+
+/* Reads the data of an index entry */
+static mdatum_t mukv_read(mukv_t *kv, entry_t *entry, apr_pool_t *pool)
+{
+	FILE *file = kv->segs[entry->seg].file;
+	mdatum_t val;
+
+	val.dptr = NULL;
+	val.dsize = 0;
+
+	/* Records may still be buffered */
+	if (entry->seg == kv->active && kv->buf_len > 0) {
+		long buf_off = kv->segs[kv->active].size - (long)kv->buf_len;
+		if (entry->off >= buf_off) {
+			val.dptr = apr_palloc(pool, entry->size);
+			memcpy(val.dptr, kv->buf + (entry->off - buf_off), entry->size);
+			val.dsize = entry->size;
+			return val;
+		} else if (entry->off + (long)entry->size > buf_off && mukv_flush(kv) != 0) {
+			return val;
+		}
+	}
+
+	/* Always seek, as reading right after writing isn't allowed */
+	if (fseek(file, entry->off, SEEK_SET) != 0) {
+		return val;
+	}
+	val.dptr = apr_palloc(pool, entry->size);
+	if (fread(val.dptr, 1, entry->size, file) != entry->size) {
+		val.dptr = NULL;
+		return val;
+	}
+	val.dsize = entry->size;
+	return val;
+}
+
+/* qsort() callback for sorting entries by segment and file offset */
+static int mukv_compare_offsets(const void *a, const void *b)
+{
+	const entry_t *ea = ((const entry_ref_t *)a)->entry;
+	const entry_t *eb = ((const entry_ref_t *)b)->entry;
+	if (ea->seg != eb->seg) {
+		return (ea->seg < eb->seg ? -1 : 1);
+	}
+	return (ea->off < eb->off ? -1 : (ea->off > eb->off ? 1 : 0));
+}
+
+/* qsort() callback for sorting compacted records by file offset */
+static int mukv_compare_recs(const void *a, const void *b)
+{
+	long oa = ((const compact_rec_t *)a)->off;
+	long ob = ((const compact_rec_t *)b)->off;
+	return (oa < ob ? -1 : (oa > ob ? 1 : 0));
+}
+
+
+/* Frees a compaction job */
+static void mukv_compact_free(compact_job_t *job)
+{
+	size_t i;
+	for (i = 0; i < job->num; i++) {
+		free(job->recs[i].key);
+	}
+	free(job->recs);
+	free(job->src_path);
+	free(job->dst_path);
+	free(job);
+}
+
+/* Copies all live records of a segment to a new file */
+static int mukv_compact_copy(compact_job_t *job)
+{
+	FILE *in, *out;
+	char *buf = NULL;
+	size_t i, buf_size = 0;
+	int ret = 0;
+
+	if ((in = fopen(job->src_path, "rb")) == NULL) {
+		return -1;
+	}
+	if ((out = fopen(job->dst_path, "wb")) == NULL) {
+		fclose(in);
+		return -1;
+	}
+
+	job->size = 0;
+	for (i = 0; i < job->num && ret == 0; i++) {
+		compact_rec_t *rec = &job->recs[i];
+		if (rec->size > buf_size) {
+			char *tmp = realloc(buf, rec->size);
+			if (tmp == NULL) {
+				ret = -1;
+				break;
+			}
+			buf = tmp;
+			buf_size = rec->size;
+		}
+		if (fseek(in, rec->off, SEEK_SET) != 0
+		    || fread(buf, 1, rec->size, in) != rec->size
+		    || fwrite(buf, 1, rec->size, out) != rec->size) {
+			ret = -1;
+			break;
+		}
+		rec->new_off = job->size;
+		job->size += (long)rec->size;
+	}
+
+	free(buf);
+	fclose(in);
+	if (fclose(out) != 0) {
+		ret = -1;
+	}
+	return ret;
+}
+
+#if APR_HAS_THREADS
+
+/* Thread function: copies the records of a compaction job */
+static void * APR_THREAD_FUNC mukv_compact_thread(apr_thread_t *thd, void *baton)
+{
+	mukv_t *kv = baton;
+	compact_job_t *job = kv->job;
+	int status = (mukv_compact_copy(job) == 0 ? 1 : -1);
+
+	apr_thread_mutex_lock(kv->mutex);
+	job->status = status;
+	apr_thread_mutex_unlock(kv->mutex);
+
+	apr_thread_exit(thd, APR_SUCCESS);
+	return NULL;
+}
+
+#endif /* APR_HAS_THREADS */
+
+/* Finishes the running compaction, if any, by pointing the index to the
+   copied records. Records that have been deleted or replaced in the
+   meantime are left alone. Optionally waits for the compaction */
+static int mukv_compact_finish(mukv_t *kv, int wait)
+{
+	compact_job_t *job = kv->job;
+	segment_t *dst;
+	size_t i;
+	int status;
+
+	if (job == NULL) {
+		return 0;
+	}
+
+#if APR_HAS_THREADS
+	if (job->thread != NULL) {
+		apr_status_t retval;
+		apr_thread_mutex_lock(kv->mutex);
+		status = job->status;
+		apr_thread_mutex_unlock(kv->mutex);
+		if (status == 0 && !wait) {
+			return 0;
+		}
+		apr_thread_join(&retval, job->thread);
+	}
+#endif
+	status = job->status;
+	kv->job = NULL;
+
+	dst = &kv->segs[job->dst];
+	dst->reserved = 0;
+	if (status < 0 || (dst->file = fopen(job->dst_path, "rb")) == NULL) {
+		/* The source segment stays in place */
+		unlink(job->dst_path);
+		mukv_compact_free(job);
+		return 0;
+	}
+	dst->size = job->size;
+	dst->live = 0;
+
+	for (i = 0; i < job->num; i++) {
+		compact_rec_t *rec = &job->recs[i];
+		entry_t *entry = rhash_get(kv->index, rec->key, rec->klen);
+		if (entry != NULL && entry->seg == job->src && entry->off == rec->off) {
+			entry->seg = job->dst;
+			entry->off = rec->new_off;
+			dst->live += (long)rec->size;
+		}
+	}
+
+	mukv_segment_remove(kv, job->src);
+	mukv_compact_free(job);
+	return 0;
+}
+
+/* Starts compacting a segment if it's sparse enough */
+static void mukv_compact_check(mukv_t *kv, unsigned int seg)
+{
+	segment_t *s = &kv->segs[seg];
+	compact_job_t *job;
+	apr_hash_index_t *hi;
+	apr_pool_t *pool;
+	size_t n = 0;
+	unsigned int i;
+
+	if (seg == kv->active || s->file == NULL) {
+		return;
+	}
+
+	/* Empty segments are removed right away, unless they are being compacted */
+	if (s->live == 0 && (kv->job == NULL || kv->job->src != seg)) {
+		mukv_segment_remove(kv, seg);
+		return;
+	}
+	if (kv->job != NULL) {
+		return;
+	}
+	if (s->live >= (s->size / 100) * COMPACT_THRESHOLD) {
+		return;
+	}
+
+	/* Find a slot for the new segment */
+	if (mukv_segment_slot(kv, &i) != 0) {
+		return;
+	}
+
+	if ((job = calloc(1, sizeof(compact_job_t))) == NULL) {
+		return;
+	}
+	job->src = seg;
+	job->dst = i;
+	job->src_path = mukv_segment_path(kv, seg);
+	job->dst_path = mukv_segment_path(kv, i);
+	job->recs = malloc(rhash_count(kv->index) * sizeof(compact_rec_t) + 1);
+	if (job->src_path == NULL || job->dst_path == NULL || job->recs == NULL) {
+		mukv_compact_free(job);
+		return;
+	}
+
+	/* Collect the live records of the segment */
+	pool = svn_pool_create(NULL);
+	for (hi = rhash_first(pool, kv->index); hi; hi = rhash_next(hi)) {
+		const void *key;
+		apr_ssize_t klen;
+		entry_t *entry;
+
+		rhash_this(hi, &key, &klen, (void **)&entry);
+		if (entry->seg != seg) {
+			continue;
+		}
+		if ((job->recs[n].key = malloc(klen)) == NULL) {
+			break;
+		}
+		memcpy(job->recs[n].key, key, klen);
+		job->recs[n].klen = klen;
+		job->recs[n].off = entry->off;
+		job->recs[n].size = entry->size;
+		job->num = ++n;
+	}
+	svn_pool_destroy(pool);
+	if (hi != NULL) {
+		mukv_compact_free(job);
+		return;
+	}
+	qsort(job->recs, job->num, sizeof(compact_rec_t), mukv_compare_recs);
+
+	/* The segment is read through a separate handle */
+	if (fflush(kv->segs[seg].file) != 0) {
+		mukv_compact_free(job);
+		return;
+	}
+
+	kv->segs[i].reserved = 1;
+	kv->job = job;
+
+#if APR_HAS_THREADS
+	if (kv->mutex != NULL && apr_thread_create(&job->thread, NULL, mukv_compact_thread, kv, kv->pool) == APR_SUCCESS) {
+		return;
+	}
+	job->thread = NULL;
+#endif
+
+	/* Without threads, compact right away */
+	job->status = (mukv_compact_copy(job) == 0 ? 1 : -1);
+	mukv_compact_finish(kv, 1);
+}
+
+/* Accounts for a record that is no longer referenced by the index */
+static void mukv_release(mukv_t *kv, entry_t *entry)
+{
+	kv->segs[entry->seg].live -= (long)entry->size;
+	mukv_compact_check(kv, entry->seg);
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
 
 /* Opens a file to be used for random-accesible storage */
 mukv_t *mukv_open(const char *path, apr_pool_t *pool)
 {
-	mukv_t *kv = apr_palloc(pool, sizeof(mukv_t));
+	mukv_t *kv = apr_pcalloc(pool, sizeof(mukv_t));
 	kv->index = rhash_make(pool);
 	kv->path = apr_pstrdup(pool, path);
-	if ((kv->file = fopen(path, "w+")) == NULL) {
+	if (mukv_segment_create(kv, &kv->active) != 0) {
+		free(kv->segs);
 		return NULL;
 	}
+
+#if APR_HAS_THREADS
+	/* Without a mutex, segments are compacted synchronously */
+	if ((kv->pool = utils_thread_pool_create(&kv->mutex, NULL, NULL)) == NULL) {
+		kv->mutex = NULL;
+	}
+#endif
 	return kv;
 }
 
 /* Closes the storage and sends it into oblivion */
 int mukv_close(mukv_t *kv)
 {
+	unsigned int i;
+	int ret = 0;
+
+	mukv_compact_finish(kv, 1);
+	mukv_flush(kv);
 	rhash_clear(kv->index);
 
 	/* Goodbye, data */
-	if (fclose(kv->file) != 0 || unlink(kv->path) != 0) {
-		return errno;
+	for (i = 0; i < kv->num_segs; i++) {
+		char *path;
+		if (kv->segs[i].file == NULL) {
+			continue;
+		}
+		path = mukv_segment_path(kv, i);
+		if (fclose(kv->segs[i].file) != 0 || path == NULL || unlink(path) != 0) {
+			ret = (path == NULL ? ENOMEM : errno);
+		}
+		free(path);
 	}
-	return 0;
+	free(kv->segs);
+	kv->segs = NULL;
+	kv->num_segs = 0;
+	free(kv->buf);
+	kv->buf = NULL;
+
+#if APR_HAS_THREADS
+	if (kv->pool != NULL) {
+		svn_pool_destroy(kv->pool);
+		kv->pool = NULL;
+	}
+#endif
+	return ret;
 }
 
 /* Stores a record */
 int mukv_store(mukv_t *kv, mdatum_t key, mdatum_t val)
 {
-	entry_t entry;
-	if (fseek(kv->file, 0, SEEK_END) != 0) {
-		return errno;
+	segment_t *s;
+	entry_t entry, *old;
+	int ret;
+
+	mukv_compact_finish(kv, 0);
+
+	/* Start a new segment if the current one is full */
+	s = &kv->segs[kv->active];
+	if (s->size > 0 && s->size + (long)val.dsize > SEGMENT_SIZE) {
+		unsigned int prev = kv->active;
+		if ((ret = mukv_flush(kv)) != 0 || (ret = mukv_segment_create(kv, &kv->active)) != 0) {
+			return ret;
+		}
+		mukv_compact_check(kv, prev);
+		s = &kv->segs[kv->active];
 	}
-	entry.off = ftell(kv->file);
+
+	entry.seg = kv->active;
+	entry.off = s->size;
 	entry.size = val.dsize;
 
-	if (fwrite(val.dptr, 1, val.dsize, kv->file) != val.dsize) {
-		return errno;
+	if (kv->batch) {
+		/* Append to buffer */
+		if (kv->buf_len + val.dsize > kv->buf_size) {
+			size_t size = (kv->buf_size > 0 ? kv->buf_size : 4096);
+			char *tmp;
+			while (size < kv->buf_len + val.dsize) {
+				size *= 2;
+			}
+			if ((tmp = realloc(kv->buf, size)) == NULL) {
+				return ENOMEM;
+			}
+			kv->buf = tmp;
+			kv->buf_size = size;
+		}
+		memcpy(kv->buf + kv->buf_len, val.dptr, val.dsize);
+		kv->buf_len += val.dsize;
+	} else {
+		/* Always seek, as writing right after reading isn't allowed */
+		if (fseek(s->file, s->size, SEEK_SET) != 0) {
+			return errno;
+		}
+		if (fwrite(val.dptr, 1, val.dsize, s->file) != val.dsize) {
+			return errno;
+		}
 	}
+	s->size += (long)val.dsize;
+	s->live += (long)val.dsize;
 
-	rhash_set(kv->index, key.dptr, key.dsize, &entry, sizeof(entry_t));
+	if ((old = rhash_get(kv->index, key.dptr, key.dsize)) != NULL) {
+		entry_t tmp = *old;
+		rhash_set(kv->index, key.dptr, key.dsize, &entry, sizeof(entry_t));
+		mukv_release(kv, &tmp);
+	} else {
+		rhash_set(kv->index, key.dptr, key.dsize, &entry, sizeof(entry_t));
+	}
 	return 0;
 }
 
+/* Starts a batch: records are collected in memory until mukv_end() */
+void mukv_begin(mukv_t *kv)
+{
+	kv->batch = 1;
+}
+
+/* Ends a batch, writing all collected records at once */
+int mukv_end(mukv_t *kv)
+{
+	kv->batch = 0;
+	return mukv_flush(kv);
+}
+
 /* Retrieves a record */
 mdatum_t mukv_fetch(mukv_t *kv, mdatum_t key, apr_pool_t *pool)
 {
@@ -101,27 +660,19 @@ mdatum_t mukv_fetch(mukv_t *kv, mdatum_t key, apr_pool_t *pool)
 	if (entry == NULL) {
 		return val;
 	}
-
-	if (ftell(kv->file) != entry->off) {
-		if (fseek(kv->file, entry->off, SEEK_SET) != 0) {
-			return val;
-		}
-	}
-	val.dptr = apr_palloc(pool, entry->size);
-	if (fread(val.dptr, 1, entry->size, kv->file) != entry->size) {
-		val.dptr = NULL;
-		return val;
-	}
-	val.dsize = entry->size;
-	return val;
+	return mukv_read(kv, entry, pool);
 }
 
-/* Deletes a record (from the index, not from the disk) */
+/* Deletes a record. Its space is reclaimed once the segment is compacted */
 int mukv_delete(mukv_t *kv, mdatum_t key)
 {
 	entry_t *entry = rhash_get(kv->index, key.dptr, key.dsize);
+
+	mukv_compact_finish(kv, 0);
 	if (entry) {
+		entry_t tmp = *entry;
 		rhash_set(kv->index, key.dptr, key.dsize, NULL, 0);
+		mukv_release(kv, &tmp);
 	}
 	return 0;
 }
@@ -131,3 +682,94 @@ int mukv_exists(mukv_t *kv, mdatum_t key)
 {
 	return (rhash_get(kv->index, key.dptr, key.dsize) != NULL);
 }
+
+/* Returns the storage location of a record */
+int mukv_locate(mukv_t *kv, mdatum_t key, mlocation_t *loc)
+{
+	entry_t *entry = rhash_get(kv->index, key.dptr, key.dsize);
+	if (entry == NULL) {
+		return -1;
+	}
+	loc->segment = entry->seg;
+	loc->off = entry->off;
+	loc->size = entry->size;
+	return 0;
+}
+
+/* Reads a range of a segment, e.g. multiple adjacent records at once */
+mdatum_t mukv_read_range(mukv_t *kv, const mlocation_t *loc, apr_pool_t *pool)
+{
+	entry_t entry;
+	mdatum_t val;
+
+	if (loc->segment >= kv->num_segs || kv->segs[loc->segment].file == NULL) {
+		val.dptr = NULL;
+		val.dsize = 0;
+		return val;
+	}
+	entry.seg = loc->segment;
+	entry.off = loc->off;
+	entry.size = loc->size;
+	return mukv_read(kv, &entry, pool);
+}
+
+/* Writes all records to a stream, in storage order */
+int mukv_save(mukv_t *kv, FILE *out, apr_pool_t *pool)
+{
+	apr_pool_t *subpool = svn_pool_create(pool);
+	apr_hash_index_t *hi;
+	entry_ref_t *refs;
+	unsigned long i, n = 0;
+
+	mukv_compact_finish(kv, 1);
+	if (mukv_flush(kv) != 0) {
+		return -1;
+	}
+
+	refs = apr_palloc(pool, (rhash_count(kv->index) + 1) * sizeof(entry_ref_t));
+	for (hi = rhash_first(pool, kv->index); hi; hi = rhash_next(hi)) {
+		rhash_this(hi, &refs[n].key, &refs[n].klen, (void **)&refs[n].entry);
+		++n;
+	}
+	qsort(refs, n, sizeof(entry_ref_t), mukv_compare_offsets);
+
+	if (fwrite(&n, sizeof(unsigned long), 1, out) != 1) {
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		mdatum_t val = mukv_read(kv, refs[i].entry, subpool);
+		if (val.dptr == NULL) {
+			return -1;
+		}
+		if (utils_write_chunk(out, refs[i].key, refs[i].klen) != 0 || utils_write_chunk(out, val.dptr, val.dsize) != 0) {
+			return -1;
+		}
+		svn_pool_clear(subpool);
+	}
+
+	svn_pool_destroy(subpool);
+	return 0;
+}
+/* Reads records that have been written with mukv_save() */
+int mukv_load(mukv_t *kv, FILE *in, apr_pool_t *pool)
+{
+	apr_pool_t *subpool = svn_pool_create(pool);
+	unsigned long i, n;
+
+	if (fread(&n, sizeof(unsigned long), 1, in) != 1) {
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		mdatum_t key, val;
+		if (utils_read_chunk(in, &key.dptr, &key.dsize, subpool) != 0 || utils_read_chunk(in, &val.dptr, &val.dsize, subpool) != 0) {
+			return -1;
+		}
+		if (mukv_store(kv, key, val) != 0) {
+			return -1;
+		}
+		svn_pool_clear(subpool);
+	}
+
+	svn_pool_destroy(subpool);
+	return 0;
+}
@@ -25,6 +25,8 @@
 #define MUKV_H_
 
 
+#include <stdio.h>
+
 #include <apr_pools.h>
 
 
@@ -35,6 +37,14 @@ typedef struct {
 	size_t dsize;
 } mdatum_t;
 
+/* Storage location. Records are only moved when other records in their
+   segment are deleted or replaced */
+typedef struct {
+	unsigned int segment;
+	long off;
+	size_t size;
+} mlocation_t;
+
 
 /* Opens a file to be used for random-accesible storage */
 extern mukv_t *mukv_open(const char *path, apr_pool_t *pool);
@@ -45,14 +55,32 @@ extern int mukv_close(mukv_t *kv);
 /* Stores a record */
 extern int mukv_store(mukv_t *kv, mdatum_t key, mdatum_t val);
 
+/* Starts a batch: records are collected in memory until mukv_end() */
+extern void mukv_begin(mukv_t *kv);
+
+/* Ends a batch, writing all collected records at once */
+extern int mukv_end(mukv_t *kv);
+
 /* Retrieves a record */
 extern mdatum_t mukv_fetch(mukv_t *kv, mdatum_t key, apr_pool_t *pool);
 
-/* Deletes a record (from the index, not from the disk) */
+/* Deletes a record. Its space is reclaimed once the segment is compacted */
 extern int mukv_delete(mukv_t *kv, mdatum_t key);
 
 /* Checks whether a record exists */
 extern int mukv_exists(mukv_t *kv, mdatum_t key);
 
+/* Returns the storage location of a record */
+extern int mukv_locate(mukv_t *kv, mdatum_t key, mlocation_t *loc);
+
+/* Reads a range of a segment, e.g. multiple adjacent records at once */
+extern mdatum_t mukv_read_range(mukv_t *kv, const mlocation_t *loc, apr_pool_t *pool);
+
+/* Writes all records to a stream, in storage order */
+extern int mukv_save(mukv_t *kv, FILE *out, apr_pool_t *pool);
+
+/* Reads records that have been written with mukv_save() */
+extern int mukv_load(mukv_t *kv, FILE *in, apr_pool_t *pool);
+
 
 #endif /* MUKV_H_ */
@@ -22,16 +22,25 @@
 
 
 #include <assert.h>
+#include <stdlib.h>
 
 #include <apr_tables.h>
+#if APR_HAS_THREADS
+ #include <apr_thread_cond.h>
+ #include <apr_thread_mutex.h>
+ #include <apr_thread_proc.h>
+#endif
 
+#include <svn_delta.h>
 #include <svn_ra.h>
 
 #include "main.h"
 
 #include "delta.h"
+#include "filter.h"
 #include "logger.h"
 #include "mukv.h"
+#include "stats.h"
 #include "utils.h"
 
 #include "critbit89/critbit.h"
@@ -42,8 +51,28 @@
 #include "path_repo.h"
 
 
-#define SNAPSHOT_INTERVAL (1<<10)  /* Interval for full-tree snapshots */
+#ifndef SNAPSHOT_INTERVAL
+	#define SNAPSHOT_INTERVAL (1<<10)  /* Interval for full-tree snapshots, a power of 2 */
+#endif
 #define CACHE_SIZE 4               /* Number of cached full trees */
+#define READ_GAP (1<<16)           /* Maximum gap between deltas read at once */
+
+/*
+ * Record types. Paths are sorted and front-coded, i.e. every path is
+ * stored as the length of the prefix shared with the previous one and the
+ * remaining suffix, both lengths being varints. Deltas store an action
+ * ('+' or '-') before each path.
+ */
+#define RECORD_SNAPSHOT 'S'
+#define RECORD_DELTA 'D'
+
+/*
+ * Snapshots are stored under their own keys, next to the delta of the
+ * same revision. They are written in the background, and reconstruction
+ * falls back to the previous snapshot until the new one has been stored.
+ */
+#define SNAPSHOT_KEY_FORMAT "s%ld"
+#define SNAPSHOT_WRITE 'W'
 
 
 /*---------------------------------------------------------------------------*/
@@ -54,15 +83,58 @@
 typedef struct {
 	svn_revnum_t revision;
 	cb_tree_t tree;
+	apr_pool_t *memo_pool;
+	apr_hash_t *memo;   /* Results of path queries on this tree */
 } pr_cache_entry_t;
 
 
+/* Memoized query results. Paths that don't exist are also noted if there
+   are no paths below them, which answers queries for all children */
+#define MEMO_MISSING 0
+#define MEMO_EXISTS 1
+#define MEMO_EMPTY 2
+
+
 typedef struct {
 	char action;
 	char *path;
 } pr_delta_entry_t;
 
 
+#if APR_HAS_THREADS
+
+/* Message for the snapshot thread: a record to seed the thread with
+   (RECORD_SNAPSHOT), a committed delta (RECORD_DELTA) or a request to
+   write a snapshot (SNAPSHOT_WRITE). For the latter, data is set to the
+   stored snapshot record once finished. Deltas that could not be tracked
+   are handed back without data as well */
+typedef struct pr_snapshot_msg_t {
+	char type;
+	svn_revnum_t revision;
+	char *data;   /* malloc()'ed */
+	size_t len;
+	struct pr_snapshot_msg_t *next;
+} pr_snapshot_msg_t;
+
+
+/* Private state of the snapshot thread. It only knows about the last
+   snapshot and the paths that changed since then, so the current tree
+   never needs to be copied */
+typedef struct {
+	char *base;          /* Last snapshot record, uncompressed, malloc()'ed */
+	size_t base_len;
+	cb_tree_t added;     /* Paths added since the last snapshot */
+	cb_tree_t deleted;   /* Paths deleted since the last snapshot */
+	char failed;         /* A delta has been lost, the state is incomplete */
+	apr_pool_t *pool;
+#ifdef USE_SNAPPY
+	struct snappy_env *snappy_env;
+#endif
+} pr_snapshot_state_t;
+
+#endif /* APR_HAS_THREADS */
+
+
 struct path_repo_t {
 	apr_pool_t *pool;
 	mukv_t *db;
@@ -73,20 +145,30 @@ struct path_repo_t {
 	cb_tree_t tree;
 	svn_revnum_t head;
 
+	apr_array_header_t *locations;   /* Deltas, indexed by revision */
+	svn_stringbuf_t *query_buf;
+
 	apr_array_header_t *cache;   /* FIFO cache */
 	int cache_index;
-
+	int cache_last;
+
+	char snapshot_seeded;   /* Snapshot thread is in sync with the history */
+#if APR_HAS_THREADS
+	apr_pool_t *snapshot_pool;
+	apr_thread_t *snapshot_thread;
+	apr_thread_mutex_t *snapshot_mutex;
+	apr_thread_cond_t *snapshot_cond;
+	pr_snapshot_msg_t *snapshot_queue, *snapshot_queue_tail;
+	pr_snapshot_msg_t *snapshot_done;
+	int snapshot_pending;
+	char snapshot_stopping;
 #ifdef USE_SNAPPY
-	struct snappy_env snappy_env;
+	struct snappy_env snapshot_snappy_env;
+#endif
 #endif
 
-#ifdef DEBUG
-	size_t delta_bytes;
-	size_t delta_bytes_raw;
-	int cache_hits;
-	int cache_misses;
-	apr_time_t recon_time;
-	apr_time_t store_time;
+#ifdef USE_SNAPPY
+	struct snappy_env snappy_env;
 #endif
 };
 
@@ -96,27 +178,18 @@ struct path_repo_t {
 /*---------------------------------------------------------------------------*/
 
 
+static void pr_snapshot_stop(path_repo_t *repo);
+
 /* Clears remaining memory of the path repo */
 static apr_status_t pr_cleanup(void *data)
 {
 	path_repo_t *repo = data;
 	int i;
 
-#ifdef DEBUG
-	L1("path_repo: snapshot interval:   %d\n", SNAPSHOT_INTERVAL);
-	L1("path_repo: cache size:          %d\n", CACHE_SIZE);
-	L1("path_repo: stored deltas:       %d kB\n", repo->delta_bytes / 1024);
-	L1("path_repo: stored deltas (raw): %d kB\n", repo->delta_bytes_raw / 1024);
-	L1("path_repo: total recon time:    %ld ms\n", apr_time_msec(repo->recon_time));
-	L1("path_repo: total store time:    %ld ms\n", apr_time_msec(repo->store_time));
-	L1("path_repo: cache miss rate:     %.2f%% (%d of %d)\n", 100.0f*repo->cache_misses / (repo->cache_hits+repo->cache_misses), repo->cache_misses, (repo->cache_hits+repo->cache_misses));
-#endif
-
+	pr_snapshot_stop(repo);
 	cb_tree_clear(&repo->tree);
 	for (i = 0; i < repo->cache->nelts; i++) {
-		if (APR_ARRAY_IDX(repo->cache, i, pr_cache_entry_t).tree.root) {
-			cb_tree_clear(&APR_ARRAY_IDX(repo->cache, i, pr_cache_entry_t).tree);
-		}
+		cb_tree_free(&APR_ARRAY_IDX(repo->cache, i, pr_cache_entry_t).tree);
 	}
 
 	mukv_close(repo->db);
@@ -134,10 +207,14 @@ static void pr_cache_init(path_repo_t *repo, int size)
 	int i;
 	repo->cache = apr_array_make(repo->pool, size, sizeof(pr_cache_entry_t));
 	for (i = 0; i < size; i++) {
-		APR_ARRAY_PUSH(repo->cache, pr_cache_entry_t).revision = -1;
-		APR_ARRAY_IDX(repo->cache, i, pr_cache_entry_t).tree = cb_tree_make();
+		pr_cache_entry_t *entry = &APR_ARRAY_PUSH(repo->cache, pr_cache_entry_t);
+		entry->revision = -1;
+		entry->tree = cb_tree_make_arena();   /* Cheap to clear and rebuild */
+		entry->memo_pool = svn_pool_create(repo->pool);
+		entry->memo = apr_hash_make(entry->memo_pool);
 	}
 	repo->cache_index = 0;
+	repo->cache_last = 0;
 }
 
 
@@ -165,209 +242,1068 @@ static apr_array_header_t *pr_tree_to_array(cb_tree_t *tree, const char *path, a
 	if (cb_tree_walk_prefixed(tree, path, pr_tree_to_array_cb, &data) != 0) {
 		return NULL;
 	}
-	return data.arr;
+	return data.arr;
+}
+
+
+/* Appends a varint to a buffer */
+static void pr_put_varint(svn_stringbuf_t *buf, size_t value)
+{
+	char tmp[16];
+	int n = 0;
+
+	while (value >= 0x80) {
+		tmp[n++] = (char)((value & 0x7F) | 0x80);
+		value >>= 7;
+	}
+	tmp[n++] = (char)value;
+	svn_stringbuf_appendbytes(buf, tmp, n);
+}
+
+
+/* Reads a varint, returning the position after it or NULL on error */
+static const unsigned char *pr_get_varint(const unsigned char *dptr, const unsigned char *end, size_t *value)
+{
+	int shift = 0;
+
+	*value = 0;
+	while (dptr < end && shift < (int)(8 * sizeof(size_t))) {
+		*value |= (size_t)(*dptr & 0x7F) << shift;
+		if (!(*dptr++ & 0x80)) {
+			return dptr;
+		}
+		shift += 7;
+	}
+	return NULL;
+}
+
+
+/* Front-coding encoder state */
+typedef struct {
+	svn_stringbuf_t *buf;
+	const char *prev;
+	size_t prev_len;
+} pr_encoder_t;
+
+
+/* Appends a path to a record */
+static void pr_encode_path(pr_encoder_t *enc, char action, const char *path)
+{
+	size_t len = strlen(path), shared = 0;
+
+	if (enc->prev != NULL) {
+		while (shared < len && shared < enc->prev_len && path[shared] == enc->prev[shared]) {
+			++shared;
+		}
+	}
+
+	if (action) {
+		svn_stringbuf_appendbytes(enc->buf, &action, 1);
+	}
+	pr_put_varint(enc->buf, shared);
+	pr_put_varint(enc->buf, len - shared);
+	svn_stringbuf_appendbytes(enc->buf, path + shared, len - shared);
+
+	enc->prev = path;
+	enc->prev_len = len;
+}
+
+
+/* Tree walk callback for pr_encode() */
+static int pr_encode_cb(const char *elem, void *arg)
+{
+	pr_encode_path((pr_encoder_t *)arg, 0, elem);
+	return 0;
+}
+
+
+/* Encodes a whole tree as a snapshot */
+static int pr_encode(cb_tree_t *tree, char **data, size_t *len, apr_pool_t *pool)
+{
+	pr_encoder_t enc;
+
+	/* Tree walks are in sorted order already */
+	enc.buf = svn_stringbuf_create_ensure(4096, pool);
+	enc.prev = NULL;
+	enc.prev_len = 0;
+	svn_stringbuf_appendbytes(enc.buf, "S", 1);
+	if (cb_tree_walk_prefixed(tree, "", pr_encode_cb, &enc) != 0) {
+		return -1;
+	}
+
+	*data = enc.buf->data;
+	*len = enc.buf->len;
+	return 0;
+}
+
+
+/* Comparison function for sorting delta entries. Multiple actions on the
+   same path stay in their original order */
+static int pr_delta_entry_cmp(const void *a, const void *b)
+{
+	const pr_delta_entry_t *ea = *(const pr_delta_entry_t **)a;
+	const pr_delta_entry_t *eb = *(const pr_delta_entry_t **)b;
+	int ret = strcmp(ea->path, eb->path);
+
+	if (ret != 0) {
+		return ret;
+	}
+	return (ea < eb ? -1 : (ea > eb ? 1 : 0));
+}
+
+
+/* Encodes a series of scheduled actions */
+static void pr_encode_delta(apr_array_header_t *delta, char **data, size_t *len, apr_pool_t *pool)
+{
+	pr_delta_entry_t **sorted;
+	pr_encoder_t enc;
+	int i;
+
+	/* Actions on different paths are independent, so they can be sorted */
+	sorted = apr_palloc(pool, (delta->nelts + 1) * sizeof(pr_delta_entry_t *));
+	for (i = 0; i < delta->nelts; i++) {
+		sorted[i] = &APR_ARRAY_IDX(delta, i, pr_delta_entry_t);
+	}
+	qsort(sorted, delta->nelts, sizeof(pr_delta_entry_t *), pr_delta_entry_cmp);
+
+	enc.buf = svn_stringbuf_create_ensure(256, pool);
+	enc.prev = NULL;
+	enc.prev_len = 0;
+	svn_stringbuf_appendbytes(enc.buf, "D", 1);
+	for (i = 0; i < delta->nelts; i++) {
+		pr_encode_path(&enc, sorted[i]->action, sorted[i]->path);
+	}
+
+	*data = enc.buf->data;
+	*len = enc.buf->len;
+}
+
+
+/* Callback for entries of decoded records */
+typedef int (*pr_decode_cb_t)(char action, const char *path, size_t len, void *baton);
+
+/* Decodes a serialized snapshot or tree delta, running the callback for
+   every entry. Snapshot entries are reported as additions */
+static int pr_decode(const char *data, size_t len, pr_decode_cb_t callback, void *baton)
+{
+	const unsigned char *dptr = (const unsigned char *)data + 1;
+	const unsigned char *end = (const unsigned char *)data + len;
+	char *path = NULL;
+	size_t path_len = 0, path_size = 0;
+	char type;
+	int ret = 0;
+
+	if (len < 1 || (data[0] != RECORD_SNAPSHOT && data[0] != RECORD_DELTA)) {
+		return -1;
+	}
+	type = data[0];
+
+	while (dptr < end) {
+		char action = '+';
+		size_t shared, suffix;
+
+		if (type == RECORD_DELTA) {
+			action = (char)*dptr++;
+		}
+		if ((dptr = pr_get_varint(dptr, end, &shared)) == NULL
+		    || (dptr = pr_get_varint(dptr, end, &suffix)) == NULL
+		    || shared > path_len || suffix > (size_t)(end - dptr)) {
+			ret = -1;
+			break;
+		}
+
+		/* Reconstruct path */
+		if (shared + suffix + 1 > path_size) {
+			char *tmp;
+			path_size = 2 * (shared + suffix + 1);
+			if ((tmp = realloc(path, path_size)) == NULL) {
+				ret = -1;
+				break;
+			}
+			path = tmp;
+		}
+		memcpy(path + shared, dptr, suffix);
+		path_len = shared + suffix;
+		path[path_len] = '\0';
+		dptr += suffix;
+
+		if (callback(action, path, path_len, baton) != 0) {
+			ret = -1;
+			break;
+		}
+	}
+
+	free(path);
+	return ret;
+}
+
+
+/* Callback for pr_delta_apply() */
+struct pr_apply_data {
+	cb_tree_t *tree;
+	apr_array_header_t *paths;
+};
+static int pr_delta_apply_cb(char action, const char *path, size_t len, void *baton)
+{
+	struct pr_apply_data *data = baton;
+	if (data->paths != NULL) {
+		APR_ARRAY_PUSH(data->paths, const char *) = apr_pstrndup(data->paths->pool, path, len);
+	} else if (action == '+') {
+		return (cb_tree_insert(data->tree, path) == ENOMEM ? -1 : 0);
+	} else {
+		cb_tree_delete(data->tree, path);
+	}
+	return 0;
+}
+
+/* Applies a serialized snapshot or tree delta to a tree */
+static int pr_delta_apply(cb_tree_t *tree, const char *data, int len, apr_pool_t *pool)
+{
+	apr_pool_t *subpool = NULL;
+	struct pr_apply_data ad;
+	int ret;
+
+	ad.tree = tree;
+	ad.paths = NULL;
+
+	/* Snapshots for empty trees are built in bulk */
+	if (len > 0 && data[0] == RECORD_SNAPSHOT && tree->root == NULL) {
+		subpool = svn_pool_create(pool);
+		ad.paths = apr_array_make(subpool, 1024, sizeof(const char *));
+	}
+
+	ret = pr_decode(data, len, pr_delta_apply_cb, &ad);
+	if (ret == 0 && ad.paths != NULL) {
+		if (cb_tree_build_sorted(tree, (const char *const *)ad.paths->elts, ad.paths->nelts) != 0) {
+			ret = -1;
+		}
+	}
+
+	if (subpool != NULL) {
+		svn_pool_destroy(subpool);
+	}
+	return ret;
+}
+
+
+/* Compresses a record and stores it under the given key */
+static int pr_store(path_repo_t *repo, const char *key, char *data, size_t len, apr_pool_t *pool)
+{
+	mdatum_t k, val;
+#ifdef USE_SNAPPY
+	size_t dsize;
+#endif
+
+	stats_add(SC_PR_BYTES_RAW, len);
+
+	val.dptr = data;
+	val.dsize = len;
+#ifdef USE_SNAPPY
+	val.dptr = apr_palloc(pool, snappy_max_compressed_length(len));
+	if (snappy_compress(&repo->snappy_env, data, len, val.dptr, &dsize) != 0) {
+		fprintf(stderr, _("Error compressing tree data\n"));
+		return -1;
+	}
+	val.dsize = dsize;
+#endif
+
+	stats_add(SC_PR_BYTES, val.dsize);
+
+	k.dptr = (char *)key;
+	k.dsize = strlen(key);
+	return mukv_store(repo->db, k, val);
+}
+
+
+/* Applies a stored record to a tree, using the given buffer for
+   decompression */
+static int pr_apply(cb_tree_t *tree, const char *data, size_t len, char **buf, size_t *buf_size, apr_pool_t *pool)
+{
+#ifdef USE_SNAPPY
+	size_t dsize;
+
+	if (!snappy_uncompressed_length(data, len, &dsize)) {
+		return -1;
+	}
+	if (dsize > *buf_size) {
+		char *tmp = realloc(*buf, dsize);
+		if (tmp == NULL) {
+			return -1;
+		}
+		*buf = tmp;
+		*buf_size = dsize;
+	}
+	if (snappy_uncompress(data, len, *buf) != 0) {
+		return -1;
+	}
+	return pr_delta_apply(tree, *buf, dsize, pool);
+#else
+	(void)buf; /* Prevent compiler warnings */
+	(void)buf_size;
+	return pr_delta_apply(tree, data, len, pool);
+#endif
+}
+
+
+/* Fetches a stored record and applies it to a tree. Returns 1 if there is
+   no record for the given key */
+static int pr_load(path_repo_t *repo, cb_tree_t *tree, const char *key, apr_pool_t *pool)
+{
+	mdatum_t k, val;
+	char *buf = NULL;
+	size_t buf_size = 0;
+	int ret;
+
+	k.dptr = (char *)key;
+	k.dsize = strlen(key);
+	if (!mukv_exists(repo->db, k)) {
+		return 1;
+	}
+
+	val = mukv_fetch(repo->db, k, pool);
+	if (val.dptr == NULL) {
+		return -1;
+	}
+	ret = pr_apply(tree, val.dptr, val.dsize, &buf, &buf_size, pool);
+	free(buf);
+	return ret;
+}
+
+
+/* Returns the storage location of the delta for the given revision */
+static mlocation_t *pr_location(path_repo_t *repo, svn_revnum_t revision)
+{
+	if (revision < 0 || revision >= repo->locations->nelts) {
+		return NULL;
+	}
+	return &APR_ARRAY_IDX(repo->locations, revision, mlocation_t);
+}
+
+
+/* Records the storage location of the delta for the given revision. Records
+   are never deleted or replaced, so they won't be moved by the storage */
+static int pr_set_location(path_repo_t *repo, svn_revnum_t revision, const char *key)
+{
+	mdatum_t k;
+	mlocation_t *loc;
+
+	while (repo->locations->nelts <= revision) {
+		loc = &APR_ARRAY_PUSH(repo->locations, mlocation_t);
+		loc->segment = 0;
+		loc->off = 0;
+		loc->size = 0;   /* No delta */
+	}
+	loc = &APR_ARRAY_IDX(repo->locations, revision, mlocation_t);
+
+	k.dptr = (char *)key;
+	k.dsize = strlen(key);
+	return mukv_locate(repo->db, k, loc);
+}
+
+
+/* Applies the deltas of a range of revisions. Deltas are appended in
+   revision order, so adjacent ones are read at once */
+static int pr_replay(path_repo_t *repo, cb_tree_t *tree, svn_revnum_t first, svn_revnum_t last, apr_pool_t *pool)
+{
+	apr_pool_t *subpool = svn_pool_create(pool);
+	char *buf = NULL;
+	size_t buf_size = 0;
+	svn_revnum_t r = first;
+	int ret = 0;
+
+	while (r <= last && ret == 0) {
+		mlocation_t *loc = pr_location(repo, r);
+		svn_revnum_t end_rev = r, q;
+		mlocation_t range;
+		long end;
+		mdatum_t val;
+
+		if (loc == NULL) {
+			break;
+		}
+		if (loc->size == 0) {
+			++r;
+			continue;
+		}
+
+		/* Extend the range as long as the next delta follows closely */
+		end = loc->off + (long)loc->size;
+		for (q = r + 1; q <= last; q++) {
+			mlocation_t *next = pr_location(repo, q);
+			if (next == NULL) {
+				break;
+			}
+			if (next->size == 0) {
+				continue;
+			}
+			if (next->segment != loc->segment || next->off < end || next->off - end > READ_GAP) {
+				break;
+			}
+			end = next->off + (long)next->size;
+			end_rev = q;
+		}
+
+		range.segment = loc->segment;
+		range.off = loc->off;
+		range.size = (size_t)(end - loc->off);
+		val = mukv_read_range(repo->db, &range, subpool);
+		if (val.dptr == NULL) {
+			fprintf(stderr, _("Error fetching tree delta for revision %ld\n"), r);
+			ret = -1;
+			break;
+		}
+
+		for (q = r; q <= end_rev; q++) {
+			mlocation_t *rloc = pr_location(repo, q);
+			if (rloc->size == 0) {
+				continue;
+			}
+			if (pr_apply(tree, val.dptr + (rloc->off - loc->off), rloc->size, &buf, &buf_size, subpool) != 0) {
+				fprintf(stderr, _("Error applying tree delta for revision %ld\n"), q);
+				ret = -1;
+				break;
+			}
+		}
+
+		svn_pool_clear(subpool);
+		r = end_rev + 1;
+	}
+
+	free(buf);
+	svn_pool_destroy(subpool);
+	return ret;
+}
+
+
+/* Reconstructs a tree for the given revision */
+static int pr_reconstruct(path_repo_t *repo, cb_tree_t *tree, svn_revnum_t revision, apr_pool_t *pool)
+{
+	svn_revnum_t base;
+	apr_time_t start = stats_timer_start();
+
+	/* Start at the last snapshot that has been stored already */
+	base = (revision & ~(SNAPSHOT_INTERVAL-1));
+	while (base > 0) {
+		int ret = pr_load(repo, tree, apr_psprintf(pool, SNAPSHOT_KEY_FORMAT, base), pool);
+		if (ret < 0) {
+			fprintf(stderr, _("Error applying tree snapshot for revision %ld\n"), base);
+			return -1;
+		} else if (ret == 0) {
+			break;
+		}
+		base -= SNAPSHOT_INTERVAL;
+	}
+
+	/* Apply deltas */
+	if (pr_replay(repo, tree, (base > 0 ? base + 1 : 0), revision, pool) != 0) {
+		return -1;
+	}
+
+	stats_timer_stop(ST_PR_RECONSTRUCT, start);
+	return 0;
+}
+
+
+#if APR_HAS_THREADS
+
+/* Tracks a committed delta in the snapshot thread */
+static int pr_snapshot_fold_cb(char action, const char *path, size_t len, void *baton)
+{
+	pr_snapshot_state_t *st = baton;
+	if (action == '+') {
+		cb_tree_delete(&st->deleted, path);
+		return (cb_tree_insert(&st->added, path) == ENOMEM ? -1 : 0);
+	}
+	cb_tree_delete(&st->added, path);
+	return (cb_tree_insert(&st->deleted, path) == ENOMEM ? -1 : 0);
+}
+
+
+/* Merge data for pr_snapshot_write() */
+struct pr_merge_data {
+	pr_snapshot_state_t *st;
+	pr_encoder_t enc;
+	svn_stringbuf_t *last, *spare;   /* The encoder refers to the last path */
+	const char **added;
+	int num_added, index;
+};
+
+/* Appends a path to the new snapshot */
+static void pr_snapshot_emit(struct pr_merge_data *md, const char *path)
+{
+	svn_stringbuf_t *tmp = md->spare;
+	svn_stringbuf_set(tmp, path);
+	pr_encode_path(&md->enc, 0, tmp->data);
+	md->spare = md->last;
+	md->last = tmp;
+}
+
+/* Tree walk callback collecting added paths */
+static int pr_snapshot_added_cb(const char *elem, void *arg)
+{
+	APR_ARRAY_PUSH((apr_array_header_t *)arg, const char *) = elem;
+	return 0;
+}
+
+/* Merges a path of the last snapshot with the added paths */
+static int pr_snapshot_merge_cb(char action, const char *path, size_t len, void *baton)
+{
+	struct pr_merge_data *md = baton;
+
+	while (md->index < md->num_added) {
+		int cmp = strcmp(md->added[md->index], path);
+		if (cmp > 0) {
+			break;
+		} else if (cmp < 0) {
+			pr_snapshot_emit(md, md->added[md->index]);
+		}
+		++md->index;
+	}
+	if (!cb_tree_contains(&md->st->deleted, path)) {
+		pr_snapshot_emit(md, path);
+	}
+
+	(void)action; /* Prevent compiler warnings */
+	(void)len;
+	return 0;
+}
+
+/* Writes a new snapshot by merging the last one with all changes since */
+static int pr_snapshot_write(pr_snapshot_state_t *st, pr_snapshot_msg_t *msg)
+{
+	apr_pool_t *pool = svn_pool_create(st->pool);
+	apr_array_header_t *added = apr_array_make(pool, 1024, sizeof(const char *));
+	struct pr_merge_data md;
+	char *base;
+
+	if (cb_tree_walk_prefixed(&st->added, "", pr_snapshot_added_cb, added) != 0) {
+		svn_pool_destroy(pool);
+		return -1;
+	}
+
+	md.st = st;
+	md.enc.buf = svn_stringbuf_create_ensure(st->base_len + 4096, pool);
+	md.enc.prev = NULL;
+	md.enc.prev_len = 0;
+	md.last = svn_stringbuf_create_ensure(256, pool);
+	md.spare = svn_stringbuf_create_ensure(256, pool);
+	md.added = (const char **)added->elts;
+	md.num_added = added->nelts;
+	md.index = 0;
+
+	svn_stringbuf_appendbytes(md.enc.buf, "S", 1);
+	if (st->base != NULL && pr_decode(st->base, st->base_len, pr_snapshot_merge_cb, &md) != 0) {
+		svn_pool_destroy(pool);
+		return -1;
+	}
+	while (md.index < md.num_added) {
+		pr_snapshot_emit(&md, md.added[md.index++]);
+	}
+
+	/* The new snapshot is the base for the next one */
+	if ((base = malloc(md.enc.buf->len)) == NULL) {
+		svn_pool_destroy(pool);
+		return -1;
+	}
+	memcpy(base, md.enc.buf->data, md.enc.buf->len);
+	free(st->base);
+	st->base = base;
+	st->base_len = md.enc.buf->len;
+	cb_tree_clear(&st->added);
+	cb_tree_clear(&st->deleted);
+
+#ifdef USE_SNAPPY
+	msg->data = malloc(snappy_max_compressed_length(st->base_len));
+	if (msg->data == NULL || snappy_compress(st->snappy_env, st->base, st->base_len, msg->data, &msg->len) != 0) {
+		free(msg->data);
+		msg->data = NULL;
+	}
+#else
+	if ((msg->data = malloc(st->base_len)) != NULL) {
+		memcpy(msg->data, st->base, st->base_len);
+		msg->len = st->base_len;
+	}
+#endif
+
+	svn_pool_destroy(pool);
+	return (msg->data != NULL ? 0 : -1);
+}
+
+/* Processes a single message in the snapshot thread */
+static int pr_snapshot_process(pr_snapshot_state_t *st, pr_snapshot_msg_t *msg)
+{
+	switch (msg->type) {
+		case RECORD_SNAPSHOT:
+			free(st->base);
+			st->base = msg->data;
+			st->base_len = msg->len;
+			msg->data = NULL;
+			cb_tree_clear(&st->added);
+			cb_tree_clear(&st->deleted);
+			st->failed = 0;
+			return 0;
+
+		case RECORD_DELTA:
+			/* Once a delta is missing, no snapshot can be written until
+			   the thread has been seeded again */
+			if (!st->failed && pr_decode(msg->data, msg->len, pr_snapshot_fold_cb, st) != 0) {
+				st->failed = 1;
+				return -1;
+			}
+			return 0;
+
+		case SNAPSHOT_WRITE:
+			if (st->failed) {
+				return -1;
+			}
+			return pr_snapshot_write(st, msg);
+
+		default:
+			break;
+	}
+	return -1;
+}
+
+/* Thread function: maintains and writes snapshots until stopped */
+static void * APR_THREAD_FUNC pr_snapshot_thread(apr_thread_t *thd, void *baton)
+{
+	path_repo_t *repo = baton;
+	pr_snapshot_state_t st;
+
+	st.base = NULL;
+	st.base_len = 0;
+	st.added = cb_tree_make_arena();
+	st.deleted = cb_tree_make_arena();
+	st.failed = 0;
+	st.pool = svn_pool_create(repo->snapshot_pool);
+#ifdef USE_SNAPPY
+	st.snappy_env = &repo->snapshot_snappy_env;
+#endif
+
+	apr_thread_mutex_lock(repo->snapshot_mutex);
+	while (!repo->snapshot_stopping) {
+		pr_snapshot_msg_t *msg = repo->snapshot_queue;
+		int ret;
+
+		if (msg == NULL) {
+			apr_thread_cond_wait(repo->snapshot_cond, repo->snapshot_mutex);
+			continue;
+		}
+		if ((repo->snapshot_queue = msg->next) == NULL) {
+			repo->snapshot_queue_tail = NULL;
+		}
+		apr_thread_mutex_unlock(repo->snapshot_mutex);
+
+		if (msg->type == SNAPSHOT_WRITE) {
+			DEBUG_MSG("path_repo: writing snapshot for revision %ld\n", msg->revision);
+		}
+		ret = pr_snapshot_process(&st, msg);
+
+		apr_thread_mutex_lock(repo->snapshot_mutex);
+		if (msg->type == SNAPSHOT_WRITE || ret != 0) {
+			/* Failed snapshots are simply not stored, and failed deltas
+			   make the main thread seed a new snapshot */
+			if (ret != 0) {
+				DEBUG_MSG("path_repo: error processing snapshot data for revision %ld\n", msg->revision);
+				free(msg->data);
+				msg->data = NULL;
+			}
+			msg->next = repo->snapshot_done;
+			repo->snapshot_done = msg;
+			apr_thread_cond_broadcast(repo->snapshot_cond);
+		} else {
+			free(msg->data);
+			free(msg);
+		}
+	}
+	apr_thread_mutex_unlock(repo->snapshot_mutex);
+
+	free(st.base);
+	cb_tree_free(&st.added);
+	cb_tree_free(&st.deleted);
+	svn_pool_destroy(st.pool);
+	apr_thread_exit(thd, APR_SUCCESS);
+	return NULL;
+}
+
+#endif /* APR_HAS_THREADS */
+
+
+/* Starts the snapshot thread. Without thread support, snapshots are
+   written synchronously */
+static void pr_snapshot_start(path_repo_t *repo)
+{
+	/* The history is empty, matching the initial thread state */
+	repo->snapshot_seeded = 1;
+
+#if APR_HAS_THREADS
+#ifdef USE_SNAPPY
+	if (snappy_init_env(&repo->snapshot_snappy_env) != 0) {
+		return;
+	}
+#endif
+	repo->snapshot_pool = utils_thread_pool_create(&repo->snapshot_mutex, &repo->snapshot_cond, NULL);
+	if (repo->snapshot_pool == NULL
+	    || apr_thread_create(&repo->snapshot_thread, NULL, pr_snapshot_thread, repo, repo->snapshot_pool) != APR_SUCCESS) {
+		DEBUG_MSG("path_repo: Unable to start thread, writing snapshots synchronously\n");
+#ifdef USE_SNAPPY
+		snappy_free_env(&repo->snapshot_snappy_env);
+#endif
+		if (repo->snapshot_pool != NULL) {
+			svn_pool_destroy(repo->snapshot_pool);
+			repo->snapshot_pool = NULL;
+		}
+		repo->snapshot_thread = NULL;
+	}
+#endif
 }
 
 
-/* Encodes a whole tree to a series of add operations */
-static int pr_encode(cb_tree_t *tree, char **data, size_t *len, apr_pool_t *pool)
+/* Checks whether snapshots can be written in the background */
+static int pr_snapshot_async(path_repo_t *repo)
 {
-	int i;
-	char *dptr;
-	apr_array_header_t *arr = pr_tree_to_array(tree, "", pool);
-	if (arr == NULL) {
+#if APR_HAS_THREADS
+	return (repo->snapshot_thread != NULL);
+#else
+	(void)repo; /* Prevent compiler warnings */
+	return 0;
+#endif
+}
+
+
+/* Hands a message over to the snapshot thread. The data is copied */
+static int pr_snapshot_post(path_repo_t *repo, char type, svn_revnum_t revision, const char *data, size_t len)
+{
+#if APR_HAS_THREADS
+	pr_snapshot_msg_t *msg = malloc(sizeof(pr_snapshot_msg_t));
+
+	if (msg == NULL) {
 		return -1;
 	}
-
-	/* Compute length */
-	*len = 0;
-	for (i = 0; i < arr->nelts; i++) {
-		*len += 2 + strlen(APR_ARRAY_IDX(arr, i, char *));
+	msg->type = type;
+	msg->revision = revision;
+	msg->data = NULL;
+	msg->len = len;
+	msg->next = NULL;
+	if (len > 0) {
+		if ((msg->data = malloc(len)) == NULL) {
+			free(msg);
+			return -1;
+		}
+		memcpy(msg->data, data, len);
 	}
 
-	/* Encode */
-	*data = apr_palloc(pool, *len);
-	dptr = *data;
-	for (i = 0; i < arr->nelts; i++) {
-		*dptr++ = '+';
-		strcpy(dptr, APR_ARRAY_IDX(arr, i, char *));
-		dptr += strlen(APR_ARRAY_IDX(arr, i, char *));
-		*dptr++ = '\0';
+	apr_thread_mutex_lock(repo->snapshot_mutex);
+	if (repo->snapshot_queue_tail != NULL) {
+		repo->snapshot_queue_tail->next = msg;
+	} else {
+		repo->snapshot_queue = msg;
+	}
+	repo->snapshot_queue_tail = msg;
+	if (type == SNAPSHOT_WRITE) {
+		++repo->snapshot_pending;
 	}
+	apr_thread_cond_broadcast(repo->snapshot_cond);
+	apr_thread_mutex_unlock(repo->snapshot_mutex);
 	return 0;
+#else
+	(void)repo; /* Prevent compiler warnings */
+	(void)type;
+	(void)revision;
+	(void)data;
+	(void)len;
+	return -1;
+#endif
 }
 
 
-/* Applies a serialized tree delta to a tree */
-static int pr_delta_apply(cb_tree_t *tree, const char *data, int len, apr_pool_t *pool)
+/* Stores all snapshots that have been written by the snapshot thread,
+   optionally waiting for pending ones. If the thread lost track of the
+   history, the next snapshot will be written synchronously */
+static int pr_snapshot_collect(path_repo_t *repo, int wait, apr_pool_t *pool)
 {
-	const char *dptr = data;
-	while (dptr - data < len) {
-		if (*dptr == '+') {
-			cb_tree_insert(tree, dptr+1);
-		} else {
-			cb_tree_delete(tree, dptr+1);
+#if APR_HAS_THREADS
+	int ret = 0;
+
+	if (repo->snapshot_thread == NULL) {
+		return 0;
+	}
+
+	apr_thread_mutex_lock(repo->snapshot_mutex);
+	while (repo->snapshot_done != NULL || (wait && repo->snapshot_pending > 0)) {
+		pr_snapshot_msg_t *msg = repo->snapshot_done;
+		mdatum_t key, val;
+
+		if (msg == NULL) {
+			apr_thread_cond_wait(repo->snapshot_cond, repo->snapshot_mutex);
+			continue;
+		}
+		repo->snapshot_done = msg->next;
+		if (msg->type == SNAPSHOT_WRITE) {
+			--repo->snapshot_pending;
+		}
+		apr_thread_mutex_unlock(repo->snapshot_mutex);
+
+		if (msg->type != SNAPSHOT_WRITE) {
+			repo->snapshot_seeded = 0;
+		} else if (msg->data != NULL) {
+			key.dptr = apr_psprintf(pool, SNAPSHOT_KEY_FORMAT, msg->revision);
+			key.dsize = strlen(key.dptr);
+			val.dptr = msg->data;
+			val.dsize = msg->len;
+			stats_add(SC_PR_BYTES, val.dsize);
+			if (mukv_store(repo->db, key, val) != 0) {
+				fprintf(stderr, _("Error storing paths for revision %ld\n"), msg->revision);
+				ret = -1;
+			}
 		}
-		dptr += 2 + strlen(dptr+1);
+		free(msg->data);
+		free(msg);
+
+		apr_thread_mutex_lock(repo->snapshot_mutex);
 	}
+	apr_thread_mutex_unlock(repo->snapshot_mutex);
+	return ret;
+#else
+	(void)repo; /* Prevent compiler warnings */
+	(void)wait;
+	(void)pool;
 	return 0;
+#endif
 }
 
 
-/* Reconstructs a tree for the given revision */
-static int pr_reconstruct(path_repo_t *repo, cb_tree_t *tree, svn_revnum_t revision, apr_pool_t *pool)
+/* Stops the snapshot thread, discarding all unfinished snapshots */
+static void pr_snapshot_stop(path_repo_t *repo)
 {
-	mdatum_t key, val;
-	svn_revnum_t r;
-	char *dptr;
-	size_t dsize;
-#ifdef DEBUG
-	apr_time_t start = apr_time_now();
-#endif
+#if APR_HAS_THREADS
+	apr_status_t status;
+	pr_snapshot_msg_t *msg;
 
-	/* Start at position of last snapshot and apply deltas */
-	r = (revision & ~(SNAPSHOT_INTERVAL-1));
-	while (r <= revision) {
-		key.dptr = apr_itoa(pool, r);
-		key.dsize = strlen(key.dptr);
+	if (repo->snapshot_thread == NULL) {
+		return;
+	}
 
-		if (mukv_exists(repo->db, key)) {
-			val = mukv_fetch(repo->db, key, pool);
-			if (val.dptr == NULL) {
-				fprintf(stderr, _("Error fetching tree delta for revision %ld\n"), r);
-				return -1;
-			}
-#ifdef USE_SNAPPY
-			if (!snappy_uncompressed_length(val.dptr, val.dsize, &dsize)) {
-				return -1;
-			}
-			dptr = malloc(dsize);
-			if (snappy_uncompress(val.dptr, val.dsize, dptr) != 0) {
-				free(dptr);
-				return -1;
-			}
-#else
-			dptr = val.dptr;
-			dsize = val.dsize;
-#endif
-			if (pr_delta_apply(tree, dptr, dsize, pool) != 0) {
-				fprintf(stderr, _("Error applying tree delta for revision %ld\n"), r);
-				return -1;
-			}
+	apr_thread_mutex_lock(repo->snapshot_mutex);
+	repo->snapshot_stopping = 1;
+	apr_thread_cond_broadcast(repo->snapshot_cond);
+	apr_thread_mutex_unlock(repo->snapshot_mutex);
+	apr_thread_join(&status, repo->snapshot_thread);
 
+	while ((msg = repo->snapshot_queue) != NULL) {
+		repo->snapshot_queue = msg->next;
+		free(msg->data);
+		free(msg);
+	}
+	while ((msg = repo->snapshot_done) != NULL) {
+		repo->snapshot_done = msg->next;
+		free(msg->data);
+		free(msg);
+	}
 #ifdef USE_SNAPPY
-			free(dptr);
+	snappy_free_env(&repo->snapshot_snappy_env);
 #endif
-		}
-		++r;
-	}
-
-#ifdef DEBUG
-	repo->recon_time += (apr_time_now() - start);
+	svn_pool_destroy(repo->snapshot_pool);
+	repo->snapshot_pool = NULL;
+	repo->snapshot_thread = NULL;
+#else
+	(void)repo; /* Prevent compiler warnings */
 #endif
-	return 0;
 }
 
 
-/* Returns a tree for the given revision */
-static cb_tree_t *pr_tree(path_repo_t *repo, svn_revnum_t revision, apr_pool_t *pool)
+/* Returns the cache entry for the given revision */
+static pr_cache_entry_t *pr_cache_get(path_repo_t *repo, svn_revnum_t revision, apr_pool_t *pool)
 {
-	cb_tree_t *tree;
+	pr_cache_entry_t *entry;
 	int i;
 
+	/* Queries tend to hit the same revision repeatedly */
+	entry = &APR_ARRAY_IDX(repo->cache, repo->cache_last, pr_cache_entry_t);
+	if (entry->revision == revision) {
+		stats_add(SC_PR_CACHE_HITS, 1);
+		return entry;
+	}
+
 	/* Check if tree is cached */
 	for (i = 0; i < repo->cache->nelts; i++) {
-		if (APR_ARRAY_IDX(repo->cache, i, pr_cache_entry_t).revision == revision) {
-			tree = &APR_ARRAY_IDX(repo->cache, i, pr_cache_entry_t).tree;
-#ifdef DEBUG
-			repo->cache_hits++;
-#endif
-			break;
+		entry = &APR_ARRAY_IDX(repo->cache, i, pr_cache_entry_t);
+		if (entry->revision == revision) {
+			stats_add(SC_PR_CACHE_HITS, 1);
+			repo->cache_last = i;
+			return entry;
 		}
 	}
 
-	/* Reconstruct tree if needed */
-	if (i >= repo->cache->nelts) {
-#ifdef DEBUG
-		repo->cache_misses++;
-#endif
-		tree = &APR_ARRAY_IDX(repo->cache, repo->cache_index, pr_cache_entry_t).tree;
-		if (tree->root != NULL) {
-			cb_tree_clear(tree);
-		}
-		if (pr_reconstruct(repo, tree, revision, pool) != 0) {
-			return NULL;
-		}
+	/* Reconstruct tree */
+	stats_add(SC_PR_CACHE_MISSES, 1);
+	entry = &APR_ARRAY_IDX(repo->cache, repo->cache_index, pr_cache_entry_t);
+	entry->revision = -1;
+	if (entry->tree.root != NULL) {
+		cb_tree_clear(&entry->tree);
+	}
+	svn_pool_clear(entry->memo_pool);
+	entry->memo = apr_hash_make(entry->memo_pool);
+	if (pr_reconstruct(repo, &entry->tree, revision, pool) != 0) {
+		return NULL;
+	}
 
-		APR_ARRAY_IDX(repo->cache, repo->cache_index, pr_cache_entry_t).revision = revision;
-		if (++repo->cache_index >= repo->cache->nelts) {
-			repo->cache_index = 0;
-		}
+	entry->revision = revision;
+	repo->cache_last = repo->cache_index;
+	if (++repo->cache_index >= repo->cache->nelts) {
+		repo->cache_index = 0;
 	}
+	return entry;
+}
 
-	return tree;
+
+/* Returns a tree for the given revision */
+static cb_tree_t *pr_tree(path_repo_t *repo, svn_revnum_t revision, apr_pool_t *pool)
+{
+	pr_cache_entry_t *entry = pr_cache_get(repo, revision, pool);
+	return (entry != NULL ? &entry->tree : NULL);
 }
 
 
-/* Fetches paths from the repository and stores them into the given array */
-static int pr_fetch_paths_rec(apr_array_header_t *paths, const char *path, svn_revnum_t rev, session_t *session, apr_pool_t *pool)
+/* Tree walk callback for pr_query(), stopping at the first path */
+static int pr_query_any_cb(const char *elem, void *arg)
 {
-	svn_error_t *err;
-	apr_hash_t *dirents;
-	apr_hash_index_t *hi;
+	(void)elem; /* Prevent compiler warnings */
+	(void)arg;
+	return 1;
+}
 
-	if ((err = svn_ra_get_dir2(session->ra, &dirents, NULL, NULL, path, rev, SVN_DIRENT_KIND, pool))) {
-		utils_handle_error(err, stderr, FALSE, "ERROR: ");
-		svn_error_clear(err);
+/* Checks if a path exists at a given revision, memoizing the result */
+static signed char pr_query(path_repo_t *repo, const char *path, apr_size_t len, svn_revnum_t revision, apr_pool_t *pool)
+{
+	static const char results[] = { MEMO_MISSING, MEMO_EXISTS, MEMO_EMPTY };
+	pr_cache_entry_t *entry;
+	const char *memo;
+	apr_size_t i;
+
+	if (revision < 0) {
+		return 0;
+	}
+	if ((entry = pr_cache_get(repo, revision, pool)) == NULL) {
 		return -1;
 	}
 
-	for (hi = apr_hash_first(pool, dirents); hi; hi = apr_hash_next(hi)) {
-		const char *entry;
-		char *subpath;
-		svn_dirent_t *dirent;
-		apr_hash_this(hi, (const void **)&entry, NULL, (void **)&dirent);
+	if ((memo = apr_hash_get(entry->memo, path, len)) != NULL) {
+		stats_add(SC_PR_QUERY_HITS, 1);
+		return (*memo == MEMO_EXISTS);
+	}
 
-		/* Add the full path of the entry */
-		if (strlen(path) > 0) {
-			subpath = apr_psprintf(pool, "%s/%s", path, entry);
-		} else {
-			subpath = apr_pstrdup(pool, entry);
+	/* Nothing below an empty parent */
+	for (i = len; i > 0; i--) {
+		if (path[i-1] == '/' && (memo = apr_hash_get(entry->memo, path, i-1)) != NULL) {
+			if (*memo == MEMO_EMPTY) {
+				stats_add(SC_PR_QUERY_HITS, 1);
+				return 0;
+			}
+			break;
 		}
+	}
 
-		if (dirent->kind == svn_node_file) {
-			APR_ARRAY_PUSH(paths, char *) = subpath;
-		} else if (dirent->kind == svn_node_dir) {
-			APR_ARRAY_PUSH(paths, char *) = subpath;
-			pr_fetch_paths_rec(paths, subpath, rev, session, pool);
-		}
+	stats_add(SC_PR_QUERY_MISSES, 1);
+	path = apr_pstrndup(entry->memo_pool, path, len);
+	if (cb_tree_contains(&entry->tree, path)) {
+		memo = &results[MEMO_EXISTS];
+	} else if (cb_tree_walk_prefixed(&entry->tree, apr_pstrcat(pool, path, "/", NULL), pr_query_any_cb, NULL) == 0) {
+		memo = &results[MEMO_EMPTY];
+	} else {
+		memo = &results[MEMO_MISSING];
 	}
-	return 0;
+	apr_hash_set(entry->memo, path, len, memo);
+	return (*memo == MEMO_EXISTS);
+}
+
+
+/* Callback for paths listed by pr_fetch_paths() */
+typedef int (*pr_fetch_cb_t)(const char *path, void *baton, apr_pool_t *pool);
+
+/* Edit baton for pr_fetch_paths() */
+typedef struct {
+	session_t *session;
+	pr_fetch_cb_t callback;
+	void *baton;
+} pr_fetch_baton_t;
+
+/* Status editor callback for added nodes */
+static svn_error_t *pr_fetch_add_node(const char *path, void *parent_baton, const char *copyfrom_path, svn_revnum_t copyfrom_revision, apr_pool_t *pool, void **child_baton)
+{
+	pr_fetch_baton_t *fb = parent_baton;
+
+	/* Excluded paths and their children are skipped */
+	*child_baton = NULL;
+	if (fb == NULL || filter_excluded(fb->session->filter, path, pool)) {
+		return SVN_NO_ERROR;
+	}
+
+	if (fb->callback(session_obfuscate(fb->session, pool, path), fb->baton, pool) != 0) {
+		return svn_error_createf(1, NULL, _("Error adding path '%s'"), path);
+	}
+
+	*child_baton = parent_baton;
+	(void)copyfrom_path; /* Prevent compiler warnings */
+	(void)copyfrom_revision;
+	return SVN_NO_ERROR;
 }
 
-/* Fetches paths from the repository and stores them into the given array */
-static int pr_fetch_paths(apr_array_header_t *paths, const char *path, svn_revnum_t rev, session_t *session, apr_pool_t *pool)
+/* Lists a path and all of its children at the given revision. Instead of
+ * crawling the tree directory by directory, a single status report claiming
+ * that the path is missing is issued, so the server sends all nodes below it
+ * in one response. The callback is run for every node that is found. */
+static int pr_fetch_paths(const char *path, svn_revnum_t rev, session_t *session, pr_fetch_cb_t callback, void *cb_baton, apr_pool_t *pool)
 {
 	svn_error_t *err;
-	svn_dirent_t *dirent;
+	svn_delta_editor_t *editor;
+	const svn_ra_reporter2_t *reporter;
+	void *report_baton;
+	pr_fetch_baton_t fb;
+
+	fb.session = session;
+	fb.callback = callback;
+	fb.baton = cb_baton;
+
+	/* The default editor passes the parent batons through */
+	editor = svn_delta_default_editor(pool);
+	editor->add_directory = pr_fetch_add_node;
+	editor->add_file = pr_fetch_add_node;
 
-	/* Check node type */
-	if ((err = svn_ra_stat(session->ra, path, rev, &dirent, pool))) {
+	if ((err = svn_ra_do_status(session->ra, &reporter, &report_baton, "", rev, TRUE, editor, &fb, pool))) {
 		utils_handle_error(err, stderr, FALSE, "ERROR: ");
 		svn_error_clear(err);
 		return -1;
 	}
 
-	if (dirent == NULL) {
-		DEBUG_MSG("pr_fetch_paths(): Non-existent: %s@%ld\n", path, rev);
-		return 0;
+	if (strlen(path) == 0) {
+		/* Pretend that the root is empty */
+		err = reporter->set_path(report_baton, "", rev, TRUE, NULL, pool);
+	} else {
+		/* Pretend that only the requested path is missing */
+		err = reporter->set_path(report_baton, "", rev, FALSE, NULL, pool);
+		if (err == NULL) {
+			err = reporter->delete_path(report_baton, path, pool);
+		}
+	}
+	if (err == NULL) {
+		err = reporter->finish_report(report_baton, pool);
+	} else {
+		svn_error_clear(reporter->abort_report(report_baton, pool));
 	}
 
-	APR_ARRAY_PUSH(paths, char *) = apr_pstrdup(pool, path);
-	if (dirent->kind == svn_node_file) {
-		return 0;
+	if (err) {
+		utils_handle_error(err, stderr, FALSE, "ERROR: ");
+		svn_error_clear(err);
+		return -1;
 	}
-	return pr_fetch_paths_rec(paths, path, rev, session, pool);
+	return 0;
+}
+
+/* pr_fetch_paths() callback for path_repo_commit_log() */
+static int pr_fetch_paths_add_cb(const char *path, void *baton, apr_pool_t *pool)
+{
+	return path_repo_add((path_repo_t *)baton, path, pool);
 }
 
 
@@ -388,6 +1324,8 @@ path_repo_t *path_repo_create(const char *tmpdir, apr_pool_t *pool)
 
 	repo->tree = cb_tree_make();
 	repo->delta = apr_array_make(repo->pool, 1, sizeof(pr_delta_entry_t));
+	repo->locations = apr_array_make(repo->pool, 1024, sizeof(mlocation_t));
+	repo->query_buf = svn_stringbuf_create_ensure(256, repo->pool);
 	pr_cache_init(repo, CACHE_SIZE);
 
 	/* Open database */
@@ -405,6 +1343,7 @@ path_repo_t *path_repo_create(const char *tmpdir, apr_pool_t *pool)
 	}
 #endif
 
+	pr_snapshot_start(repo);
 	apr_pool_cleanup_register(repo->pool, repo, pr_cleanup, apr_pool_cleanup_null);
 	return repo;
 }
@@ -446,18 +1385,12 @@ int path_repo_delete(path_repo_t *repo, const char *path, apr_pool_t *pool)
 }
 
 
-/* Commits all scheduled actions, using the given revision number */
-int path_repo_commit(path_repo_t *repo, svn_revnum_t revision, apr_pool_t *pool)
+/* Stores the delta and snapshot records for a revision */
+static int pr_commit(path_repo_t *repo, svn_revnum_t revision, apr_pool_t *pool)
 {
-	mdatum_t key, val;
-	int i;
-	char *dptr = NULL;
-#ifdef USE_SNAPPY
-	size_t dsize;
-#endif
-#ifdef DEBUG
-	apr_time_t start = apr_time_now();
-#endif
+	char *data;
+	size_t len;
+	apr_time_t start = stats_timer_start();
 	int snapshot = (revision > 0 && (revision % SNAPSHOT_INTERVAL == 0));
 
 	/* Skip empty revisions if there's no snapshot pending */
@@ -466,49 +1399,41 @@ int path_repo_commit(path_repo_t *repo, svn_revnum_t revision, apr_pool_t *pool)
 		return 0;
 	}
 
-	/* Encode data if necessary */
-	if (!snapshot) {
-		val.dptr = apr_palloc(pool, repo->delta_len);
-		val.dsize = repo->delta_len;
-		dptr = val.dptr;
-
-		for (i = 0; i < repo->delta->nelts; i++) {
-			pr_delta_entry_t *e = &APR_ARRAY_IDX(repo->delta, i, pr_delta_entry_t);
-
-			*dptr++ = e->action;
-			strcpy(dptr, e->path);
-			dptr += strlen(e->path);
-			*dptr++ = '\0';
-		}
-	} else {
-		if (pr_encode(&repo->tree, &val.dptr, &val.dsize, pool) != 0) {
-			fprintf(stderr, _("Error encoding tree data for snapshot\n"));
+	/* Store delta */
+	if (repo->delta_len > 0) {
+		const char *key = apr_itoa(pool, revision);
+		pr_encode_delta(repo->delta, &data, &len, pool);
+		if (pr_store(repo, key, data, len, pool) != 0 || pr_set_location(repo, revision, key) != 0) {
+			fprintf(stderr, _("Error storing paths for revision %ld\n"), revision);
 			return -1;
 		}
+		if (repo->snapshot_seeded && pr_snapshot_async(repo)) {
+			if (pr_snapshot_post(repo, RECORD_DELTA, revision, data, len) != 0) {
+				repo->snapshot_seeded = 0;
+			}
+		}
 	}
 
-#ifdef DEBUG
-	repo->delta_bytes_raw += val.dsize;
-#endif
-
-#ifdef USE_SNAPPY
-	dptr = apr_palloc(pool, snappy_max_compressed_length(val.dsize));
-	if (snappy_compress(&repo->snappy_env, val.dptr, val.dsize, dptr, &dsize) != 0) {
-		fprintf(stderr, _("Error compressing tree data for revision %ld\n"), revision);
-		return -1;
+	/* Write snapshot in the background if possible. Otherwise, encode the
+	   current tree and use it to seed the snapshot thread */
+	if (snapshot) {
+		if (!repo->snapshot_seeded || !pr_snapshot_async(repo)
+		    || pr_snapshot_post(repo, SNAPSHOT_WRITE, revision, NULL, 0) != 0) {
+			if (pr_encode(&repo->tree, &data, &len, pool) != 0) {
+				fprintf(stderr, _("Error encoding tree data for snapshot\n"));
+				return -1;
+			}
+			if (pr_store(repo, apr_psprintf(pool, SNAPSHOT_KEY_FORMAT, revision), data, len, pool) != 0) {
+				fprintf(stderr, _("Error storing paths for revision %ld\n"), revision);
+				return -1;
+			}
+			if (pr_snapshot_async(repo)) {
+				repo->snapshot_seeded = (pr_snapshot_post(repo, RECORD_SNAPSHOT, revision, data, len) == 0);
+			}
+		}
 	}
-	val.dptr = dptr;
-	val.dsize = dsize;
-#endif
 
-#ifdef DEBUG
-	repo->delta_bytes += val.dsize;
-#endif
-
-	key.dptr = apr_itoa(pool, revision);
-	key.dsize = strlen(key.dptr);
-	if (mukv_store(repo->db, key, val) != 0) {
-		fprintf(stderr, _("Error storing paths for revision %ld\n"), revision);
+	if (pr_snapshot_collect(repo, 0, pool) != 0) {
 		return -1;
 	}
 
@@ -516,13 +1441,27 @@ int path_repo_commit(path_repo_t *repo, svn_revnum_t revision, apr_pool_t *pool)
 	repo->delta_len = 0;
 	apr_array_clear(repo->delta);
 	svn_pool_clear(repo->delta_pool);
-#ifdef DEBUG
-	repo->store_time += (apr_time_now() - start);
-#endif
+	stats_timer_stop(ST_PR_STORE, start);
 	return 0;
 }
 
 
+/* Commits all scheduled actions, using the given revision number */
+int path_repo_commit(path_repo_t *repo, svn_revnum_t revision, apr_pool_t *pool)
+{
+	int ret;
+
+	/* Write all records of this revision at once */
+	mukv_begin(repo->db);
+	ret = pr_commit(repo, revision, pool);
+	if (mukv_end(repo->db) != 0 && ret == 0) {
+		fprintf(stderr, _("Error storing paths for revision %ld\n"), revision);
+		ret = -1;
+	}
+	return ret;
+}
+
+
 /* Discards all scheduled actions */
 int path_repo_discard(path_repo_t *repo, apr_pool_t *pool)
 {
@@ -549,7 +1488,6 @@ int path_repo_commit_log(path_repo_t *repo, session_t *session, dump_options_t *
 	}
 
 	/* Sort changed paths */
-	/* TODO: More advanced sorting necessary? */
 	paths = apr_array_make(pool, apr_hash_count(log->changed_paths), sizeof(const char *));
 	for (hi = apr_hash_first(pool, log->changed_paths); hi; hi = apr_hash_next(hi)) {
 		const char *path;
@@ -583,16 +1521,12 @@ int path_repo_commit_log(path_repo_t *repo, session_t *session, dump_options_t *
 			apr_array_header_t *cpaths;
 			const char *copyfrom_path = delta_get_local_copyfrom_path(session->prefix, info->copyfrom_path);
 
-			if (copyfrom_path == NULL) {
-				cpaths = apr_array_make(pool, 1, sizeof(char *));
-				if (pr_fetch_paths(cpaths, path, log->revision, session, pool) != 0) {
+			if (copyfrom_path == NULL || filter_affects_copy(session->filter, copyfrom_path, path, pool)) {
+				/* The copy has been dumped as an addition of the actual tree */
+				if (pr_fetch_paths(path, log->revision, session, pr_fetch_paths_add_cb, repo, pool) != 0) {
 					fprintf(stderr, _("Error fetching tree for revision %ld\n"), log->revision);
 					return -1;
 				}
-
-				for (j = 0; j < cpaths->nelts; j++) {
-					path_repo_add(repo, APR_ARRAY_IDX(cpaths, j, char *), pool);
-				}
 			} else {
 				svn_revnum_t copyfrom_rev = delta_get_local_copyfrom_rev(info->copyfrom_rev, opts, logs, revision);
 				cb_tree_t *tree = pr_tree(repo, copyfrom_rev, pool);
@@ -627,44 +1561,170 @@ int path_repo_commit_log(path_repo_t *repo, session_t *session, dump_options_t *
 /* Checks if a path exists at a given revision */
 extern signed char path_repo_exists(path_repo_t *repo, const char *path, svn_revnum_t revision, apr_pool_t *pool)
 {
-	cb_tree_t *tree;
-	if (revision < 0) {
-		return 0;
+	return pr_query(repo, path, strlen(path), revision, pool);
+}
+
+
+/* Checks the parent relation of two paths at a given revision */
+signed char path_repo_check_parent(path_repo_t *repo, const char *parent, const char *child, svn_revnum_t revision, apr_pool_t *pool)
+{
+	/* Join the paths in a reusable buffer, as this is called a lot */
+	svn_stringbuf_set(repo->query_buf, parent);
+	svn_stringbuf_appendbytes(repo->query_buf, "/", 1);
+	svn_stringbuf_appendcstr(repo->query_buf, child);
+	return pr_query(repo, repo->query_buf->data, repo->query_buf->len, revision, pool);
+}
+
+
+/* Writes the committed history to a stream */
+int path_repo_save(path_repo_t *repo, FILE *out, apr_pool_t *pool)
+{
+	/* Scheduled actions are not part of the history yet */
+	if (repo->delta->nelts > 0) {
+		fprintf(stderr, _("Error saving paths: uncommitted changes present\n"));
+		return -1;
 	}
 
-	tree = pr_tree(repo, revision, pool);
-	if (tree == NULL) {
+	/* Include all snapshots that are being written */
+	if (pr_snapshot_collect(repo, 1, pool) != 0) {
 		return -1;
 	}
-	if (cb_tree_contains(tree, path)) {
-		return 1;
+
+	if (fwrite(&repo->head, sizeof(svn_revnum_t), 1, out) != 1) {
+		return -1;
 	}
-	return 0;
+	return mukv_save(repo->db, out, pool);
 }
 
 
-/* Checks the parent relation of two paths at a given revision */
-signed char path_repo_check_parent(path_repo_t *repo, const char *parent, const char *child, svn_revnum_t revision, apr_pool_t *pool)
+/* Restores a history that has been written by path_repo_save() */
+int path_repo_load(path_repo_t *repo, FILE *in, apr_pool_t *pool)
 {
-	char *path;
-	cb_tree_t *tree;
+	svn_revnum_t r;
+	int i;
 
-	if (revision < 0) {
-		return 0;
+	/* The snapshot thread needs to be seeded with the restored history */
+	if (pr_snapshot_collect(repo, 1, pool) != 0) {
+		return -1;
 	}
+	repo->snapshot_seeded = 0;
 
-	tree = pr_tree(repo, revision, pool);
-	if (tree == NULL) {
+	if (fread(&repo->head, sizeof(svn_revnum_t), 1, in) != 1) {
+		return -1;
+	}
+	if (mukv_load(repo->db, in, pool) != 0) {
 		return -1;
 	}
-	path = apr_psprintf(pool, "%s/%s", parent, child);
-	if (cb_tree_contains(tree, path)) {
+
+	/* Record offsets have changed */
+	apr_array_clear(repo->locations);
+	for (r = 0; r <= repo->head; r++) {
+		char key[32];
+		mdatum_t k;
+		sprintf(key, "%ld", r);
+		k.dptr = key;
+		k.dsize = strlen(key);
+		if (mukv_exists(repo->db, k) && pr_set_location(repo, r, key) != 0) {
+			return -1;
+		}
+	}
+
+	/* Invalidate the cache and rebuild the current tree */
+	for (i = 0; i < repo->cache->nelts; i++) {
+		APR_ARRAY_IDX(repo->cache, i, pr_cache_entry_t).revision = -1;
+	}
+	cb_tree_clear(&repo->tree);
+	return pr_reconstruct(repo, &repo->tree, repo->head, pool);
+}
+
+#ifdef DEBUG
+
+/* pr_fetch_paths() callback for path_repo_test() */
+static int pr_test_fetch_cb(const char *path, void *baton, apr_pool_t *pool)
+{
+	apr_array_header_t *paths = baton;
+	APR_ARRAY_PUSH(paths, char *) = apr_pstrdup(paths->pool, path);
+	(void)pool; /* Prevent compiler warnings */
+	return 0;
+}
+
+/* cb_tree_walk_prefixed() callback for pr_test_query() */
+static int pr_test_walk_cb(const char *elem, void *arg)
+{
+	APR_ARRAY_PUSH((apr_array_header_t *)arg, const char *) = elem;
+	return 0;
+}
+
+/* Checks whether two trees give the same answers for a query */
+static int pr_test_query(cb_tree_t *a, cb_tree_t *b, const char *query, apr_pool_t *pool)
+{
+	apr_array_header_t *ra = apr_array_make(pool, 0, sizeof(const char *));
+	apr_array_header_t *rb = apr_array_make(pool, 0, sizeof(const char *));
+	int i;
+
+	if (!cb_tree_contains(a, query) != !cb_tree_contains(b, query)) {
+		fprintf(stderr, "build: contains(%s) differs\n", query);
+		return 1;
+	}
+	if (cb_tree_walk_prefixed(a, query, pr_test_walk_cb, ra) != 0
+	    || cb_tree_walk_prefixed(b, query, pr_test_walk_cb, rb) != 0) {
+		fprintf(stderr, "build: error walking %s\n", query);
+		return 1;
+	}
+	if (ra->nelts != rb->nelts) {
+		fprintf(stderr, "build: walk(%s) gives %d != %d paths\n", query, ra->nelts, rb->nelts);
 		return 1;
 	}
+	for (i = 0; i < ra->nelts; i++) {
+		if (strcmp(APR_ARRAY_IDX(ra, i, const char *), APR_ARRAY_IDX(rb, i, const char *))) {
+			fprintf(stderr, "build: walk(%s) differs at %s\n", query, APR_ARRAY_IDX(ra, i, const char *));
+			return 1;
+		}
+	}
 	return 0;
 }
 
-#ifdef DEBUG
+/* Checks that a tree built from sorted paths answers queries for the
+   paths, their parents and their neighbors like a tree built by inserting
+   the paths one by one */
+static int pr_test_build(const char *const *paths, int n, apr_pool_t *pool)
+{
+	cb_tree_t built = cb_tree_make(), inserted = cb_tree_make();
+	apr_pool_t *subpool = svn_pool_create(pool);
+	int i, ret = 0;
+
+	for (i = 0; i < n && ret == 0; i++) {
+		if (cb_tree_insert(&inserted, paths[i]) == ENOMEM) {
+			ret = 1;
+		}
+	}
+	if (ret == 0 && cb_tree_build_sorted(&built, paths, n) != 0) {
+		fprintf(stderr, "build: error building tree from %d paths\n", n);
+		ret = 1;
+	}
+
+	if (ret == 0) {
+		ret = pr_test_query(&built, &inserted, "", subpool);
+	}
+	for (i = 0; i < n && ret == 0; i++) {
+		const char *path = paths[i], *sep;
+		size_t len = strlen(path);
+
+		ret = pr_test_query(&built, &inserted, path, subpool)
+		    || pr_test_query(&built, &inserted, apr_pstrcat(subpool, path, "/", NULL), subpool)
+		    || pr_test_query(&built, &inserted, apr_pstrcat(subpool, path, "0", NULL), subpool)
+		    || (len > 0 && pr_test_query(&built, &inserted, apr_pstrndup(subpool, path, len - 1), subpool));
+		for (sep = strchr(path, '/'); sep != NULL && ret == 0; sep = strchr(sep + 1, '/')) {
+			ret = pr_test_query(&built, &inserted, apr_pstrndup(subpool, path, sep - path), subpool);
+		}
+		svn_pool_clear(subpool);
+	}
+
+	cb_tree_clear(&built);
+	cb_tree_clear(&inserted);
+	svn_pool_destroy(subpool);
+	return ret;
+}
 
 /* Verifies a given revision */
 int path_repo_test(path_repo_t *repo, session_t *session, svn_revnum_t revision, svn_revnum_t svn_rev, apr_pool_t *pool)
@@ -683,13 +1743,13 @@ int path_repo_test(path_repo_t *repo, session_t *session, svn_revnum_t revision,
 
 	/* Retrieve actual tree -- assume the session is rooted at a directory */
 	paths_orig = apr_array_make(pool, 0, sizeof(char *));
-	pr_fetch_paths(paths_orig, "", svn_rev, session, pool);
+	pr_fetch_paths("", svn_rev, session, pr_test_fetch_cb, paths_orig, pool);
 	utils_sort(paths_orig);
 
-	/* Skip empty root element from original tree (HACK!) */
-	if (paths_orig->nelts > 0 && strlen(APR_ARRAY_IDX(paths_orig, 0, char *)) == 0) {
-		paths_orig->elts += sizeof(char *);
-		paths_orig->nelts--;
+	/* Snapshot records are applied by building trees from sorted paths */
+	if (pr_test_build((const char *const *)paths_orig->elts, paths_orig->nelts, pool) != 0) {
+		fprintf(stderr, "r%ld: tree built from sorted paths differs\n", revision);
+		ret = 1;
 	}
 
 	/* Compare trees */
@@ -724,6 +1784,16 @@ int path_repo_test_all(path_repo_t *repo, session_t *session, apr_pool_t *pool)
 	apr_pool_t *revpool = svn_pool_create(pool);
 	int ret = 0;
 
+	/* Duplicates and paths that are prefixes of others */
+	static const char *const build_paths[] = {
+		"a", "a", "a/b", "a/b", "a/b/c", "a/bc", "a0", "ab", "ab/c", "b"
+	};
+
+	if (pr_test_build(build_paths, sizeof(build_paths) / sizeof(build_paths[0]), pool) != 0) {
+		fprintf(stderr, "Tree built from sorted paths differs\n");
+		return 1;
+	}
+
 	L0("Checking path_repo until revision %ld...\n", repo->head);
 	while (ret == 0 && ++rev < repo->head) {
 		mdatum_t key;
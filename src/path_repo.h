@@ -25,6 +25,8 @@
 #define PATH_REPO_H_
 
 
+#include <stdio.h>
+
 #include <svn_pools.h>
 
 #include "dump.h"
@@ -59,6 +61,12 @@ extern signed char path_repo_exists(path_repo_t *repo, const char *path, svn_rev
 /* Checks the parent relation of two paths at a given revision */
 extern signed char path_repo_check_parent(path_repo_t *repo, const char *parent, const char *child, svn_revnum_t revision, apr_pool_t *pool);
 
+/* Writes the committed history to a stream */
+extern int path_repo_save(path_repo_t *repo, FILE *out, apr_pool_t *pool);
+
+/* Restores a history that has been written by path_repo_save() */
+extern int path_repo_load(path_repo_t *repo, FILE *in, apr_pool_t *pool);
+
 #ifdef DEBUG
 
 /* Testing */
@@ -0,0 +1,264 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-present Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ *      file: progress.c
+ *      desc: Periodic progress reports to a file descriptor
+ *
+ *      Reports are written by a separate thread at a fixed interval. The
+ *      dumping thread only publishes its position via a non-blocking
+ *      trylock, so a slow reader or a large temporary directory will
+ *      never stall the dump.
+ */
+
+
+#include <stdio.h>
+#ifdef WIN32
+ #include <io.h>
+#endif
+
+#include <svn_pools.h>
+
+#include <apr_file_io.h>
+#include <apr_portable.h>
+#include <apr_strings.h>
+#include <apr_time.h>
+#if APR_HAS_THREADS
+ #include <apr_thread_cond.h>
+ #include <apr_thread_mutex.h>
+ #include <apr_thread_proc.h>
+#endif
+
+#include "main.h"
+#include "logger.h"
+#include "stats.h"
+#include "utils.h"
+
+#include "progress.h"
+
+
+/* Interval between progress reports */
+#define PROGRESS_INTERVAL apr_time_from_sec(2)
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+typedef struct {
+	svn_revnum_t start;
+	svn_revnum_t end;
+	svn_revnum_t revision;
+	svn_revnum_t local_revision;
+	apr_uint64_t revisions;
+	apr_uint64_t bytes;      /* Copied from the statistics by the dumping thread */
+} progress_data_t;
+
+
+#if APR_HAS_THREADS
+
+static progress_data_t shared;   /* Protected by the mutex */
+static progress_data_t current;  /* Only accessed by the dumping thread */
+static char running = 0, stopping = 0;
+
+static apr_pool_t *thread_pool = NULL;
+static apr_thread_t *thread;
+static apr_thread_mutex_t *mutex;
+static apr_thread_cond_t *cond;
+static apr_file_t *out;
+static const char *temp_dir;
+static apr_time_t start_time;
+
+
+/*---------------------------------------------------------------------------*/
+/* Local functions                                                           */
+/*---------------------------------------------------------------------------*/
+
+
+/* Writes a single progress record */
+static void progress_report(progress_data_t *data, char final, apr_pool_t *pool)
+{
+	apr_time_t elapsed = apr_time_now() - start_time;
+	double secs = (double)elapsed / APR_USEC_PER_SEC;
+	apr_uint64_t bytes = data->bytes;
+	apr_off_t temp_bytes = 0;
+	apr_uint64_t temp_files = 0;
+	long int eta = -1;
+
+	utils_dir_usage(pool, temp_dir, &temp_bytes, &temp_files);
+
+	/* Revisions that don't touch the dumped path count as progress, too */
+	if (data->revision > data->start && data->end >= data->revision) {
+		eta = (long int)(secs * (data->end - data->revision) / (data->revision - data->start));
+	}
+
+	apr_file_printf(out, "%s revision=%ld local=%ld end=%ld revisions=%" APR_UINT64_T_FMT " elapsed=%ld rev_per_sec=%.2f bytes=%" APR_UINT64_T_FMT " bytes_per_sec=%.0f temp_bytes=%" APR_OFF_T_FMT " temp_files=%" APR_UINT64_T_FMT " eta=%ld\n",
+		(final ? "done" : "progress"), data->revision, data->local_revision, data->end, data->revisions, (long int)apr_time_sec(elapsed),
+		(secs > 0 ? data->revisions / secs : 0.0), bytes, (secs > 0 ? bytes / secs : 0.0), temp_bytes, temp_files, eta);
+}
+
+
+/* Thread function: reports progress until stopped */
+static void * APR_THREAD_FUNC progress_thread(apr_thread_t *thd, void *baton)
+{
+	apr_pool_t *iterpool = svn_pool_create(thread_pool);
+	progress_data_t data;
+
+	apr_thread_mutex_lock(mutex);
+	while (!stopping) {
+		apr_thread_cond_timedwait(cond, mutex, PROGRESS_INTERVAL);
+		if (stopping) {
+			break;
+		}
+		data = shared;
+
+		/* Don't hold the lock while writing */
+		apr_thread_mutex_unlock(mutex);
+		progress_report(&data, 0, iterpool);
+		svn_pool_clear(iterpool);
+		apr_thread_mutex_lock(mutex);
+	}
+	apr_thread_mutex_unlock(mutex);
+
+	svn_pool_destroy(iterpool);
+	apr_thread_exit(thd, APR_SUCCESS);
+	return NULL;
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Starts the reporting thread, writing to the given file descriptor */
+int progress_start(int fd, const char *dir)
+{
+#ifdef WIN32
+	apr_os_file_t osfd = (apr_os_file_t)_get_osfhandle(fd);
+#else
+	apr_os_file_t osfd = fd;
+#endif
+
+	if ((thread_pool = utils_thread_pool_create(&mutex, &cond, NULL)) == NULL) {
+		fprintf(stderr, _("ERROR: Unable to start progress reporting thread\n"));
+		return -1;
+	}
+	temp_dir = apr_pstrdup(thread_pool, dir);
+	if (apr_os_file_put(&out, &osfd, APR_WRITE, thread_pool) != APR_SUCCESS) {
+		fprintf(stderr, _("ERROR: Invalid progress file descriptor %d\n"), fd);
+		return -1;
+	}
+
+	current.start = current.end = -1;
+	current.revision = current.local_revision = -1;
+	current.revisions = 0;
+	current.bytes = 0;
+	shared = current;
+	start_time = apr_time_now();
+
+	if (apr_thread_create(&thread, NULL, progress_thread, NULL, thread_pool) != APR_SUCCESS) {
+		fprintf(stderr, _("ERROR: Unable to start progress reporting thread\n"));
+		return -1;
+	}
+	running = 1;
+	return 0;
+}
+
+
+/* Sets the range of original revisions that will be dumped */
+void progress_set_range(svn_revnum_t start, svn_revnum_t end)
+{
+	if (!running) {
+		return;
+	}
+
+	current.start = start;
+	current.end = end;
+	current.bytes = stats_get(SC_BYTES_RECEIVED);
+	apr_thread_mutex_lock(mutex);
+	shared = current;
+	apr_thread_mutex_unlock(mutex);
+}
+
+
+/* Notes that a revision has been dumped. This never blocks */
+void progress_update(svn_revnum_t revision, svn_revnum_t local_revision)
+{
+	if (!running) {
+		return;
+	}
+
+	current.revision = revision;
+	current.local_revision = local_revision;
+	++current.revisions;
+	current.bytes = stats_get(SC_BYTES_RECEIVED);
+
+	/* If the reporter is busy, it will get the next update */
+	if (apr_thread_mutex_trylock(mutex) == APR_SUCCESS) {
+		shared = current;
+		apr_thread_mutex_unlock(mutex);
+	}
+}
+
+
+/* Stops the reporting thread after writing a final report */
+void progress_stop()
+{
+	apr_status_t status;
+
+	if (!running) {
+		return;
+	}
+
+	apr_thread_mutex_lock(mutex);
+	stopping = 1;
+	apr_thread_cond_signal(cond);
+	apr_thread_mutex_unlock(mutex);
+	apr_thread_join(&status, thread);
+
+	current.bytes = stats_get(SC_BYTES_RECEIVED);
+	progress_report(&current, 1, thread_pool);
+	svn_pool_destroy(thread_pool);
+	thread_pool = NULL;
+	running = 0;
+}
+
+#else /* APR_HAS_THREADS */
+
+/* Starts the reporting thread, writing to the given file descriptor */
+int progress_start(int fd, const char *dir)
+{
+	fprintf(stderr, _("ERROR: Progress reports require thread support in APR\n"));
+	return -1;
+}
+
+void progress_set_range(svn_revnum_t start, svn_revnum_t end)
+{
+}
+
+void progress_update(svn_revnum_t revision, svn_revnum_t local_revision)
+{
+}
+
+void progress_stop()
+{
+}
+
+#endif /* APR_HAS_THREADS */
@@ -0,0 +1,45 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-present Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ *      file: progress.h
+ *      desc: Periodic progress reports to a file descriptor
+ */
+
+
+#ifndef PROGRESS_H_
+#define PROGRESS_H_
+
+
+#include <svn_types.h>
+
+
+/* Starts the reporting thread, writing to the given file descriptor */
+extern int progress_start(int fd, const char *temp_dir);
+
+/* Sets the range of original revisions that will be dumped */
+extern void progress_set_range(svn_revnum_t start, svn_revnum_t end);
+
+/* Notes that a revision has been dumped. This never blocks */
+extern void progress_update(svn_revnum_t revision, svn_revnum_t local_revision);
+
+/* Stops the reporting thread after writing a final report */
+extern void progress_stop();
+
+
+#endif
@@ -38,6 +38,8 @@
 
 #include "logger.h"
 #include "mukv.h"
+#include "stats.h"
+#include "utils.h"
 
 #ifdef USE_SNAPPY
 	#include "snappy-c/snappy.h"
@@ -62,6 +64,7 @@ typedef struct {
 typedef struct {
 	char *path;
 	prop_ref_t *ref;
+	svn_revnum_t rev;  /* Revision of the last change */
 } prop_entry_t;
 
 
@@ -70,17 +73,13 @@ struct property_storage_t {
 	apr_pool_t *pool;
 	apr_hash_t *refs;     /* Property IDs to reference */
 	apr_hash_t *entries;  /* Path to property ID pointer */
+	apr_hash_t *loaded;   /* Entries that have been loaded but not stored again */
 	mukv_t *db;           /* DBM: ID to property data */
 	apr_hash_t *gc;       /* Entries that reached zero reference count */
 
 #ifdef USE_SNAPPY
 	struct snappy_env snappy_env;
 #endif
-
-#ifdef DEBUG
-	size_t bytes;
-	size_t bytes_raw;
-#endif
 };
 
 
@@ -98,11 +97,6 @@ static apr_status_t prop_cleanup(void *param)
 	apr_ssize_t klen;
 	void *value;
 
-#ifdef DEBUG
-	L1("prop_store: stored data:        %d kB\n", store->bytes / 1024);
-	L1("prop_store: stored data (raw):  %d kB\n", store->bytes_raw / 1024);
-#endif
-
 	/* Manually delete hash data */
 	for (hi = apr_hash_first(store->pool, store->refs); hi; hi = apr_hash_next(hi)) {
 		apr_hash_this(hi, &key, &klen, &value);
@@ -113,6 +107,11 @@ static apr_status_t prop_cleanup(void *param)
 		free(((prop_entry_t *)value)->path);
 		free(value);
 	}
+	for (hi = apr_hash_first(store->pool, store->loaded); hi; hi = apr_hash_next(hi)) {
+		apr_hash_this(hi, &key, &klen, &value);
+		free(((prop_entry_t *)value)->path);
+		free(value);
+	}
 
 	mukv_close(store->db);
 
@@ -123,6 +122,18 @@ static apr_status_t prop_cleanup(void *param)
 }
 
 
+/* Dereferences a property reference */
+static void prop_unref(property_storage_t *store, prop_ref_t *ref)
+{
+	ref->count--;
+
+	/* Mark entries with zero reference count ready for cleanup */
+	if (ref->count <= 0) {
+		apr_hash_set(store->gc, ref, sizeof(prop_ref_t *), ref);
+	}
+}
+
+
 /* Serializes a hash to a simple string format */
 static int prop_hash_serialize(char **data, size_t *len, apr_hash_t *props, apr_pool_t *pool)
 {
@@ -255,6 +266,25 @@ void property_del_dump(const char *key)
 }
 
 
+/* Returns the serialized dump representation of a property hash */
+svn_stringbuf_t *property_block_create(apr_hash_t *props, apr_pool_t *pool)
+{
+	apr_hash_index_t *hi;
+	svn_stringbuf_t *block = svn_stringbuf_create("", pool);
+
+	for (hi = apr_hash_first(pool, props); hi; hi = apr_hash_next(hi)) {
+		const char *key;
+		svn_string_t *value;
+		apr_hash_this(hi, (const void **)&key, NULL, (void **)&value);
+
+		svn_stringbuf_appendcstr(block, apr_psprintf(pool, "K %lu\n%s\nV %lu\n", (unsigned long)strlen(key), key, (unsigned long)value->len));
+		svn_stringbuf_appendbytes(block, value->data, value->len);
+		svn_stringbuf_appendbytes(block, "\n", 1);
+	}
+	return block;
+}
+
+
 /* Initializes the property storage, binding it to the given pool */
 property_storage_t *property_storage_create(const char *tmpdir, apr_pool_t *pool)
 {
@@ -268,6 +298,7 @@ property_storage_t *property_storage_create(const char *tmpdir, apr_pool_t *pool
 
 	store->refs = apr_hash_make(store->pool);
 	store->entries = apr_hash_make(store->pool);
+	store->loaded = apr_hash_make(store->pool);
 	store->gc = apr_hash_make(store->pool);
 
 	/* Open database */
@@ -291,7 +322,7 @@ property_storage_t *property_storage_create(const char *tmpdir, apr_pool_t *pool
 
 
 /* Saves the properties of the given path and references them */
-int property_store(property_storage_t *store, const char *path, apr_hash_t *props, apr_pool_t *pool)
+int property_store(property_storage_t *store, const char *path, apr_hash_t *props, svn_revnum_t revision, apr_pool_t *pool)
 {
 	size_t len;
 	char *data;
@@ -299,12 +330,18 @@ int property_store(property_storage_t *store, const char *path, apr_hash_t *prop
 	prop_ref_t *ref;
 	prop_entry_t *entry;
 
-	entry = apr_hash_get(store->entries, path, APR_HASH_KEY_STRING);
+	/* Detach the previous entry, if any */
+	if ((entry = apr_hash_get(store->entries, path, APR_HASH_KEY_STRING)) != NULL) {
+		apr_hash_set(store->entries, path, APR_HASH_KEY_STRING, NULL);
+		prop_unref(store, entry->ref);
+	} else if ((entry = apr_hash_get(store->loaded, path, APR_HASH_KEY_STRING)) != NULL) {
+		apr_hash_set(store->loaded, path, APR_HASH_KEY_STRING, NULL);
+	}
 
 	/* No work for empty property hashes */
 	if (apr_hash_count(props) == 0) {
-		apr_hash_set(store->entries, path, APR_HASH_KEY_STRING, NULL);
 		if (entry) {
+			free(entry->path);
 			free(entry);
 		}
 		return 0;
@@ -345,20 +382,23 @@ int property_store(property_storage_t *store, const char *path, apr_hash_t *prop
 		value.dsize = len;
 #endif
 
-#ifdef DEBUG
-		store->bytes_raw += len;
-		store->bytes += value.dsize;
-#endif
+		stats_add(SC_PROP_BYTES_RAW, len);
+		stats_add(SC_PROP_BYTES, value.dsize);
+		stats_add(SC_PROP_MISSES, 1);
 
-		/* Add new ID -> data mapping to database */
+		/* Add new ID -> data mapping to database. New records are written
+		   in a single batch by property_storage_cleanup() */
 		key.dptr = (char *)id;
 		key.dsize = sizeof(id);
+		mukv_begin(store->db);
 		if (mukv_store(store->db, key, value) != 0) {
 			return -1;
 		}
+	} else {
+		stats_add(SC_PROP_HITS, 1);
 	}
 
-	/* Add entry */
+	/* Add entry, keeping track of the last change */
 	if (entry == NULL) {
 		entry = malloc(sizeof(prop_entry_t));
 		if (entry == NULL) {
@@ -367,6 +407,9 @@ int property_store(property_storage_t *store, const char *path, apr_hash_t *prop
 		if ((entry->path = strdup(path)) == NULL) {
 			return -1;
 		}
+		entry->rev = revision;
+	} else if (entry->ref != ref) {
+		entry->rev = revision;
 	}
 	entry->ref = ref;
 	ref->count++;
@@ -375,6 +418,23 @@ int property_store(property_storage_t *store, const char *path, apr_hash_t *prop
 }
 
 
+/* Returns the ID of the properties stored for the given path, or NULL */
+const unsigned char *property_id(property_storage_t *store, const char *path)
+{
+	prop_entry_t *entry = apr_hash_get(store->entries, path, APR_HASH_KEY_STRING);
+	return (entry != NULL ? entry->ref->id : NULL);
+}
+
+
+/* Returns the revision in which the properties of the given path have
+   been changed last, or -1 if the path has no properties */
+svn_revnum_t property_changed_rev(property_storage_t *store, const char *path)
+{
+	prop_entry_t *entry = apr_hash_get(store->entries, path, APR_HASH_KEY_STRING);
+	return (entry != NULL ? entry->rev : -1);
+}
+
+
 /* Loads the properties of the given path and dereferences them */
 int property_load(property_storage_t *store, const char *path, apr_hash_t *props, apr_pool_t *pool)
 {
@@ -414,17 +474,11 @@ int property_load(property_storage_t *store, const char *path, apr_hash_t *props
 		return -1;
 	}
 
-	/* Remove entry */
+	/* Remove entry. It's kept until the path is stored again in order
+	   to detect whether the properties have been changed */
 	apr_hash_set(store->entries, path, APR_HASH_KEY_STRING, NULL);
-	entry->ref->count--;
-
-	/* Mark entries with zero reference count ready for cleanup */
-	if (entry->ref->count <= 0) {
-		apr_hash_set(store->gc, entry->ref, sizeof(prop_ref_t *), entry->ref);
-	}
-
-	free(entry->path);
-	free(entry);
+	prop_unref(store, entry->ref);
+	apr_hash_set(store->loaded, entry->path, APR_HASH_KEY_STRING, entry);
 	return 0;
 }
 
@@ -441,12 +495,7 @@ int property_delete(property_storage_t *store, const char *path, apr_pool_t *poo
 
 	/* Remove entry */
 	apr_hash_set(store->entries, path, APR_HASH_KEY_STRING, NULL);
-	entry->ref->count--;
-
-	/* Mark entries with zero reference count ready for cleanup */
-	if (entry->ref->count <= 0) {
-		apr_hash_set(store->gc, entry->ref, sizeof(prop_ref_t *), entry->ref);
-	}
+	prop_unref(store, entry->ref);
 
 	free(entry->path);
 	free(entry);
@@ -454,7 +503,7 @@ int property_delete(property_storage_t *store, const char *path, apr_pool_t *poo
 }
 
 
-/* Removes properties from the storage that have zero reference count */
+/* Writes pending properties and removes those with zero reference count */
 int property_storage_cleanup(property_storage_t *store, apr_pool_t *pool)
 {
 	int n = 0;
@@ -462,6 +511,20 @@ int property_storage_cleanup(property_storage_t *store, apr_pool_t *pool)
 	prop_ref_t *ref;
 	prop_ref_t **tofree;
 
+	/* Write records stored during this revision */
+	if (mukv_end(store->db) != 0) {
+		return -1;
+	}
+
+	/* Loaded entries that haven't been stored again are stale now */
+	for (hi = apr_hash_first(pool, store->loaded); hi; hi = apr_hash_next(hi)) {
+		prop_entry_t *entry;
+		apr_hash_this(hi, NULL, NULL, (void **)&entry);
+		free(entry->path);
+		free(entry);
+	}
+	apr_hash_clear(store->loaded);
+
 	/* Any work to do? */
 	LDEBUG("property_storage_cleanup(): %d items in database, %d references\n", apr_hash_count(store->refs), apr_hash_count(store->entries));
 	if (apr_hash_count(store->gc) == 0) {
@@ -497,3 +560,98 @@ int property_storage_cleanup(property_storage_t *store, apr_pool_t *pool)
 	}
 	return 0;
 }
+
+
+/* Writes the contents of the storage to a stream */
+int property_storage_save(property_storage_t *store, FILE *out, apr_pool_t *pool)
+{
+	apr_hash_index_t *hi;
+	unsigned long n;
+
+	/* Make sure no unreferenced data is written */
+	if (property_storage_cleanup(store, pool) != 0) {
+		return -1;
+	}
+	if (mukv_save(store->db, out, pool) != 0) {
+		return -1;
+	}
+
+	n = apr_hash_count(store->entries);
+	if (fwrite(&n, sizeof(unsigned long), 1, out) != 1) {
+		return -1;
+	}
+	for (hi = apr_hash_first(pool, store->entries); hi; hi = apr_hash_next(hi)) {
+		prop_entry_t *entry;
+		apr_hash_this(hi, NULL, NULL, (void **)&entry);
+		if (utils_write_chunk(out, entry->path, strlen(entry->path)) != 0) {
+			return -1;
+		}
+		if (fwrite(entry->ref->id, 1, APR_MD5_DIGESTSIZE, out) != APR_MD5_DIGESTSIZE) {
+			return -1;
+		}
+		if (fwrite(&entry->rev, sizeof(svn_revnum_t), 1, out) != 1) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+/* Restores the contents of a storage written by property_storage_save() */
+int property_storage_load(property_storage_t *store, FILE *in, apr_pool_t *pool)
+{
+	apr_pool_t *subpool = svn_pool_create(pool);
+	unsigned long i, n;
+
+	if (mukv_load(store->db, in, pool) != 0) {
+		return -1;
+	}
+
+	if (fread(&n, sizeof(unsigned long), 1, in) != 1) {
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		unsigned char id[APR_MD5_DIGESTSIZE];
+		svn_revnum_t rev;
+		prop_entry_t *entry;
+		prop_ref_t *ref;
+		char *path;
+		size_t len;
+
+		if (utils_read_chunk(in, &path, &len, subpool) != 0) {
+			return -1;
+		}
+		if (fread(id, 1, APR_MD5_DIGESTSIZE, in) != APR_MD5_DIGESTSIZE) {
+			return -1;
+		}
+		if (fread(&rev, sizeof(svn_revnum_t), 1, in) != 1) {
+			return -1;
+		}
+
+		/* The reference counts are restored from the entries */
+		if ((ref = apr_hash_get(store->refs, id, sizeof(id))) == NULL) {
+			if ((ref = malloc(sizeof(prop_ref_t))) == NULL) {
+				return -1;
+			}
+			memcpy(ref->id, id, sizeof(id));
+			ref->count = 0;
+			apr_hash_set(store->refs, ref->id, sizeof(id), ref);
+		}
+
+		if ((entry = malloc(sizeof(prop_entry_t))) == NULL) {
+			return -1;
+		}
+		if ((entry->path = strdup(path)) == NULL) {
+			return -1;
+		}
+		entry->ref = ref;
+		entry->rev = rev;
+		ref->count++;
+		apr_hash_set(store->entries, entry->path, APR_HASH_KEY_STRING, entry);
+
+		svn_pool_clear(subpool);
+	}
+
+	svn_pool_destroy(subpool);
+	return 0;
+}
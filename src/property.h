@@ -26,6 +26,11 @@
 #define PROPERTY_H_
 
 
+#include <stdio.h>
+
+#include <svn_string.h>
+#include <svn_types.h>
+
 #include <apr_pools.h>
 #include <apr_hash.h>
 
@@ -42,6 +47,9 @@ extern void property_dump(const char *key, const char *value);
 /* Dumps a property deletion to stdout */
 extern void property_del_dump(const char *key);
 
+/* Returns the serialized dump representation of a property hash */
+extern svn_stringbuf_t *property_block_create(apr_hash_t *props, apr_pool_t *pool);
+
 
 /* Persistent property storage */
 typedef struct property_storage_t property_storage_t;
@@ -50,7 +58,14 @@ typedef struct property_storage_t property_storage_t;
 extern property_storage_t *property_storage_create(const char *tmpdir, apr_pool_t *pool);
 
 /* Saves the properties of the given path and references them */
-extern int property_store(property_storage_t *store, const char *path, apr_hash_t *props, apr_pool_t *pool);
+extern int property_store(property_storage_t *store, const char *path, apr_hash_t *props, svn_revnum_t revision, apr_pool_t *pool);
+
+/* Returns the ID of the properties stored for the given path, or NULL */
+extern const unsigned char *property_id(property_storage_t *store, const char *path);
+
+/* Returns the revision in which the properties of the given path have
+   been changed last, or -1 if the path has no properties */
+extern svn_revnum_t property_changed_rev(property_storage_t *store, const char *path);
 
 /* Loads the properties of the given path and dereferences them */
 extern int property_load(property_storage_t *store, const char *path, apr_hash_t *props, apr_pool_t *pool);
@@ -58,8 +73,14 @@ extern int property_load(property_storage_t *store, const char *path, apr_hash_t
 /* Removes the properties of the given path from the storage (thus dereferencing them) */
 extern int property_delete(property_storage_t *store, const char *path, apr_pool_t *pool);
 
-/* Removes properties from the storage that have zero reference count */
+/* Writes pending properties and removes those with zero reference count */
 extern int property_storage_cleanup(property_storage_t *store, apr_pool_t *pool);
 
+/* Writes the contents of the storage to a stream */
+extern int property_storage_save(property_storage_t *store, FILE *out, apr_pool_t *pool);
+
+/* Restores the contents of a storage written by property_storage_save() */
+extern int property_storage_load(property_storage_t *store, FILE *in, apr_pool_t *pool);
+
 
 #endif
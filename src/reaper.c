@@ -0,0 +1,254 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-present Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: reaper.c
+ *      desc: Deferred removal of temporary files
+ *
+ *      Local file copies that aren't needed anymore are removed by a
+ *      separate thread, so large deletions don't stall the delta editor.
+ *      Files are handed over in batches in order to keep locking rare.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <svn_pools.h>
+
+#include <apr_file_io.h>
+#if APR_HAS_THREADS
+ #include <apr_thread_cond.h>
+ #include <apr_thread_mutex.h>
+ #include <apr_thread_proc.h>
+#endif
+
+#include "main.h"
+#include "logger.h"
+#include "utils.h"
+
+#include "reaper.h"
+
+
+/* Number of files that are collected before waking up the reaper */
+#define REAPER_BATCH_SIZE 64
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+/* A list of malloc()'ed file names */
+typedef struct {
+	char **paths;
+	size_t num;
+	size_t size;
+} reaper_list_t;
+
+
+#if APR_HAS_THREADS
+
+static reaper_list_t batch;   /* Only accessed by the dumping thread */
+static reaper_list_t queue;   /* Protected by the mutex */
+static char running = 0, stopping = 0;
+
+static apr_pool_t *thread_pool = NULL;
+static apr_thread_t *thread;
+static apr_thread_mutex_t *mutex;
+static apr_thread_cond_t *cond;
+
+#endif
+
+
+/*---------------------------------------------------------------------------*/
+/* Local functions                                                           */
+/*---------------------------------------------------------------------------*/
+
+
+/* Removes a single file */
+static void reaper_remove(const char *path, apr_pool_t *pool)
+{
+	if (apr_file_remove(path, pool) != APR_SUCCESS) {
+		DEBUG_MSG("reaper: Cannot remove file %s\n", path);
+	}
+}
+
+
+#if APR_HAS_THREADS
+
+/* Appends a file name to a list, taking ownership of it */
+static void reaper_list_push(reaper_list_t *list, char *path)
+{
+	if (list->num == list->size) {
+		list->size = (list->size ? list->size * 2 : REAPER_BATCH_SIZE);
+		list->paths = realloc(list->paths, list->size * sizeof(char *));
+		if (list->paths == NULL) {
+			fprintf(stderr, "reaper: out of memory\n");
+			exit(1);
+		}
+	}
+	list->paths[list->num++] = path;
+}
+
+
+/* Removes all files of a list and empties it */
+static void reaper_list_remove(reaper_list_t *list, apr_pool_t *pool)
+{
+	size_t i;
+	for (i = 0; i < list->num; i++) {
+		reaper_remove(list->paths[i], pool);
+		free(list->paths[i]);
+		svn_pool_clear(pool);
+	}
+	list->num = 0;
+}
+
+
+/* Thread function: removes queued files until stopped */
+static void * APR_THREAD_FUNC reaper_thread(apr_thread_t *thd, void *baton)
+{
+	apr_pool_t *iterpool = svn_pool_create(thread_pool);
+	reaper_list_t work = { NULL, 0, 0 };
+
+	apr_thread_mutex_lock(mutex);
+	while (!stopping || queue.num > 0) {
+		reaper_list_t tmp;
+		if (queue.num == 0) {
+			apr_thread_cond_wait(cond, mutex);
+			continue;
+		}
+
+		/* Swap lists so the dumping thread can keep on queuing files */
+		tmp = queue;
+		queue = work;
+		work = tmp;
+
+		apr_thread_mutex_unlock(mutex);
+		reaper_list_remove(&work, iterpool);
+		apr_thread_mutex_lock(mutex);
+	}
+	apr_thread_mutex_unlock(mutex);
+
+	free(work.paths);
+	svn_pool_destroy(iterpool);
+	apr_thread_exit(thd, APR_SUCCESS);
+	return NULL;
+}
+
+#endif /* APR_HAS_THREADS */
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Starts the reaper thread. Without thread support, files are removed
+   immediately */
+void reaper_start()
+{
+#if APR_HAS_THREADS
+	stopping = 0;
+	if ((thread_pool = utils_thread_pool_create(&mutex, &cond, NULL)) == NULL
+	    || apr_thread_create(&thread, NULL, reaper_thread, NULL, thread_pool) != APR_SUCCESS) {
+		DEBUG_MSG("reaper: Unable to start thread, removing files immediately\n");
+		if (thread_pool != NULL) {
+			svn_pool_destroy(thread_pool);
+			thread_pool = NULL;
+		}
+		return;
+	}
+	running = 1;
+#endif
+}
+
+
+/* Queues a file for removal. The file must not be queued twice */
+void reaper_unlink(const char *path)
+{
+#if APR_HAS_THREADS
+	if (running) {
+		char *copy = malloc(strlen(path) + 1);
+		if (copy == NULL) {
+			fprintf(stderr, "reaper: out of memory\n");
+			exit(1);
+		}
+		strcpy(copy, path);
+		reaper_list_push(&batch, copy);
+		if (batch.num >= REAPER_BATCH_SIZE) {
+			reaper_flush();
+		}
+		return;
+	}
+#endif
+	{
+		apr_pool_t *pool = svn_pool_create(NULL);
+		reaper_remove(path, pool);
+		svn_pool_destroy(pool);
+	}
+}
+
+
+/* Hands all pending files over to the reaper thread */
+void reaper_flush()
+{
+#if APR_HAS_THREADS
+	size_t i;
+
+	if (!running || batch.num == 0) {
+		return;
+	}
+
+	apr_thread_mutex_lock(mutex);
+	for (i = 0; i < batch.num; i++) {
+		reaper_list_push(&queue, batch.paths[i]);
+	}
+	apr_thread_cond_signal(cond);
+	apr_thread_mutex_unlock(mutex);
+	batch.num = 0;
+#endif
+}
+
+
+/* Removes all remaining files and stops the reaper thread */
+void reaper_stop()
+{
+#if APR_HAS_THREADS
+	apr_status_t status;
+
+	if (!running) {
+		return;
+	}
+
+	reaper_flush();
+	apr_thread_mutex_lock(mutex);
+	stopping = 1;
+	apr_thread_cond_signal(cond);
+	apr_thread_mutex_unlock(mutex);
+	apr_thread_join(&status, thread);
+
+	free(batch.paths);
+	free(queue.paths);
+	memset(&batch, 0, sizeof(batch));
+	memset(&queue, 0, sizeof(queue));
+	svn_pool_destroy(thread_pool);
+	thread_pool = NULL;
+	running = 0;
+#endif
+}
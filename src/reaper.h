@@ -0,0 +1,42 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-present Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: reaper.h
+ *      desc: Deferred removal of temporary files
+ */
+
+
+#ifndef REAPER_H_
+#define REAPER_H_
+
+
+/* Starts the reaper thread. Without thread support, files are removed
+   immediately */
+extern void reaper_start();
+
+/* Queues a file for removal. The file must not be queued twice */
+extern void reaper_unlink(const char *path);
+
+/* Hands all pending files over to the reaper thread */
+extern void reaper_flush();
+
+/* Removes all remaining files and stops the reaper thread */
+extern void reaper_stop();
+
+
+#endif
@@ -185,7 +185,9 @@ void rhash_this(apr_hash_index_t *hi, const void **key, apr_ssize_t *klen, void
 {
 	entry_t *e;
 	apr_hash_this(hi, key, klen, (void **)&e);
-	val = &e->val;
+	if (val) {
+		*val = e->val;
+	}
 }
 
 
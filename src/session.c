@@ -29,11 +29,13 @@
 #include <svn_path.h>
 #include <svn_pools.h>
 #include <svn_ra.h>
+#include <svn_repos.h>
 #include <svn_utf.h>
 
 #include <time.h>
 
 #include "main.h"
+#include "stats.h"
 #include "utils.h"
 
 #include "session.h"
@@ -106,6 +108,8 @@ session_t session_create()
 	session_t session;
 
 	session.ra = NULL;
+	session.repos = NULL;
+	session.repos_path = NULL;
 	session.url = NULL;
 	session.encoded_url = NULL;
 	session.root = NULL;
@@ -122,6 +126,7 @@ session_t session_create()
 
 	session.obf_hash = apr_hash_make(session.pool);
 	session.obf_taken = apr_hash_make(session.pool);
+	session.filter = NULL;
 	srand(time(NULL));
 
 	return session;
@@ -199,6 +204,9 @@ char session_open(session_t *session)
 		return 1;
 	}
 	ctx->auth_baton = auth_baton;
+	if (stats_enabled) {
+		ctx->progress_func = stats_ra_progress;
+	}
 
 	/* Setup the RA session */
 	if ((err = svn_client_open_ra_session(&(session->ra), session->encoded_url, ctx, session->pool))) {
@@ -221,6 +229,31 @@ char session_open(session_t *session)
 	}
 	session->prefix = session_obfuscate(session, session->pool, session->prefix);
 
+	/* Open local repositories directly if requested */
+	if (session->flags & SF_NATIVE_FS) {
+		const char *path;
+		if (strncmp(root, "file://", 7)) {
+			fprintf(stderr, _("ERROR: --native-fs requires a file:// URL.\n"));
+			return 1;
+		}
+		path = svn_path_uri_decode(root + 7, session->pool);
+#ifdef WIN32
+		/* Strip the slash in front of drive letters */
+		if (path[0] == '/' && path[1] != '\0' && path[2] == ':') {
+			++path;
+		}
+#endif
+		if ((err = svn_repos_open(&session->repos, path, session->pool))) {
+			utils_handle_error(err, stderr, FALSE, "ERROR: ");
+			svn_error_clear(err);
+			return 1;
+		}
+		session->repos_path = svn_path_uri_decode(session->encoded_url + strlen(root), session->pool);
+		if (*session->repos_path == '\0') {
+			session->repos_path = "/";
+		}
+	}
+
 	return 0;
 }
 
@@ -35,12 +35,15 @@ enum session_flags {
 	SF_NO_CHECK_CERTIFICATE = 0x01,
 	SF_NON_INTERACTIVE = 0x02,
 	SF_NO_AUTH_CACHE = 0x04,
-	SF_OBFUSCATE = 0x08
+	SF_OBFUSCATE = 0x08,
+	SF_NATIVE_FS = 0x10
 };
 
 /* Session data */
 typedef struct {
 	struct svn_ra_session_t *ra;
+	struct svn_repos_t *repos;  /* Only set for local repositories with SF_NATIVE_FS */
+	const char *repos_path;     /* Session root inside the repository */
 	struct apr_pool_t *pool;
 	char *url;
 	const char *encoded_url;
@@ -56,6 +59,7 @@ typedef struct {
 
 	struct apr_hash_t *obf_hash;
 	struct apr_hash_t *obf_taken;
+	struct filter_t *filter;    /* Include/exclude patterns, if any */
 } session_t;
 
 
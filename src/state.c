@@ -0,0 +1,276 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-present Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ *      file: state.c
+ *      desc: Persistent state for incremental dumps
+ *
+ *      A state directory contains the path repository, the property storage
+ *      and the local file copies of the last dumped revision, together with
+ *      a small text manifest. The manifest is written last, so a directory
+ *      without one is never loaded.
+ */
+
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <svn_pools.h>
+
+#include <apr_file_io.h>
+#include <apr_strings.h>
+
+#include "main.h"
+#include "delta.h"
+#include "filter.h"
+#include "logger.h"
+#include "utils.h"
+
+#include "state.h"
+
+
+#define STATE_MAGIC "rsvndump-state"
+#define STATE_VERSION 5
+
+
+/*---------------------------------------------------------------------------*/
+/* Static functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Opens a file in the state directory */
+static FILE *state_fopen(const char *dir, const char *name, const char *mode, apr_pool_t *pool)
+{
+	const char *path = apr_psprintf(pool, "%s/%s", dir, name);
+	FILE *f = fopen(path, mode);
+
+	if (f == NULL) {
+		fprintf(stderr, _("ERROR: Unable to open %s (%s)\n"), path, strerror(errno));
+	}
+	return f;
+}
+
+
+/* Reads a "key: value" line from the manifest */
+static int state_read_value(FILE *f, const char *key, char *buf, size_t len)
+{
+	size_t klen = strlen(key);
+	char *eol;
+
+	if (fgets(buf, len, f) == NULL || strncmp(buf, key, klen) || strncmp(buf + klen, ": ", 2)) {
+		return -1;
+	}
+	if ((eol = strchr(buf, '\n')) == NULL) {
+		return -1;
+	}
+	*eol = '\0';
+	memmove(buf, buf + klen + 2, strlen(buf + klen + 2) + 1);
+	return 0;
+}
+
+
+/* Reads a numeric "key: value" line from the manifest */
+static int state_read_number(FILE *f, const char *key, long *num)
+{
+	char buf[64], eos;
+
+	if (state_read_value(f, key, buf, sizeof(buf)) || sscanf(buf, "%ld%c", num, &eos) != 1) {
+		return -1;
+	}
+	return 0;
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Reads the manifest of a saved state and adjusts the start revision */
+int state_check(const char *dir, session_t *session, dump_options_t *opts, svn_revnum_t *revision, svn_revnum_t *local_revision, apr_pool_t *pool)
+{
+	FILE *f;
+	char url[4096], filter[4096];
+	long version, keep_revnums, dry_run;
+
+	if (!(opts->flags & DF_INCREMENTAL)) {
+		fprintf(stderr, _("ERROR: Loading a saved state requires --incremental.\n"));
+		return -1;
+	}
+
+	if ((f = state_fopen(dir, "state", "r", pool)) == NULL) {
+		return -1;
+	}
+	if (state_read_number(f, STATE_MAGIC, &version)
+	    || version != STATE_VERSION
+	    || state_read_value(f, "url", url, sizeof(url))
+	    || state_read_number(f, "revision", revision)
+	    || state_read_number(f, "local-revision", local_revision)
+	    || state_read_number(f, "keep-revnums", &keep_revnums)
+	    || state_read_number(f, "dry-run", &dry_run)
+	    || state_read_value(f, "filter", filter, sizeof(filter))) {
+		fprintf(stderr, _("ERROR: %s does not contain a valid saved state.\n"), dir);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	/* The state must have been created by a compatible run */
+	if (strcmp(url, session->encoded_url)) {
+		fprintf(stderr, _("ERROR: The saved state belongs to a different URL (%s).\n"), url);
+		return -1;
+	}
+	if (keep_revnums != ((opts->flags & DF_KEEP_REVNUMS) != 0) || dry_run != ((opts->flags & DF_DRY_RUN) != 0)) {
+		fprintf(stderr, _("ERROR: The saved state has been created with different --keep-revnums or --dry-run options.\n"));
+		return -1;
+	}
+	if (strcmp(filter, filter_describe(session->filter, pool))) {
+		fprintf(stderr, _("ERROR: The saved state has been created with different --include or --exclude options.\n"));
+		return -1;
+	}
+
+	/* Continue right after the saved revision by default */
+	if (opts->start == 0) {
+		opts->start = *revision + 1;
+	} else if (opts->start <= *revision) {
+		fprintf(stderr, _("ERROR: The saved state already covers revision %ld.\n"), opts->start);
+		return -1;
+	}
+
+	DEBUG_MSG("state_check(%s): revision = %ld, local = %ld, start = %ld\n", dir, *revision, *local_revision, opts->start);
+	return 0;
+}
+
+
+/* Restores the path repository, property storage and local file copies */
+int state_load(const char *dir, dump_options_t *opts, path_repo_t *path_repo, property_storage_t *prop_store, apr_pool_t *pool)
+{
+	FILE *f;
+	int ret;
+
+	if ((f = state_fopen(dir, "paths", "rb", pool)) == NULL) {
+		return -1;
+	}
+	ret = path_repo_load(path_repo, f, pool);
+	fclose(f);
+	if (ret != 0) {
+		fprintf(stderr, _("ERROR: Unable to load the path repository from %s\n"), dir);
+		return -1;
+	}
+
+	if ((f = state_fopen(dir, "props", "rb", pool)) == NULL) {
+		return -1;
+	}
+	ret = property_storage_load(prop_store, f, pool);
+	fclose(f);
+	if (ret != 0) {
+		fprintf(stderr, _("ERROR: Unable to load the property storage from %s\n"), dir);
+		return -1;
+	}
+
+	if ((f = state_fopen(dir, "texts", "rb", pool)) == NULL) {
+		return -1;
+	}
+	ret = delta_load_state(f, dir, opts, pool);
+	fclose(f);
+	if (ret != 0) {
+		fprintf(stderr, _("ERROR: Unable to load the local file copies from %s\n"), dir);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* Saves the current state, replacing a previously saved state in dir */
+int state_save(const char *dir, session_t *session, dump_options_t *opts, path_repo_t *path_repo, property_storage_t *prop_store, svn_revnum_t revision, svn_revnum_t local_revision, apr_pool_t *pool)
+{
+	apr_pool_t *subpool = svn_pool_create(pool);
+	const char *tmp = apr_psprintf(subpool, "%s.new", dir);
+	const char *old = apr_psprintf(subpool, "%s.old", dir);
+	apr_finfo_t finfo;
+	FILE *f;
+	int err, ret = -1;
+
+	/* Write the new state next to the old one first */
+	utils_rrmdir(subpool, tmp, 1);
+	if (apr_dir_make_recursive(tmp, APR_OS_DEFAULT, subpool) != APR_SUCCESS) {
+		fprintf(stderr, _("ERROR: Unable to create directory %s\n"), tmp);
+		goto finish;
+	}
+
+	if ((f = state_fopen(tmp, "paths", "wb", subpool)) == NULL) {
+		goto finish;
+	}
+	err = path_repo_save(path_repo, f, subpool);
+	if (fclose(f) != 0 || err != 0) {
+		fprintf(stderr, _("ERROR: Unable to save the path repository to %s\n"), tmp);
+		goto finish;
+	}
+
+	if ((f = state_fopen(tmp, "props", "wb", subpool)) == NULL) {
+		goto finish;
+	}
+	err = property_storage_save(prop_store, f, subpool);
+	if (fclose(f) != 0 || err != 0) {
+		fprintf(stderr, _("ERROR: Unable to save the property storage to %s\n"), tmp);
+		goto finish;
+	}
+
+	if ((f = state_fopen(tmp, "texts", "wb", subpool)) == NULL) {
+		goto finish;
+	}
+	err = delta_save_state(f, tmp, subpool);
+	if (fclose(f) != 0 || err != 0) {
+		fprintf(stderr, _("ERROR: Unable to save the local file copies to %s\n"), tmp);
+		goto finish;
+	}
+
+	/* The manifest marks the state as complete */
+	if ((f = state_fopen(tmp, "state", "w", subpool)) == NULL) {
+		goto finish;
+	}
+	fprintf(f, "%s: %d\n", STATE_MAGIC, STATE_VERSION);
+	fprintf(f, "url: %s\n", session->encoded_url);
+	fprintf(f, "revision: %ld\n", revision);
+	fprintf(f, "local-revision: %ld\n", local_revision);
+	fprintf(f, "keep-revnums: %d\n", ((opts->flags & DF_KEEP_REVNUMS) != 0));
+	fprintf(f, "dry-run: %d\n", ((opts->flags & DF_DRY_RUN) != 0));
+	fprintf(f, "filter: %s\n", filter_describe(session->filter, subpool));
+	if (fclose(f) != 0) {
+		fprintf(stderr, _("ERROR: Unable to write the state manifest to %s\n"), tmp);
+		goto finish;
+	}
+
+	/* Replace the previous state */
+	utils_rrmdir(subpool, old, 1);
+	if (apr_stat(&finfo, dir, APR_FINFO_TYPE, subpool) == APR_SUCCESS && apr_file_rename(dir, old, subpool) != APR_SUCCESS) {
+		fprintf(stderr, _("ERROR: Unable to rename %s to %s\n"), dir, old);
+		goto finish;
+	}
+	if (apr_file_rename(tmp, dir, subpool) != APR_SUCCESS) {
+		fprintf(stderr, _("ERROR: Unable to rename %s to %s\n"), tmp, dir);
+		goto finish;
+	}
+	utils_rrmdir(subpool, old, 1);
+	ret = 0;
+
+finish:
+	svn_pool_destroy(subpool);
+	return ret;
+}
@@ -0,0 +1,48 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-present Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: state.h
+ *      desc: Persistent state for incremental dumps
+ */
+
+
+#ifndef STATE_H_
+#define STATE_H_
+
+
+#include <svn_types.h>
+
+#include <apr_pools.h>
+
+#include "dump.h"
+#include "path_repo.h"
+#include "property.h"
+#include "session.h"
+
+
+/* Reads the manifest of a saved state and adjusts the start revision */
+extern int state_check(const char *dir, session_t *session, dump_options_t *opts, svn_revnum_t *revision, svn_revnum_t *local_revision, apr_pool_t *pool);
+
+/* Restores the path repository, property storage and local file copies */
+extern int state_load(const char *dir, dump_options_t *opts, path_repo_t *path_repo, property_storage_t *prop_store, apr_pool_t *pool);
+
+/* Saves the current state, replacing a previously saved state in dir */
+extern int state_save(const char *dir, session_t *session, dump_options_t *opts, path_repo_t *path_repo, property_storage_t *prop_store, svn_revnum_t revision, svn_revnum_t local_revision, apr_pool_t *pool);
+
+
+#endif
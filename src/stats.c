@@ -0,0 +1,482 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-present Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ *      file: stats.c
+ *      desc: Performance counters and timers
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <svn_delta.h>
+
+#include <apr_time.h>
+
+#include "main.h"
+#include "logger.h"
+
+#include "stats.h"
+
+
+/* Interval between JSON snapshots */
+#define SNAPSHOT_INTERVAL apr_time_from_sec(10)
+
+/* Number of revision latency histogram buckets (log2 of milliseconds) */
+#define HISTOGRAM_SIZE 20
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+/* Baton for the wrapping editor, used for all nodes */
+typedef struct {
+	const svn_delta_editor_t *editor;
+	void *baton;
+} se_baton_t;
+
+/* Baton for the wrapping window handler */
+typedef struct {
+	svn_txdelta_window_handler_t handler;
+	void *baton;
+} se_window_baton_t;
+
+
+/* Global variable: non-zero if statistics should be gathered */
+int stats_enabled = 0;
+
+static const char *counter_names[SC_NUM_COUNTERS] = {
+	"bytes_received",
+	"delta_bytes",
+	"text_bytes",
+	"editor_calls",
+	"revisions",
+	"path_repo_bytes_raw",
+	"path_repo_bytes",
+	"path_repo_cache_hits",
+	"path_repo_cache_misses",
+	"path_repo_query_hits",
+	"path_repo_query_misses",
+	"prop_bytes_raw",
+	"prop_bytes",
+	"prop_hits",
+	"prop_misses",
+	"text_memory",
+	"text_disk",
+	"text_evicted",
+	"text_shared"
+};
+
+static const char *timer_names[ST_NUM_TIMERS] = {
+	"diff",
+	"editor",
+	"temp_io",
+	"path_repo_reconstruct",
+	"path_repo_store"
+};
+
+static apr_uint64_t counters[SC_NUM_COUNTERS];
+static apr_time_t timers[ST_NUM_TIMERS];
+static apr_uint64_t histogram[HISTOGRAM_SIZE];
+static svn_revnum_t last_revision = -1;
+static apr_off_t last_progress = 0;
+static apr_time_t start_time, last_snapshot;
+static char print_summary = 0;
+static FILE *json_file = NULL;
+
+
+/*---------------------------------------------------------------------------*/
+/* Local functions                                                           */
+/*---------------------------------------------------------------------------*/
+
+
+/* Returns the ratio of two counters, or 0 if the divisor is zero */
+static double stats_ratio(apr_uint64_t a, apr_uint64_t b)
+{
+	return (b ? (double)a / b : 0.0);
+}
+
+
+/* Writes a JSON snapshot of all counters and timers */
+static void stats_snapshot(char final)
+{
+	apr_time_t now = apr_time_now();
+	int i;
+
+	fprintf(json_file, "{\"time\": %ld, \"elapsed_ms\": %ld, \"final\": %s, \"revision\": %ld, \"counters\": {", (long int)apr_time_sec(now), (long int)apr_time_as_msec(now - start_time), (final ? "true" : "false"), last_revision);
+	for (i = 0; i < SC_NUM_COUNTERS; i++) {
+		fprintf(json_file, "%s\"%s\": %"APR_UINT64_T_FMT, (i ? ", " : ""), counter_names[i], counters[i]);
+	}
+	fprintf(json_file, "}, \"timers_ms\": {");
+	for (i = 0; i < ST_NUM_TIMERS; i++) {
+		fprintf(json_file, "%s\"%s\": %ld", (i ? ", " : ""), timer_names[i], (long int)apr_time_as_msec(timers[i]));
+	}
+	fprintf(json_file, "}, \"revision_ms_log2\": [");
+	for (i = 0; i < HISTOGRAM_SIZE; i++) {
+		fprintf(json_file, "%s%"APR_UINT64_T_FMT, (i ? ", " : ""), histogram[i]);
+	}
+	fprintf(json_file, "]}\n");
+	fflush(json_file);
+
+	last_snapshot = now;
+}
+
+
+/* Writes a snapshot if the interval has elapsed. This is also checked
+   during revisions, as a single one may take hours */
+static void stats_snapshot_check(apr_time_t now)
+{
+	if (json_file != NULL && (now - last_snapshot) >= SNAPSHOT_INTERVAL) {
+		stats_snapshot(0);
+	}
+}
+
+
+/* Prints a human-readable summary to stderr */
+static void stats_summary()
+{
+	apr_time_t elapsed = apr_time_now() - start_time;
+	apr_time_t network = timers[ST_DIFF] - timers[ST_EDITOR];
+	int i;
+
+	fprintf(stderr, _("Statistics:\n"));
+	fprintf(stderr, _("  revisions dumped:          %"APR_UINT64_T_FMT"\n"), counters[SC_REVISIONS]);
+	fprintf(stderr, _("  total time:                %ld ms\n"), (long int)apr_time_as_msec(elapsed));
+	fprintf(stderr, _("  network wait time:         %ld ms\n"), (long int)apr_time_as_msec(network > 0 ? network : 0));
+	fprintf(stderr, _("  editor time:               %ld ms (%"APR_UINT64_T_FMT" calls)\n"), (long int)apr_time_as_msec(timers[ST_EDITOR]), counters[SC_EDITOR_CALLS]);
+	fprintf(stderr, _("  temporary file I/O time:   %ld ms\n"), (long int)apr_time_as_msec(timers[ST_TEMP_IO]));
+	fprintf(stderr, _("  bytes received:            %"APR_UINT64_T_FMT"\n"), counters[SC_BYTES_RECEIVED]);
+	fprintf(stderr, _("  text delta data:           %"APR_UINT64_T_FMT" bytes (%"APR_UINT64_T_FMT" bytes of text)\n"), counters[SC_DELTA_BYTES], counters[SC_TEXT_BYTES]);
+	fprintf(stderr, _("  path repository:           %"APR_UINT64_T_FMT" kB (ratio %.2f), %ld ms store, %ld ms reconstruct\n"), counters[SC_PR_BYTES] / 1024, stats_ratio(counters[SC_PR_BYTES_RAW], counters[SC_PR_BYTES]), (long int)apr_time_as_msec(timers[ST_PR_STORE]), (long int)apr_time_as_msec(timers[ST_PR_RECONSTRUCT]));
+	fprintf(stderr, _("  path repository cache:     %.2f%% hits (%"APR_UINT64_T_FMT" of %"APR_UINT64_T_FMT")\n"), 100.0 * stats_ratio(counters[SC_PR_CACHE_HITS], counters[SC_PR_CACHE_HITS] + counters[SC_PR_CACHE_MISSES]), counters[SC_PR_CACHE_HITS], counters[SC_PR_CACHE_HITS] + counters[SC_PR_CACHE_MISSES]);
+	fprintf(stderr, _("  path repository queries:   %.2f%% memoized (%"APR_UINT64_T_FMT" of %"APR_UINT64_T_FMT")\n"), 100.0 * stats_ratio(counters[SC_PR_QUERY_HITS], counters[SC_PR_QUERY_HITS] + counters[SC_PR_QUERY_MISSES]), counters[SC_PR_QUERY_HITS], counters[SC_PR_QUERY_HITS] + counters[SC_PR_QUERY_MISSES]);
+	fprintf(stderr, _("  property storage:          %"APR_UINT64_T_FMT" kB (ratio %.2f)\n"), counters[SC_PROP_BYTES] / 1024, stats_ratio(counters[SC_PROP_BYTES_RAW], counters[SC_PROP_BYTES]));
+	fprintf(stderr, _("  shared property sets:      %.2f%% (%"APR_UINT64_T_FMT" of %"APR_UINT64_T_FMT")\n"), 100.0 * stats_ratio(counters[SC_PROP_HITS], counters[SC_PROP_HITS] + counters[SC_PROP_MISSES]), counters[SC_PROP_HITS], counters[SC_PROP_HITS] + counters[SC_PROP_MISSES]);
+	fprintf(stderr, _("  local copies:              %"APR_UINT64_T_FMT" in memory, %"APR_UINT64_T_FMT" on disk (%"APR_UINT64_T_FMT" evicted), %"APR_UINT64_T_FMT" shared\n"), counters[SC_TEXT_MEMORY], counters[SC_TEXT_DISK], counters[SC_TEXT_EVICTED], counters[SC_TEXT_SHARED]);
+
+	fprintf(stderr, _("  revision latency:\n"));
+	for (i = 0; i < HISTOGRAM_SIZE; i++) {
+		if (histogram[i] == 0) {
+			continue;
+		}
+		if (i < HISTOGRAM_SIZE-1) {
+			fprintf(stderr, "    < %7ld ms: %"APR_UINT64_T_FMT"\n", 1L << i, histogram[i]);
+		} else {
+			fprintf(stderr, "   >= %7ld ms: %"APR_UINT64_T_FMT"\n", 1L << (i-1), histogram[i]);
+		}
+	}
+}
+
+
+/* Measures the time spent in an editor callback */
+#define SE_CALL(call) \
+	do { \
+		apr_time_t start_ = apr_time_now(), end_; \
+		svn_error_t *err_ = (call); \
+		end_ = apr_time_now(); \
+		timers[ST_EDITOR] += (end_ - start_); \
+		++counters[SC_EDITOR_CALLS]; \
+		stats_snapshot_check(end_); \
+		return err_; \
+	} while (0)
+
+
+/* Creates a baton for a node */
+static se_baton_t *se_make_baton(const svn_delta_editor_t *editor, apr_pool_t *pool)
+{
+	se_baton_t *baton = apr_palloc(pool, sizeof(se_baton_t));
+	baton->editor = editor;
+	baton->baton = NULL;
+	return baton;
+}
+
+
+/* Wrapping delta editor callbacks */
+static svn_error_t *se_set_target_revision(void *edit_baton, svn_revnum_t target_revision, apr_pool_t *pool)
+{
+	se_baton_t *eb = edit_baton;
+	SE_CALL(eb->editor->set_target_revision(eb->baton, target_revision, pool));
+}
+
+static svn_error_t *se_open_root(void *edit_baton, svn_revnum_t base_revision, apr_pool_t *dir_pool, void **root_baton)
+{
+	se_baton_t *eb = edit_baton, *b = se_make_baton(eb->editor, dir_pool);
+	*root_baton = b;
+	SE_CALL(eb->editor->open_root(eb->baton, base_revision, dir_pool, &b->baton));
+}
+
+static svn_error_t *se_delete_entry(const char *path, svn_revnum_t revision, void *parent_baton, apr_pool_t *pool)
+{
+	se_baton_t *pb = parent_baton;
+	SE_CALL(pb->editor->delete_entry(path, revision, pb->baton, pool));
+}
+
+static svn_error_t *se_add_directory(const char *path, void *parent_baton, const char *copyfrom_path, svn_revnum_t copyfrom_revision, apr_pool_t *dir_pool, void **child_baton)
+{
+	se_baton_t *pb = parent_baton, *b = se_make_baton(pb->editor, dir_pool);
+	*child_baton = b;
+	SE_CALL(pb->editor->add_directory(path, pb->baton, copyfrom_path, copyfrom_revision, dir_pool, &b->baton));
+}
+
+static svn_error_t *se_open_directory(const char *path, void *parent_baton, svn_revnum_t base_revision, apr_pool_t *dir_pool, void **child_baton)
+{
+	se_baton_t *pb = parent_baton, *b = se_make_baton(pb->editor, dir_pool);
+	*child_baton = b;
+	SE_CALL(pb->editor->open_directory(path, pb->baton, base_revision, dir_pool, &b->baton));
+}
+
+static svn_error_t *se_change_dir_prop(void *dir_baton, const char *name, const svn_string_t *value, apr_pool_t *pool)
+{
+	se_baton_t *b = dir_baton;
+	SE_CALL(b->editor->change_dir_prop(b->baton, name, value, pool));
+}
+
+static svn_error_t *se_close_directory(void *dir_baton, apr_pool_t *pool)
+{
+	se_baton_t *b = dir_baton;
+	SE_CALL(b->editor->close_directory(b->baton, pool));
+}
+
+static svn_error_t *se_absent_directory(const char *path, void *parent_baton, apr_pool_t *pool)
+{
+	se_baton_t *pb = parent_baton;
+	SE_CALL(pb->editor->absent_directory(path, pb->baton, pool));
+}
+
+static svn_error_t *se_add_file(const char *path, void *parent_baton, const char *copyfrom_path, svn_revnum_t copyfrom_revision, apr_pool_t *file_pool, void **file_baton)
+{
+	se_baton_t *pb = parent_baton, *b = se_make_baton(pb->editor, file_pool);
+	*file_baton = b;
+	SE_CALL(pb->editor->add_file(path, pb->baton, copyfrom_path, copyfrom_revision, file_pool, &b->baton));
+}
+
+static svn_error_t *se_open_file(const char *path, void *parent_baton, svn_revnum_t base_revision, apr_pool_t *file_pool, void **file_baton)
+{
+	se_baton_t *pb = parent_baton, *b = se_make_baton(pb->editor, file_pool);
+	*file_baton = b;
+	SE_CALL(pb->editor->open_file(path, pb->baton, base_revision, file_pool, &b->baton));
+}
+
+static svn_error_t *se_window_handler(svn_txdelta_window_t *window, void *baton)
+{
+	se_window_baton_t *wb = baton;
+	if (window != NULL) {
+		counters[SC_DELTA_BYTES] += (window->new_data ? window->new_data->len : 0);
+		counters[SC_TEXT_BYTES] += window->tview_len;
+	}
+	SE_CALL(wb->handler(window, wb->baton));
+}
+
+static svn_error_t *se_apply_textdelta(void *file_baton, const char *base_checksum, apr_pool_t *pool, svn_txdelta_window_handler_t *handler, void **handler_baton)
+{
+	se_baton_t *b = file_baton;
+	se_window_baton_t *wb = apr_palloc(pool, sizeof(se_window_baton_t));
+	*handler = se_window_handler;
+	*handler_baton = wb;
+	SE_CALL(b->editor->apply_textdelta(b->baton, base_checksum, pool, &wb->handler, &wb->baton));
+}
+
+static svn_error_t *se_change_file_prop(void *file_baton, const char *name, const svn_string_t *value, apr_pool_t *pool)
+{
+	se_baton_t *b = file_baton;
+	SE_CALL(b->editor->change_file_prop(b->baton, name, value, pool));
+}
+
+static svn_error_t *se_close_file(void *file_baton, const char *text_checksum, apr_pool_t *pool)
+{
+	se_baton_t *b = file_baton;
+	SE_CALL(b->editor->close_file(b->baton, text_checksum, pool));
+}
+
+static svn_error_t *se_absent_file(const char *path, void *parent_baton, apr_pool_t *pool)
+{
+	se_baton_t *pb = parent_baton;
+	SE_CALL(pb->editor->absent_file(path, pb->baton, pool));
+}
+
+static svn_error_t *se_close_edit(void *edit_baton, apr_pool_t *pool)
+{
+	se_baton_t *eb = edit_baton;
+	SE_CALL(eb->editor->close_edit(eb->baton, pool));
+}
+
+static svn_error_t *se_abort_edit(void *edit_baton, apr_pool_t *pool)
+{
+	se_baton_t *eb = edit_baton;
+	SE_CALL(eb->editor->abort_edit(eb->baton, pool));
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Enables statistics, with an optional summary and periodic JSON snapshots */
+int stats_enable(char summary, const char *json_path)
+{
+	if (json_path != NULL) {
+		if ((json_file = fopen(json_path, "w")) == NULL) {
+			fprintf(stderr, _("ERROR: Unable to open %s (%s)\n"), json_path, strerror(errno));
+			return -1;
+		}
+	}
+
+	memset(counters, 0, sizeof(counters));
+	memset(timers, 0, sizeof(timers));
+	memset(histogram, 0, sizeof(histogram));
+	start_time = last_snapshot = apr_time_now();
+	print_summary = summary;
+	stats_enabled = 1;
+	return 0;
+}
+
+
+/* Adds a value to a counter */
+void stats_add(stats_counter_t counter, apr_uint64_t n)
+{
+	if (stats_enabled) {
+		counters[counter] += n;
+	}
+}
+
+
+/* Returns the current value of a counter */
+apr_uint64_t stats_get(stats_counter_t counter)
+{
+	return counters[counter];
+}
+
+
+/* Returns the current time if statistics are enabled */
+apr_time_t stats_timer_start()
+{
+	return (stats_enabled ? apr_time_now() : 0);
+}
+
+
+/* Adds the time elapsed since start to a timer */
+void stats_timer_stop(stats_timer_t timer, apr_time_t start)
+{
+	if (stats_enabled) {
+		timers[timer] += (apr_time_now() - start);
+	}
+}
+
+
+/* Records the latency of a dumped revision and writes a snapshot if due */
+void stats_revision_done(svn_revnum_t revision, apr_time_t start)
+{
+	apr_time_t now;
+	apr_int64_t ms;
+	int bucket = 0;
+
+	if (!stats_enabled) {
+		return;
+	}
+
+	now = apr_time_now();
+	ms = apr_time_as_msec(now - start);
+	while (ms > 0 && bucket < HISTOGRAM_SIZE-1) {
+		ms >>= 1;
+		++bucket;
+	}
+	++histogram[bucket];
+	++counters[SC_REVISIONS];
+	last_revision = revision;
+	stats_snapshot_check(now);
+}
+
+
+/* Progress callback for the RA layer */
+void stats_ra_progress(apr_off_t progress, apr_off_t total, void *baton, apr_pool_t *pool)
+{
+	if (!stats_enabled) {
+		return;
+	}
+
+	/* The progress is cumulative, but may be reset by some RA layers */
+	if (progress >= last_progress) {
+		counters[SC_BYTES_RECEIVED] += (progress - last_progress);
+	} else {
+		counters[SC_BYTES_RECEIVED] += progress;
+	}
+	last_progress = progress;
+
+	if (json_file != NULL) {
+		stats_snapshot_check(apr_time_now());
+	}
+}
+
+
+/* Wraps a delta editor in order to measure the time spent in it */
+void stats_wrap_editor(const svn_delta_editor_t **editor, void **edit_baton, apr_pool_t *pool)
+{
+	svn_delta_editor_t *wrapper;
+	se_baton_t *eb;
+
+	if (!stats_enabled) {
+		return;
+	}
+
+	wrapper = svn_delta_default_editor(pool);
+	wrapper->set_target_revision = se_set_target_revision;
+	wrapper->open_root = se_open_root;
+	wrapper->delete_entry = se_delete_entry;
+	wrapper->add_directory = se_add_directory;
+	wrapper->open_directory = se_open_directory;
+	wrapper->change_dir_prop = se_change_dir_prop;
+	wrapper->close_directory = se_close_directory;
+	wrapper->absent_directory = se_absent_directory;
+	wrapper->add_file = se_add_file;
+	wrapper->open_file = se_open_file;
+	wrapper->apply_textdelta = se_apply_textdelta;
+	wrapper->change_file_prop = se_change_file_prop;
+	wrapper->close_file = se_close_file;
+	wrapper->absent_file = se_absent_file;
+	wrapper->close_edit = se_close_edit;
+	wrapper->abort_edit = se_abort_edit;
+
+	eb = se_make_baton(*editor, pool);
+	eb->baton = *edit_baton;
+	*editor = wrapper;
+	*edit_baton = eb;
+}
+
+
+/* Prints a summary (if requested) and writes a final snapshot */
+void stats_finish()
+{
+	if (!stats_enabled) {
+		return;
+	}
+
+	if (print_summary) {
+		stats_summary();
+	}
+	if (json_file != NULL) {
+		stats_snapshot(1);
+		fclose(json_file);
+		json_file = NULL;
+	}
+	stats_enabled = 0;
+}
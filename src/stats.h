@@ -0,0 +1,103 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-present Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ *      file: stats.h
+ *      desc: Performance counters and timers
+ */
+
+
+#ifndef STATS_H_
+#define STATS_H_
+
+
+#include <svn_delta.h>
+#include <svn_types.h>
+
+#include <apr_pools.h>
+#include <apr_time.h>
+
+
+/* Counters */
+typedef enum {
+	SC_BYTES_RECEIVED = 0,  /* Bytes reported by the RA layer */
+	SC_DELTA_BYTES,         /* New data in received text delta windows */
+	SC_TEXT_BYTES,          /* Full text bytes written to local copies */
+	SC_EDITOR_CALLS,
+	SC_REVISIONS,
+	SC_PR_BYTES_RAW,        /* Path repository deltas and snapshots */
+	SC_PR_BYTES,
+	SC_PR_CACHE_HITS,
+	SC_PR_CACHE_MISSES,
+	SC_PR_QUERY_HITS,       /* Memoized path queries */
+	SC_PR_QUERY_MISSES,
+	SC_PROP_BYTES_RAW,      /* Node property storage */
+	SC_PROP_BYTES,
+	SC_PROP_HITS,           /* Property sets that were already stored */
+	SC_PROP_MISSES,
+	SC_TEXT_MEMORY,         /* Local copies kept in memory */
+	SC_TEXT_DISK,           /* Local copies written to temporary files */
+	SC_TEXT_EVICTED,        /* Local copies moved from memory to disk */
+	SC_TEXT_SHARED,         /* Local copies with already stored contents */
+	SC_NUM_COUNTERS
+} stats_counter_t;
+
+/* Timers */
+typedef enum {
+	ST_DIFF = 0,            /* Total time spent in dump_do_diff() */
+	ST_EDITOR,              /* Time spent in delta editor callbacks */
+	ST_TEMP_IO,             /* Reading and deltifying local copies */
+	ST_PR_RECONSTRUCT,
+	ST_PR_STORE,
+	ST_NUM_TIMERS
+} stats_timer_t;
+
+
+/* Global variable: non-zero if statistics should be gathered */
+extern int stats_enabled;
+
+
+/* Enables statistics, with an optional summary and periodic JSON snapshots */
+extern int stats_enable(char summary, const char *json_file);
+
+/* Adds a value to a counter */
+extern void stats_add(stats_counter_t counter, apr_uint64_t n);
+
+/* Returns the current value of a counter */
+extern apr_uint64_t stats_get(stats_counter_t counter);
+
+/* Returns the current time if statistics are enabled */
+extern apr_time_t stats_timer_start();
+
+/* Adds the time elapsed since start to a timer */
+extern void stats_timer_stop(stats_timer_t timer, apr_time_t start);
+
+/* Records the latency of a dumped revision and writes a snapshot if due */
+extern void stats_revision_done(svn_revnum_t revision, apr_time_t start);
+
+/* Progress callback for the RA layer */
+extern void stats_ra_progress(apr_off_t progress, apr_off_t total, void *baton, apr_pool_t *pool);
+
+/* Wraps a delta editor in order to measure the time spent in it */
+extern void stats_wrap_editor(const svn_delta_editor_t **editor, void **edit_baton, apr_pool_t *pool);
+
+/* Prints a summary (if requested) and writes a final snapshot */
+extern void stats_finish();
+
+
+#endif
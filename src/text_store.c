@@ -0,0 +1,627 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-present Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: text_store.c
+ *      desc: Storage for local copies of file contents
+ *
+ *      Most files are small, so creating a temporary file for every
+ *      version is expensive. Texts below a threshold are kept in memory
+ *      (compressed, if possible) instead. If the memory budget is
+ *      exceeded, the least recently used texts are moved to disk.
+ *
+ *      Contents are stored once per MD5 checksum, so copied or reverted
+ *      files share a single blob. Texts are names referencing blobs.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <svn_io.h>
+#include <svn_md5.h>
+#include <svn_pools.h>
+
+#include <apr_file_io.h>
+#include <apr_hash.h>
+#include <apr_md5.h>
+#include <apr_strings.h>
+
+#include "main.h"
+
+#include "logger.h"
+#include "reaper.h"
+#include "stats.h"
+#include "utils.h"
+
+#ifdef USE_SNAPPY
+	#include "snappy-c/snappy.h"
+#endif
+
+#include "text_store.h"
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+/* Stored contents */
+typedef struct text_blob_t {
+	unsigned char md5[APR_MD5_DIGESTSIZE];
+	int refs;             /* Number of texts referencing this blob */
+	char *data;           /* Contents if in memory */
+	apr_size_t dsize;     /* Size of data */
+	apr_size_t size;      /* Uncompressed size */
+	char compressed;
+	char *filename;       /* File name if on disk */
+	struct text_blob_t *prev, *next;  /* LRU list, for blobs in memory */
+} text_blob_t;
+
+
+/* A single text */
+typedef struct {
+	char *name;
+	text_blob_t *blob;    /* NULL until the writing stream is closed */
+} text_entry_t;
+
+
+/* Baton for writing streams */
+typedef struct {
+	text_entry_t *entry;
+	svn_stringbuf_t *buffer;  /* Contents until the threshold is reached */
+	apr_file_t *file;
+	char *filename;
+	apr_size_t size;
+	apr_md5_ctx_t md5_ctx;
+	apr_pool_t *pool;
+} text_writer_t;
+
+
+/*---------------------------------------------------------------------------*/
+/* Static variables                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+static apr_pool_t *store_pool = NULL;
+static apr_hash_t *entries = NULL;   /* Name to text_entry_t */
+static apr_hash_t *blobs = NULL;     /* MD5 sum to text_blob_t */
+static const char *temp_dir = NULL;
+static apr_size_t mem_threshold = 0;
+static apr_size_t mem_budget = 0;
+static apr_size_t mem_used = 0;
+static unsigned long next_id = 0;
+
+/* The most recently used blob is at the head of the list */
+static text_blob_t *lru_head = NULL;
+static text_blob_t *lru_tail = NULL;
+
+#ifdef USE_SNAPPY
+static struct snappy_env snappy_env;
+#endif
+
+
+/*---------------------------------------------------------------------------*/
+/* Local functions                                                           */
+/*---------------------------------------------------------------------------*/
+
+
+/* Allocates memory, exiting if there is none left */
+static void *ts_malloc(size_t size)
+{
+	void *ptr = malloc(size > 0 ? size : 1);
+	if (ptr == NULL) {
+		fprintf(stderr, "text store: out of memory\n");
+		exit(1);
+	}
+	return ptr;
+}
+
+
+/* Duplicates a string using malloc() */
+static char *ts_strdup(const char *str)
+{
+	char *copy = ts_malloc(strlen(str) + 1);
+	strcpy(copy, str);
+	return copy;
+}
+
+
+/* Removes a blob from the LRU list */
+static void ts_lru_unlink(text_blob_t *blob)
+{
+	if (blob->prev) {
+		blob->prev->next = blob->next;
+	} else {
+		lru_head = blob->next;
+	}
+	if (blob->next) {
+		blob->next->prev = blob->prev;
+	} else {
+		lru_tail = blob->prev;
+	}
+	blob->prev = blob->next = NULL;
+}
+
+
+/* Inserts a blob at the head of the LRU list */
+static void ts_lru_push(text_blob_t *blob)
+{
+	blob->prev = NULL;
+	blob->next = lru_head;
+	if (lru_head) {
+		lru_head->prev = blob;
+	} else {
+		lru_tail = blob;
+	}
+	lru_head = blob;
+}
+
+
+/* Decompresses the contents of a blob that is kept in memory */
+static svn_error_t *ts_uncompress(char **data, text_blob_t *blob, apr_pool_t *pool)
+{
+	*data = apr_palloc(pool, blob->size + 1);
+	if (!blob->compressed) {
+		memcpy(*data, blob->data, blob->size);
+	} else {
+#ifdef USE_SNAPPY
+		if (snappy_uncompress(blob->data, blob->dsize, *data) != 0) {
+			return svn_error_createf(1, NULL, "Unable to decompress %s", svn_md5_digest_to_cstring(blob->md5, pool));
+		}
+#endif
+	}
+	(*data)[blob->size] = '\0';
+	return SVN_NO_ERROR;
+}
+
+
+/* Creates a new temporary file */
+static svn_error_t *ts_create_file(apr_file_t **file, char **filename, apr_pool_t *pool)
+{
+	apr_status_t status;
+
+	*filename = apr_psprintf(pool, "%s/td/XXXXXX", temp_dir);
+	status = utils_mkstemp(file, *filename, pool);
+	if (status) {
+		DEBUG_MSG("text_store: Error creating temporary file in %s\n", temp_dir);
+		return svn_error_wrap_apr(status, "Unable to create temporary file in %s", temp_dir);
+	}
+	stats_add(SC_TEXT_DISK, 1);
+	return SVN_NO_ERROR;
+}
+
+
+/* Moves the least recently used blobs to disk until the memory budget is met */
+static svn_error_t *ts_evict(apr_pool_t *pool)
+{
+	apr_pool_t *subpool = svn_pool_create(pool);
+
+	while (mem_used > mem_budget && lru_tail != NULL) {
+		text_blob_t *blob = lru_tail;
+		apr_file_t *file;
+		char *filename, *data;
+		apr_status_t status;
+
+		SVN_ERR(ts_uncompress(&data, blob, subpool));
+		SVN_ERR(ts_create_file(&file, &filename, subpool));
+		if ((status = apr_file_write_full(file, data, blob->size, NULL)) != APR_SUCCESS
+		    || (status = apr_file_close(file)) != APR_SUCCESS) {
+			return svn_error_wrap_apr(status, "Unable to write to %s", filename);
+		}
+
+		DEBUG_MSG("text_store: evicting %s to %s\n", svn_md5_digest_to_cstring(blob->md5, subpool), filename);
+		ts_lru_unlink(blob);
+		mem_used -= blob->dsize;
+		free(blob->data);
+		blob->data = NULL;
+		blob->filename = ts_strdup(filename);
+		stats_add(SC_TEXT_EVICTED, 1);
+		svn_pool_clear(subpool);
+	}
+
+	svn_pool_destroy(subpool);
+	return SVN_NO_ERROR;
+}
+
+
+/* Keeps the contents of a new blob in memory */
+static void ts_store_memory(text_blob_t *blob, const char *data, apr_size_t len, apr_pool_t *pool)
+{
+	blob->size = len;
+	blob->dsize = len;
+	blob->compressed = 0;
+
+#ifdef USE_SNAPPY
+	if (len > 0) {
+		size_t dsize;
+		char *dptr = apr_palloc(pool, snappy_max_compressed_length(len));
+		if (snappy_compress(&snappy_env, data, len, dptr, &dsize) == 0 && dsize < len) {
+			data = dptr;
+			blob->dsize = dsize;
+			blob->compressed = 1;
+		}
+	}
+#endif
+
+	blob->data = ts_malloc(blob->dsize);
+	memcpy(blob->data, data, blob->dsize);
+
+	ts_lru_push(blob);
+	mem_used += blob->dsize;
+	stats_add(SC_TEXT_MEMORY, 1);
+}
+
+
+/* Drops a reference to a blob, freeing it if it's not used anymore */
+static void ts_release_blob(text_blob_t *blob, char remove_file)
+{
+	if (--blob->refs > 0) {
+		return;
+	}
+
+	apr_hash_set(blobs, blob->md5, APR_MD5_DIGESTSIZE, NULL);
+	if (blob->data != NULL) {
+		ts_lru_unlink(blob);
+		mem_used -= blob->dsize;
+	}
+	if (blob->filename != NULL && remove_file) {
+		reaper_unlink(blob->filename);
+	}
+	free(blob->data);
+	free(blob->filename);
+	free(blob);
+}
+
+
+/* Stream callback: writes data to a text */
+static svn_error_t *ts_write(void *baton, const char *data, apr_size_t *len)
+{
+	text_writer_t *writer = baton;
+	apr_status_t status;
+
+	apr_md5_update(&writer->md5_ctx, data, *len);
+	writer->size += *len;
+
+	/* Switch to a file once the threshold has been exceeded */
+	if (writer->file == NULL && writer->buffer->len + *len > mem_threshold) {
+		SVN_ERR(ts_create_file(&writer->file, &writer->filename, writer->pool));
+		if (writer->buffer->len > 0) {
+			status = apr_file_write_full(writer->file, writer->buffer->data, writer->buffer->len, NULL);
+			if (status != APR_SUCCESS) {
+				return svn_error_wrap_apr(status, "Unable to write to %s", writer->filename);
+			}
+		}
+	}
+
+	if (writer->file == NULL) {
+		svn_stringbuf_appendbytes(writer->buffer, data, *len);
+	} else {
+		status = apr_file_write_full(writer->file, data, *len, NULL);
+		if (status != APR_SUCCESS) {
+			return svn_error_wrap_apr(status, "Unable to write to %s", writer->filename);
+		}
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Stream callback: finishes a text, sharing the blob with equal texts */
+static svn_error_t *ts_close(void *baton)
+{
+	text_writer_t *writer = baton;
+	unsigned char md5[APR_MD5_DIGESTSIZE];
+	text_blob_t *blob;
+
+	if (writer->entry->blob != NULL) {
+		return SVN_NO_ERROR;
+	}
+
+	if (writer->file != NULL) {
+		apr_status_t status = apr_file_close(writer->file);
+		if (status != APR_SUCCESS) {
+			return svn_error_wrap_apr(status, "Unable to write to %s", writer->filename);
+		}
+	}
+
+	apr_md5_final(md5, &writer->md5_ctx);
+	blob = apr_hash_get(blobs, md5, APR_MD5_DIGESTSIZE);
+	if (blob != NULL) {
+		DEBUG_MSG("text_store: %s shares %s\n", writer->entry->name, svn_md5_digest_to_cstring(md5, writer->pool));
+		++blob->refs;
+		writer->entry->blob = blob;
+		if (writer->file != NULL) {
+			reaper_unlink(writer->filename);
+		}
+		stats_add(SC_TEXT_SHARED, 1);
+		return SVN_NO_ERROR;
+	}
+
+	blob = ts_malloc(sizeof(text_blob_t));
+	memcpy(blob->md5, md5, APR_MD5_DIGESTSIZE);
+	blob->refs = 1;
+	blob->data = NULL;
+	blob->filename = NULL;
+	blob->prev = blob->next = NULL;
+	apr_hash_set(blobs, blob->md5, APR_MD5_DIGESTSIZE, blob);
+	writer->entry->blob = blob;
+
+	if (writer->file != NULL) {
+		blob->filename = ts_strdup(writer->filename);
+		blob->size = writer->size;
+		blob->dsize = 0;
+		blob->compressed = 0;
+		return SVN_NO_ERROR;
+	}
+	ts_store_memory(blob, writer->buffer->data, writer->buffer->len, writer->pool);
+	return ts_evict(writer->pool);
+}
+
+
+/* Frees an entry */
+static void ts_free_entry(text_entry_t *entry, char remove_file)
+{
+	if (entry->blob != NULL) {
+		ts_release_blob(entry->blob, remove_file);
+	}
+	free(entry->name);
+	free(entry);
+}
+
+
+/* Cleanup handler for the store pool */
+static apr_status_t ts_cleanup(void *param)
+{
+	apr_hash_index_t *hi;
+	void *value;
+
+	for (hi = apr_hash_first(NULL, entries); hi; hi = apr_hash_next(hi)) {
+		apr_hash_this(hi, NULL, NULL, &value);
+		ts_free_entry(value, 0);
+	}
+#ifdef USE_SNAPPY
+	snappy_free_env(&snappy_env);
+#endif
+
+	entries = NULL;
+	blobs = NULL;
+	store_pool = NULL;
+	lru_head = lru_tail = NULL;
+	mem_used = 0;
+	return APR_SUCCESS;
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Initializes the text store. Texts up to 'threshold' bytes are kept
+   in memory as long as their total size doesn't exceed 'budget' bytes */
+int text_store_init(const char *tmpdir, apr_size_t threshold, apr_size_t budget, apr_pool_t *pool)
+{
+	store_pool = svn_pool_create(pool);
+	entries = apr_hash_make(store_pool);
+	blobs = apr_hash_make(store_pool);
+	temp_dir = apr_pstrdup(store_pool, tmpdir);
+	mem_threshold = (budget > 0 ? threshold : 0);
+	mem_budget = budget;
+	mem_used = 0;
+
+#ifdef USE_SNAPPY
+	if (snappy_init_env(&snappy_env) != 0) {
+		fprintf(stderr, _("Error initializing snappy compressor\n"));
+		return -1;
+	}
+#endif
+
+	apr_pool_cleanup_register(store_pool, NULL, ts_cleanup, apr_pool_cleanup_null);
+	return 0;
+}
+
+
+/* Creates a new text and returns a stream for writing its contents.
+   The text is complete once the stream has been closed */
+svn_error_t *text_store_write(svn_stream_t **stream, const char **name, apr_pool_t *pool)
+{
+	text_writer_t *writer = apr_pcalloc(pool, sizeof(text_writer_t));
+	text_entry_t *entry = ts_malloc(sizeof(text_entry_t));
+
+	entry->name = ts_strdup(apr_psprintf(pool, "text-%lu", next_id++));
+	entry->blob = NULL;
+	apr_hash_set(entries, entry->name, APR_HASH_KEY_STRING, entry);
+
+	writer->entry = entry;
+	writer->buffer = svn_stringbuf_create("", pool);
+	writer->pool = pool;
+	apr_md5_init(&writer->md5_ctx);
+
+	*stream = svn_stream_create(writer, pool);
+	svn_stream_set_write(*stream, ts_write);
+	svn_stream_set_close(*stream, ts_close);
+	*name = entry->name;
+	return SVN_NO_ERROR;
+}
+
+
+/* Returns a stream for reading the contents of a text */
+svn_error_t *text_store_read(svn_stream_t **stream, const char *name, apr_pool_t *pool)
+{
+	text_entry_t *entry = apr_hash_get(entries, name, APR_HASH_KEY_STRING);
+	text_blob_t *blob;
+	apr_file_t *file;
+	apr_status_t status;
+
+	if (entry == NULL) {
+		return svn_error_createf(1, NULL, "Unknown text %s", name);
+	}
+	if ((blob = entry->blob) == NULL) {
+		*stream = svn_stream_empty(pool);
+		return SVN_NO_ERROR;
+	}
+
+	if (blob->data != NULL) {
+		svn_stringbuf_t *buf = apr_palloc(pool, sizeof(svn_stringbuf_t));
+		SVN_ERR(ts_uncompress(&buf->data, blob, pool));
+		buf->len = blob->size;
+		buf->blocksize = blob->size + 1;
+		buf->pool = pool;
+
+		/* Mark as recently used */
+		ts_lru_unlink(blob);
+		ts_lru_push(blob);
+
+		*stream = svn_stream_from_stringbuf(buf, pool);
+		return SVN_NO_ERROR;
+	}
+
+	status = apr_file_open(&file, blob->filename, APR_READ, 0600, pool);
+	if (status) {
+		DEBUG_MSG("text_store_read(%s): Error opening %s\n", name, blob->filename);
+		return svn_error_wrap_apr(status, "Unable to open %s", blob->filename);
+	}
+	*stream = svn_stream_from_aprfile2(file, FALSE, pool);
+	return SVN_NO_ERROR;
+}
+
+
+/* Returns either a copy of the contents of a text or the name of the file
+   containing it. The file stays valid until the text is removed */
+svn_error_t *text_store_locate(const char *name, svn_stringbuf_t **data, const char **filename, apr_pool_t *pool)
+{
+	text_entry_t *entry = apr_hash_get(entries, name, APR_HASH_KEY_STRING);
+	text_blob_t *blob;
+
+	if (entry == NULL) {
+		return svn_error_createf(1, NULL, "Unknown text %s", name);
+	}
+
+	*data = NULL;
+	*filename = NULL;
+	if ((blob = entry->blob) == NULL) {
+		*data = svn_stringbuf_create("", pool);
+	} else if (blob->data != NULL) {
+		svn_stringbuf_t *buf = apr_palloc(pool, sizeof(svn_stringbuf_t));
+		SVN_ERR(ts_uncompress(&buf->data, blob, pool));
+		buf->len = blob->size;
+		buf->blocksize = blob->size + 1;
+		buf->pool = pool;
+		*data = buf;
+	} else {
+		*filename = apr_pstrdup(pool, blob->filename);
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Returns the size of a text */
+svn_error_t *text_store_size(apr_off_t *size, const char *name, apr_pool_t *pool)
+{
+	text_entry_t *entry = apr_hash_get(entries, name, APR_HASH_KEY_STRING);
+
+	if (entry == NULL) {
+		return svn_error_createf(1, NULL, "Unknown text %s", name);
+	}
+	*size = (entry->blob != NULL ? (apr_off_t)entry->blob->size : 0);
+	return SVN_NO_ERROR;
+}
+
+
+/* Removes a text. Files on disk are removed by the reaper */
+void text_store_remove(const char *name)
+{
+	text_entry_t *entry = apr_hash_get(entries, name, APR_HASH_KEY_STRING);
+	if (entry == NULL) {
+		return;
+	}
+
+	apr_hash_set(entries, entry->name, APR_HASH_KEY_STRING, NULL);
+	ts_free_entry(entry, 1);
+}
+
+
+/* Writes the contents of a text to the given file, which is created */
+int text_store_export(const char *name, const char *path, apr_pool_t *pool)
+{
+	text_entry_t *entry = apr_hash_get(entries, name, APR_HASH_KEY_STRING);
+	text_blob_t *blob;
+	apr_file_t *file;
+	svn_error_t *err;
+	char *data;
+
+	if (entry == NULL || (blob = entry->blob) == NULL) {
+		return -1;
+	}
+
+	/* Files on disk won't be needed anymore, so try to move them */
+	if (blob->data == NULL) {
+		if (blob->refs == 1 && apr_file_rename(blob->filename, path, pool) == APR_SUCCESS) {
+			free(blob->filename);
+			blob->filename = ts_strdup(path);
+			return 0;
+		}
+		return (apr_file_copy(blob->filename, path, APR_FILE_SOURCE_PERMS, pool) == APR_SUCCESS ? 0 : -1);
+	}
+
+	if ((err = ts_uncompress(&data, blob, pool))) {
+		svn_error_clear(err);
+		return -1;
+	}
+	if (apr_file_open(&file, path, APR_WRITE | APR_CREATE | APR_TRUNCATE | APR_BINARY, APR_OS_DEFAULT, pool) != APR_SUCCESS) {
+		return -1;
+	}
+	if (apr_file_write_full(file, data, blob->size, NULL) != APR_SUCCESS) {
+		apr_file_close(file);
+		return -1;
+	}
+	return (apr_file_close(file) == APR_SUCCESS ? 0 : -1);
+}
+
+
+/* Creates a new text from the contents of the given file */
+int text_store_import(const char **name, const char *path, apr_pool_t *pool)
+{
+	svn_stream_t *in, *out;
+	apr_file_t *file;
+	svn_error_t *err;
+
+	if (apr_file_open(&file, path, APR_READ | APR_BINARY, 0600, pool) != APR_SUCCESS) {
+		return -1;
+	}
+	in = svn_stream_from_aprfile2(file, FALSE, pool);
+
+	if ((err = text_store_write(&out, name, pool))
+	    || (err = svn_stream_copy(in, out, pool))
+	    || (err = svn_stream_close(out))) {
+		svn_stream_close(in);
+		svn_error_clear(err);
+		return -1;
+	}
+	svn_stream_close(in);
+	return 0;
+}
+
+
+/* Frees all resources */
+void text_store_cleanup()
+{
+	if (store_pool != NULL) {
+		svn_pool_destroy(store_pool);
+	}
+}
@@ -0,0 +1,64 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-present Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: text_store.h
+ *      desc: Storage for local copies of file contents
+ */
+
+
+#ifndef TEXT_STORE_H_
+#define TEXT_STORE_H_
+
+
+#include <svn_io.h>
+
+#include <apr_pools.h>
+
+
+/* Initializes the text store. Texts up to 'threshold' bytes are kept
+   in memory as long as their total size doesn't exceed 'budget' bytes */
+extern int text_store_init(const char *tmpdir, apr_size_t threshold, apr_size_t budget, apr_pool_t *pool);
+
+/* Creates a new text and returns a stream for writing its contents.
+   The text is complete once the stream has been closed */
+extern svn_error_t *text_store_write(svn_stream_t **stream, const char **name, apr_pool_t *pool);
+
+/* Returns a stream for reading the contents of a text */
+extern svn_error_t *text_store_read(svn_stream_t **stream, const char *name, apr_pool_t *pool);
+
+/* Returns either a copy of the contents of a text or the name of the file
+   containing it. The file stays valid until the text is removed */
+extern svn_error_t *text_store_locate(const char *name, svn_stringbuf_t **data, const char **filename, apr_pool_t *pool);
+
+/* Returns the size of a text */
+extern svn_error_t *text_store_size(apr_off_t *size, const char *name, apr_pool_t *pool);
+
+/* Removes a text. Files on disk are removed by the reaper */
+extern void text_store_remove(const char *name);
+
+/* Writes the contents of a text to the given file, which is created */
+extern int text_store_export(const char *name, const char *path, apr_pool_t *pool);
+
+/* Creates a new text from the contents of the given file */
+extern int text_store_import(const char **name, const char *path, apr_pool_t *pool);
+
+/* Frees all resources */
+extern void text_store_cleanup();
+
+
+#endif
@@ -219,6 +219,31 @@ void utils_rrmdir(struct apr_pool_t *pool, const char *path, char remove_dir)
 }
 
 
+/* Recursively sums up the size and number of files in a directory */
+void utils_dir_usage(struct apr_pool_t *pool, const char *path, apr_off_t *bytes, apr_uint64_t *files)
+{
+	apr_pool_t *subpool = svn_pool_create((apr_pool_t *)pool);
+	apr_dir_t *dir = NULL;
+
+	if (apr_dir_open(&dir, path, subpool) == APR_SUCCESS) {
+		apr_finfo_t *info = apr_palloc(subpool, sizeof(apr_finfo_t));
+		while (apr_dir_read(info, APR_FINFO_NAME | APR_FINFO_TYPE | APR_FINFO_SIZE, dir) == APR_SUCCESS) {
+			if (strcmp(info->name, ".") && strcmp(info->name, "..")) {
+				if (info->filetype == APR_DIR) {
+					utils_dir_usage(subpool, apr_psprintf(subpool, "%s/%s", path, info->name), bytes, files);
+				} else {
+					*bytes += info->size;
+					++(*files);
+				}
+			}
+		}
+		apr_dir_close(dir);
+	}
+
+	svn_pool_destroy(subpool);
+}
+
+
 /* Path splitting, without canonicalization */
 void utils_path_split(struct apr_pool_t *pool, const char *path, const char **dir, const char **base)
 {
@@ -253,12 +278,115 @@ const char *utils_path_join(struct apr_pool_t *pool, const char *dir, const char
 }
 
 
+/* Writes a length-prefixed chunk of data to a stream */
+int utils_write_chunk(FILE *f, const void *data, size_t len)
+{
+	if (fwrite(&len, sizeof(size_t), 1, f) != 1) {
+		return -1;
+	}
+	if (len > 0 && fwrite(data, 1, len, f) != len) {
+		return -1;
+	}
+	return 0;
+}
+
+
+/* Reads a length-prefixed chunk of data from a stream. The data is
+   allocated in the given pool and zero-terminated for convenience. */
+int utils_read_chunk(FILE *f, char **data, size_t *len, apr_pool_t *pool)
+{
+	if (fread(len, sizeof(size_t), 1, f) != 1) {
+		return -1;
+	}
+	*data = apr_palloc(pool, *len + 1);
+	if (*len > 0 && fread(*data, 1, *len, f) != *len) {
+		return -1;
+	}
+	(*data)[*len] = '\0';
+	return 0;
+}
+
+
 static int compstrp(const void *a, const void *b) { return strcmp(*(char *const *)a, *(char * const *)b); }
 
-/* qsort() wrapper for an array of strings */
+/* Returns the character at the given position as an unsigned value */
+#define MKQS_CHAR(s, d) ((unsigned char)(s)[d])
+#define MKQS_SWAP(a, i, j) do { const char *t_ = (a)[i]; (a)[i] = (a)[j]; (a)[j] = t_; } while (0)
+
+/* Multikey quicksort (Bentley and Sedgewick) for strings that are known to
+   be equal up to the given depth. Paths share long prefixes, so comparing
+   single characters avoids rescanning them with strcmp() */
+static void utils_mkqsort(const char **a, size_t n, size_t depth)
+{
+	while (n > 1) {
+		size_t lt, gt, i;
+		unsigned int v, x, y, z;
+
+		/* Small ranges are sorted by insertion */
+		if (n < 16) {
+			for (i = 1; i < n; i++) {
+				size_t j;
+				for (j = i; j > 0 && strcmp(a[j-1] + depth, a[j] + depth) > 0; j--) {
+					MKQS_SWAP(a, j-1, j);
+				}
+			}
+			return;
+		}
+
+		/* Median of three as pivot */
+		x = MKQS_CHAR(a[0], depth);
+		y = MKQS_CHAR(a[n/2], depth);
+		z = MKQS_CHAR(a[n-1], depth);
+		v = (x < y ? (y < z ? y : (x < z ? z : x)) : (x < z ? x : (y < z ? z : y)));
+
+		/* Three-way partition on the current character */
+		lt = 0;
+		gt = n;
+		i = 0;
+		while (i < gt) {
+			unsigned int c = MKQS_CHAR(a[i], depth);
+			if (c < v) {
+				MKQS_SWAP(a, lt, i);
+				++lt;
+				++i;
+			} else if (c > v) {
+				--gt;
+				MKQS_SWAP(a, i, gt);
+			} else {
+				++i;
+			}
+		}
+
+		utils_mkqsort(a, lt, depth);
+		utils_mkqsort(a + gt, n - gt, depth);
+
+		/* Continue with the next character in the middle range, unless
+		   all strings in it have ended */
+		if (v == 0) {
+			return;
+		}
+		a += lt;
+		n = gt - lt;
+		++depth;
+	}
+}
+
+#undef MKQS_CHAR
+#undef MKQS_SWAP
+
+/* Sorts an array of strings */
 void utils_sort(apr_array_header_t *a)
 {
-	qsort(a->elts, a->nelts, a->elt_size, compstrp);
+	const char **elts = (const char **)a->elts;
+	int i;
+
+	/* Nothing to do if the array is sorted already */
+	for (i = 1; i < a->nelts && strcmp(elts[i-1], elts[i]) <= 0; i++);
+	if (i >= a->nelts) {
+		return;
+	}
+
+	utils_mkqsort(elts, a->nelts, 0);
 }
 
 
@@ -267,3 +395,30 @@ char *utils_search(const char *s, apr_array_header_t *a)
 {
 	return bsearch(&s, a->elts, a->nelts, a->elt_size, compstrp);
 }
+
+
+#if APR_HAS_THREADS
+
+/*
+ * Creates a root pool for data that is shared with other threads, along
+ * with a mutex and up to two condition variables for non-NULL arguments.
+ * Pools aren't thread-safe, so background threads can't allocate from the
+ * pools of the dumping thread, and sub-pools can't be created or
+ * destroyed concurrently either. Thus, every thread uses its own root
+ * pool, and so do the synchronization primitives shared with it.
+ * Returns NULL on failure.
+ */
+apr_pool_t *utils_thread_pool_create(apr_thread_mutex_t **mutex, apr_thread_cond_t **cond1, apr_thread_cond_t **cond2)
+{
+	apr_pool_t *pool = svn_pool_create(NULL);
+
+	if ((mutex != NULL && apr_thread_mutex_create(mutex, APR_THREAD_MUTEX_DEFAULT, pool) != APR_SUCCESS)
+	    || (cond1 != NULL && apr_thread_cond_create(cond1, pool) != APR_SUCCESS)
+	    || (cond2 != NULL && apr_thread_cond_create(cond2, pool) != APR_SUCCESS)) {
+		svn_pool_destroy(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+#endif /* APR_HAS_THREADS */
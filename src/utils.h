@@ -25,11 +25,18 @@
 #define UTILS_H
 
 
+#include <stdio.h>
+
 #include "main.h"
 
 #include <apr_file_io.h>
 #include <apr_pools.h>
 
+#if APR_HAS_THREADS
+ #include <apr_thread_cond.h>
+ #include <apr_thread_mutex.h>
+#endif
+
 
 #ifdef USE_TIMING
 
@@ -57,15 +64,31 @@ extern int utils_mkstemp(apr_file_t **file, char *name, apr_pool_t *pool);
 /* itself it 'rmdir' is non-zero */
 extern void utils_rrmdir(apr_pool_t *pool, const char *path, char rmdir);
 
+/* Recursively sums up the size and number of files in a directory */
+extern void utils_dir_usage(apr_pool_t *pool, const char *path, apr_off_t *bytes, apr_uint64_t *files);
+
 /* Path splitting and joining */
 extern void utils_path_split(apr_pool_t *pool, const char *path, const char **dir, const char **base);
 extern const char *utils_path_join(apr_pool_t *pool, const char *dir, const char *base);
 
-/* qsort() wrapper for an array of strings */
+/* Reads and writes length-prefixed chunks of data */
+extern int utils_write_chunk(FILE *f, const void *data, size_t len);
+extern int utils_read_chunk(FILE *f, char **data, size_t *len, apr_pool_t *pool);
+
+/* Sorts an array of strings */
 extern void utils_sort(apr_array_header_t *a);
 
 /* bsearch() wrapper for an array of strings */
 extern char *utils_search(const char *s, apr_array_header_t *a);
 
+#if APR_HAS_THREADS
+
+/* Creates a root pool for data that is shared with other threads, along
+   with a mutex and up to two condition variables for non-NULL arguments.
+   Returns NULL on failure */
+extern apr_pool_t *utils_thread_pool_create(apr_thread_mutex_t **mutex, apr_thread_cond_t **cond1, apr_thread_cond_t **cond2);
+
+#endif
+
 
 #endif
@@ -0,0 +1,241 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-present Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: workers.c
+ *      desc: A simple pool of worker threads
+ *
+ *      Jobs are run in submission order. They must not use any pools or
+ *      global data that is accessed by the dumping thread at the same time.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <svn_pools.h>
+
+#if APR_HAS_THREADS
+ #include <apr_thread_cond.h>
+ #include <apr_thread_mutex.h>
+ #include <apr_thread_proc.h>
+#endif
+
+#include "main.h"
+#include "logger.h"
+#include "utils.h"
+
+#include "workers.h"
+
+
+/* Maximum number of worker threads */
+#define WORKERS_MAX 64
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+struct workers_job_t {
+	workers_func_t func;
+	void *baton;
+	char done;
+	struct workers_job_t *next;
+};
+
+
+#if APR_HAS_THREADS
+
+static struct workers_job_t *queue_head = NULL, *queue_tail = NULL;
+static int num_threads = 0;
+static char stopping = 0;
+
+static apr_pool_t *thread_pool = NULL;
+static apr_thread_t *threads[WORKERS_MAX];
+static apr_thread_mutex_t *mutex;
+static apr_thread_cond_t *job_cond;   /* Signaled for new jobs */
+static apr_thread_cond_t *done_cond;  /* Signaled for finished jobs */
+
+#endif
+
+
+/*---------------------------------------------------------------------------*/
+/* Local functions                                                           */
+/*---------------------------------------------------------------------------*/
+
+
+#if APR_HAS_THREADS
+
+/* Thread function: runs jobs until stopped */
+static void * APR_THREAD_FUNC workers_thread(apr_thread_t *thd, void *baton)
+{
+	apr_thread_mutex_lock(mutex);
+	while (1) {
+		struct workers_job_t *job;
+		if (queue_head == NULL) {
+			if (stopping) {
+				break;
+			}
+			apr_thread_cond_wait(job_cond, mutex);
+			continue;
+		}
+
+		job = queue_head;
+		queue_head = job->next;
+		if (queue_head == NULL) {
+			queue_tail = NULL;
+		}
+
+		apr_thread_mutex_unlock(mutex);
+		job->func(job->baton);
+		apr_thread_mutex_lock(mutex);
+
+		job->done = 1;
+		apr_thread_cond_broadcast(done_cond);
+	}
+	apr_thread_mutex_unlock(mutex);
+
+	apr_thread_exit(thd, APR_SUCCESS);
+	return NULL;
+}
+
+#endif /* APR_HAS_THREADS */
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Starts the given number of worker threads */
+void workers_start(int num)
+{
+#if APR_HAS_THREADS
+	if (num > WORKERS_MAX) {
+		num = WORKERS_MAX;
+	}
+	if (num <= 0) {
+		return;
+	}
+
+	stopping = 0;
+	if ((thread_pool = utils_thread_pool_create(&mutex, &job_cond, &done_cond)) == NULL) {
+		DEBUG_MSG("workers: Unable to create synchronization primitives\n");
+		return;
+	}
+
+	for (num_threads = 0; num_threads < num; num_threads++) {
+		if (apr_thread_create(&threads[num_threads], NULL, workers_thread, NULL, thread_pool) != APR_SUCCESS) {
+			DEBUG_MSG("workers: Unable to start thread %d\n", num_threads);
+			break;
+		}
+	}
+	if (num_threads == 0) {
+		svn_pool_destroy(thread_pool);
+		thread_pool = NULL;
+	}
+#endif
+}
+
+
+/* Returns non-zero if jobs can be run in the background */
+int workers_running()
+{
+#if APR_HAS_THREADS
+	return (num_threads > 0);
+#else
+	return 0;
+#endif
+}
+
+
+/* Submits a job. Every submitted job must be waited for */
+workers_job_t *workers_submit(workers_func_t func, void *baton)
+{
+	struct workers_job_t *job = malloc(sizeof(struct workers_job_t));
+	if (job == NULL) {
+		fprintf(stderr, "workers: out of memory\n");
+		exit(1);
+	}
+	job->func = func;
+	job->baton = baton;
+	job->done = 0;
+	job->next = NULL;
+
+#if APR_HAS_THREADS
+	if (num_threads > 0) {
+		apr_thread_mutex_lock(mutex);
+		if (queue_tail) {
+			queue_tail->next = job;
+		} else {
+			queue_head = job;
+		}
+		queue_tail = job;
+		apr_thread_cond_signal(job_cond);
+		apr_thread_mutex_unlock(mutex);
+		return job;
+	}
+#endif
+
+	/* Run the job right away */
+	func(baton);
+	job->done = 1;
+	return job;
+}
+
+
+/* Waits until a job has been finished and frees the handle */
+void workers_wait(workers_job_t *job)
+{
+#if APR_HAS_THREADS
+	if (num_threads > 0) {
+		apr_thread_mutex_lock(mutex);
+		while (!job->done) {
+			apr_thread_cond_wait(done_cond, mutex);
+		}
+		apr_thread_mutex_unlock(mutex);
+	}
+#endif
+	free(job);
+}
+
+
+/* Stops all worker threads */
+void workers_stop()
+{
+#if APR_HAS_THREADS
+	apr_status_t status;
+	int i;
+
+	if (num_threads == 0) {
+		return;
+	}
+
+	apr_thread_mutex_lock(mutex);
+	stopping = 1;
+	apr_thread_cond_broadcast(job_cond);
+	apr_thread_mutex_unlock(mutex);
+	for (i = 0; i < num_threads; i++) {
+		apr_thread_join(&status, threads[i]);
+	}
+
+	svn_pool_destroy(thread_pool);
+	thread_pool = NULL;
+	num_threads = 0;
+#endif
+}
@@ -0,0 +1,51 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-present Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: workers.h
+ *      desc: A simple pool of worker threads
+ */
+
+
+#ifndef WORKERS_H_
+#define WORKERS_H_
+
+
+/* Opaque job handle */
+typedef struct workers_job_t workers_job_t;
+
+/* Job function */
+typedef void (*workers_func_t)(void *baton);
+
+
+/* Starts the given number of worker threads */
+extern void workers_start(int num);
+
+/* Returns non-zero if jobs can be run in the background */
+extern int workers_running();
+
+/* Submits a job. Every submitted job must be waited for */
+extern workers_job_t *workers_submit(workers_func_t func, void *baton);
+
+/* Waits until a job has been finished and frees the handle */
+extern void workers_wait(workers_job_t *job);
+
+/* Stops all worker threads */
+extern void workers_stop();
+
+
+#endif
@@ -0,0 +1,360 @@
+#!/usr/bin/env python3
+#
+#	Benchmark suite for rsvndump
+#
+#	Synthetic repositories are generated as dump files and loaded with
+#	svnadmin, so they are identical on every machine. rsvndump is then
+#	run against them via file:// in several modes.
+#
+
+
+import hashlib, json, os, random, shutil, subprocess, sys, threading, time
+
+
+# Globals
+work_dir = "work"
+repo_dir = work_dir+"/repos"
+tmp_dir = work_dir+"/tmp"
+seed = 4711
+
+modes = {
+	"plain": [],
+	"deltas": ["--deltas"],
+	"incremental": ["--incremental"],
+	"sub": [],
+	"keep-revnums": ["--keep-revnums"],
+}
+
+
+# Writes dump file records for synthetic repositories
+class DumpWriter:
+	def __init__(self, f):
+		self.f = f
+		self.rev = 0
+		self.f.write(b"SVN-fs-dump-format-version: 2\n\n")
+
+	def props(self, props):
+		data = b""
+		for k in sorted(props.keys()):
+			v = props[k]
+			data += b"K "+str(len(k)).encode()+b"\n"+k+b"\nV "+str(len(v)).encode()+b"\n"+v+b"\n"
+		return data+b"PROPS-END\n"
+
+	def revision(self, message):
+		self.rev += 1
+		date = time.strftime("%Y-%m-%dT%H:%M:%S.000000Z", time.gmtime(1000000000 + self.rev * 60)).encode()
+		p = self.props({b"svn:log": message.encode(), b"svn:author": b"bench", b"svn:date": date})
+		self.f.write(b"Revision-number: "+str(self.rev).encode()+b"\n")
+		self.f.write(b"Prop-content-length: "+str(len(p)).encode()+b"\n")
+		self.f.write(b"Content-length: "+str(len(p)).encode()+b"\n\n")
+		self.f.write(p+b"\n")
+		return self.rev
+
+	def node(self, path, kind, action, text = None, props = None, copyfrom = None):
+		self.f.write(b"Node-path: "+path.encode()+b"\n")
+		if kind:
+			self.f.write(b"Node-kind: "+kind.encode()+b"\n")
+		self.f.write(b"Node-action: "+action.encode()+b"\n")
+		if copyfrom:
+			self.f.write(b"Node-copyfrom-rev: "+str(copyfrom[1]).encode()+b"\n")
+			self.f.write(b"Node-copyfrom-path: "+copyfrom[0].encode()+b"\n")
+		p = b""
+		if props is not None:
+			p = self.props(props)
+			self.f.write(b"Prop-content-length: "+str(len(p)).encode()+b"\n")
+		if text is not None:
+			self.f.write(b"Text-content-length: "+str(len(text)).encode()+b"\n")
+			self.f.write(b"Text-content-md5: "+hashlib.md5(text).hexdigest().encode()+b"\n")
+		if props is not None or text is not None:
+			self.f.write(b"Content-length: "+str(len(p) + (len(text) if text is not None else 0)).encode()+b"\n")
+		self.f.write(b"\n")
+		self.f.write(p)
+		if text is not None:
+			self.f.write(text)
+		self.f.write(b"\n\n")
+
+	def mkdir(self, path):
+		self.node(path, "dir", "add")
+
+	def add(self, path, text, props = None):
+		self.node(path, "file", "add", text, props if props else {})
+
+	def change(self, path, text, props = None):
+		self.node(path, "file", "change", text, props)
+
+	def copy(self, path, src, rev):
+		self.node(path, "dir", "add", copyfrom = (src, rev))
+
+	def delete(self, path):
+		self.node(path, None, "delete")
+
+
+# Returns some reproducible text
+def text(rnd, lines):
+	return "".join(["line %d: %x\n" % (i, rnd.getrandbits(64)) for i in range(lines)]).encode()
+
+
+# Many small revisions touching a few files each
+def gen_revisions(w, rnd, scale):
+	w.revision("layout")
+	w.mkdir("trunk")
+	files = []
+	for i in range(50):
+		files.append("trunk/f%d.txt" % i)
+	w.revision("initial files")
+	for f in files:
+		w.add(f, text(rnd, 20))
+	for r in range(200 * scale):
+		w.revision("change %d" % r)
+		for f in rnd.sample(files, 3):
+			w.change(f, text(rnd, 20))
+
+
+# A deep and wide directory tree
+def gen_deep(w, rnd, scale):
+	w.revision("layout")
+	w.mkdir("trunk")
+	paths = ["trunk"]
+	for r in range(20 * scale):
+		w.revision("grow %d" % r)
+		for i in range(10):
+			parent = rnd.choice(paths)
+			d = parent+"/d%d_%d" % (r, i)
+			w.mkdir(d)
+			paths.append(d)
+			w.add(d+"/file", text(rnd, 5))
+	for r in range(20 * scale):
+		w.revision("modify %d" % r)
+		for p in rnd.sample(paths[1:], 5):
+			w.change(p+"/file", text(rnd, 5))
+
+
+# Massive branch and tag copies of a large tree
+def gen_branches(w, rnd, scale):
+	w.revision("layout")
+	for d in ["trunk", "branches", "tags"]:
+		w.mkdir(d)
+	w.revision("initial tree")
+	files = []
+	for i in range(20):
+		w.mkdir("trunk/m%d" % i)
+		for j in range(25):
+			files.append("trunk/m%d/f%d.c" % (i, j))
+			w.add(files[-1], text(rnd, 10))
+	for r in range(25 * scale):
+		rev = w.revision("branch %d" % r)
+		w.copy("branches/b%d" % r, "trunk", rev - 1)
+		w.revision("tag %d" % r)
+		w.copy("tags/t%d" % r, "trunk", rev - 1)
+		w.revision("work %d" % r)
+		for f in rnd.sample(files, 5):
+			w.change(f, text(rnd, 10))
+		if r % 5 == 4:
+			w.revision("cleanup %d" % r)
+			w.delete("branches/b%d" % (r - 4))
+
+
+# Large binary files with small modifications
+def gen_binaries(w, rnd, scale):
+	w.revision("layout")
+	w.mkdir("trunk")
+	blobs = {}
+	w.revision("initial binaries")
+	for i in range(4):
+		blobs[i] = bytearray(rnd.getrandbits(8 * 2 * 1024 * 1024).to_bytes(2 * 1024 * 1024, "little"))
+		w.add("trunk/blob%d.bin" % i, bytes(blobs[i]), {b"svn:mime-type": b"application/octet-stream"})
+	for r in range(10 * scale):
+		w.revision("patch %d" % r)
+		i = rnd.randrange(4)
+		for j in range(64):
+			blobs[i][rnd.randrange(len(blobs[i]))] = rnd.getrandbits(8)
+		w.change("trunk/blob%d.bin" % i, bytes(blobs[i]))
+
+
+# Nodes with many and frequently changing properties
+def gen_props(w, rnd, scale):
+	w.revision("layout")
+	w.mkdir("trunk")
+	files = []
+	w.revision("initial files")
+	for i in range(100):
+		files.append("trunk/p%d" % i)
+		props = {}
+		for j in range(20):
+			props[("custom:prop%d" % j).encode()] = ("%x" % rnd.getrandbits(128)).encode()
+		w.add(files[-1], text(rnd, 2), props)
+	for r in range(100 * scale):
+		w.revision("props %d" % r)
+		for f in rnd.sample(files, 5):
+			props = {}
+			for j in range(20):
+				props[("custom:prop%d" % j).encode()] = ("%x" % rnd.getrandbits(16 if j else 128)).encode()
+			w.node(f, "file", "change", props = props)
+
+
+scenarios = {
+	"revisions": gen_revisions,
+	"deep": gen_deep,
+	"branches": gen_branches,
+	"binaries": gen_binaries,
+	"props": gen_props,
+}
+
+
+# Generates a repository for the given scenario
+def generate(name, scale):
+	repo = os.path.abspath(repo_dir+"/%s-%d" % (name, scale))
+	if os.path.exists(repo):
+		return repo
+	dump = repo+".dump"
+	f = open(dump, "wb")
+	scenarios[name](DumpWriter(f), random.Random(seed), scale)
+	f.close()
+	subprocess.check_call(["svnadmin", "create", repo])
+	subprocess.check_call(["svnadmin", "load", "--quiet", repo], stdin = open(dump, "rb"))
+	os.unlink(dump)
+	return repo
+
+
+# Returns the HEAD revision of a repository
+def youngest(repo):
+	return int(subprocess.check_output(["svnlook", "youngest", repo]).strip())
+
+
+# Samples the size and number of files in a directory until stopped
+class DirSampler(threading.Thread):
+	def __init__(self, path):
+		threading.Thread.__init__(self)
+		self.path = path
+		self.bytes = 0
+		self.inodes = 0
+		self.stop = threading.Event()
+
+	def sample(self):
+		size, inodes = 0, 0
+		for root, dirs, files in os.walk(self.path):
+			inodes += len(dirs) + len(files)
+			for f in files:
+				try:
+					size += os.lstat(os.path.join(root, f)).st_size
+				except OSError:
+					pass
+		self.bytes = max(self.bytes, size)
+		self.inodes = max(self.inodes, inodes)
+
+	def run(self):
+		while not self.stop.wait(0.05):
+			self.sample()
+
+
+# Runs rsvndump once and returns the measurements
+def measure(rsvndump, repo, mode):
+	url = "file://"+repo
+	args = list(modes[mode])
+	if mode == "sub":
+		url += "/trunk"
+	elif mode == "incremental":
+		args += ["--revision", "%d:HEAD" % (youngest(repo) // 2)]
+
+	shutil.rmtree(tmp_dir, ignore_errors = True)
+	os.makedirs(tmp_dir)
+	env = dict(os.environ)
+	env["TMPDIR"] = os.path.abspath(tmp_dir)
+
+	out = open(os.devnull, "wb")
+	sampler = DirSampler(tmp_dir)
+	sampler.start()
+	start = time.monotonic()
+	proc = subprocess.Popen([rsvndump, "--quiet", url] + args, stdout = out, env = env)
+	pid, status, rusage = os.wait4(proc.pid, 0)
+	wall = time.monotonic() - start
+	sampler.stop.set()
+	sampler.join()
+	out.close()
+
+	# ru_maxrss is in kilobytes on Linux, but in bytes on macOS
+	rss = rusage.ru_maxrss * (1 if sys.platform == "darwin" else 1024)
+	return {
+		"status": os.WEXITSTATUS(status) if os.WIFEXITED(status) else -1,
+		"wall_s": round(wall, 3),
+		"user_s": round(rusage.ru_utime, 3),
+		"sys_s": round(rusage.ru_stime, 3),
+		"peak_rss_bytes": rss,
+		"temp_bytes": sampler.bytes,
+		"temp_inodes": sampler.inodes,
+	}
+
+
+# Prints usage help
+def print_help():
+	print("USAGE: "+sys.argv[0]+" [options]\n")
+	print("options:")
+	print("    --rsvndump PATH      binary to benchmark (default: ../../src/rsvndump)")
+	print("    --scenario NAME      only run the given scenario (repeatable)")
+	print("    --mode NAME          only run the given mode (repeatable)")
+	print("    --scale N            scale repository sizes by N (default: 1)")
+	print("    --runs N             number of runs per combination (default: 1)")
+	print("    --output FILE        append JSON results to FILE")
+	print("    --clean              remove generated repositories first")
+	print("\nscenarios: "+", ".join(sorted(scenarios.keys())))
+	print("modes: "+", ".join(sorted(modes.keys())))
+
+
+# Program entry point
+def main():
+	rsvndump = "../../src/rsvndump"
+	names, mnames = [], []
+	scale, runs, output = 1, 1, None
+
+	args = sys.argv[1:]
+	while args:
+		a = args.pop(0)
+		if a in ("-h", "--help"):
+			print_help()
+			return 0
+		elif a == "--clean":
+			shutil.rmtree(work_dir, ignore_errors = True)
+		elif a in ("--rsvndump", "--scenario", "--mode", "--scale", "--runs", "--output") and args:
+			v = args.pop(0)
+			if a == "--rsvndump":
+				rsvndump = v
+			elif a == "--scenario" and v in scenarios:
+				names.append(v)
+			elif a == "--mode" and v in modes:
+				mnames.append(v)
+			elif a == "--scale":
+				scale = int(v)
+			elif a == "--runs":
+				runs = int(v)
+			elif a == "--output":
+				output = v
+			else:
+				print("Unknown value for "+a+": "+v)
+				return 1
+		else:
+			print("Unknown argument "+a)
+			return 1
+
+	os.makedirs(repo_dir, exist_ok = True)
+	rsvndump = os.path.abspath(rsvndump)
+	ret = 0
+	for name in (names if names else sorted(scenarios.keys())):
+		repo = generate(name, scale)
+		for mode in (mnames if mnames else sorted(modes.keys())):
+			for run in range(runs):
+				result = {"scenario": name, "mode": mode, "scale": scale, "run": run, "revisions": youngest(repo)}
+				result.update(measure(rsvndump, repo, mode))
+				print(json.dumps(result))
+				sys.stdout.flush()
+				if output:
+					f = open(output, "a")
+					f.write(json.dumps(result)+"\n")
+					f.close()
+				if result["status"] != 0:
+					ret = 1
+	return ret
+
+
+if __name__ == "__main__":
+	ret = main()
+	raise SystemExit(ret)
@@ -140,6 +140,31 @@ def dump_rsvndump_incremental(id, stepsize, args, repos = None):
 			break
 	return dump
 
+# Dumps the repository incremental using rsvndump and a saved state and returns the dumpfile path
+def dump_rsvndump_incremental_state(id, stepsize, args, repos = None):
+	log(id, "\n*** dump_rsvndump_incremental_state ("+str(id)+")\n")
+
+	if not repos:
+		repos = test.repo(id)
+	dump = test.dumps(id)+"/rsvndump.dump"
+	state = test.dumps(id)+"/state"
+	start = 0
+	end = stepsize
+	while True:
+		state_args = ("--save-state", state)
+		if start > 0:
+			state_args += ("--load-state", state)
+		try:
+			if not platform.system() == "Windows":
+				run("../../src/rsvndump", uri("file://"+repos), "--incremental", "--no-incremental-header", "--revision", str(start)+":"+str(end), *state_args, extra_args = tuple(args), output = dump, error = test.log(id))
+			else:
+				run("../../bin/rsvndump.exe", uri("file://"+repos), "--incremental", "--no-incremental-header", "--revision", str(start)+":"+str(end), *state_args, extra_args = tuple(args), output = dump, error = test.log(id))
+			start = end+1
+			end = start+stepsize
+		except:
+			break
+	return dump
+
 # Dumps the reopsitory incremental using rsvndump and returns the dumpfile path
 def dump_rsvndump_incremental_sub(id, path, stepsize, args, repos = None):
 	log(id, "\n*** dump_rsvndump_incremental ("+str(id)+")\n")
@@ -205,6 +230,16 @@ def dump_reload(id, dumpfile):
 	return dump
 
 
+# Filters the specified dumpfile using svndumpfilter and returns the path of
+# the result
+def dump_filter(id, dumpfile, args):
+	log(id, "\n*** dump_filter ("+str(id)+")\n")
+
+	dump = test.dumps(id)+"/filtered.dump"
+	run("svndumpfilter", *args, input = dumpfile, output = dump, error = test.log(id))
+	return dump
+
+
 # Loads the specified dumpfile into a temporary repository and dumps it using
 # rsvndump
 def dump_reload_rsvndump(id, dumpfile, args):
@@ -239,6 +274,25 @@ def dump_reload_rsvndump_sub(id, dumpfile, path, args):
 	return dump
 
 
+# Loads the repository into a temporary repository using rsvndump and dumps
+# the result
+def dump_rsvndump_load(id, args, repos = None):
+	log(id, "\n*** dump_rsvndump_load ("+str(id)+")\n")
+
+	if not repos:
+		repos = test.repo(id)
+	tmp = test.mkdtemp(id)
+	run("svnadmin", "create", tmp, output = test.log(id))
+	if not platform.system() == "Windows":
+		run("../../src/rsvndump", uri("file://"+repos), extra_args = tuple(args + ["--load-into", tmp]), output = test.log(id), error = test.log(id))
+	else:
+		run("../../bin/rsvndump.exe", uri("file://"+repos), extra_args = tuple(args + ["--load-into", tmp]), output = test.log(id), error = test.log(id))
+
+	dump = test.dumps(id)+"/validate.dump"
+	run("svnadmin", "dump", tmp, output = dump, error = test.log(id))
+	return dump
+
+
 # Compares two subversion repositories using "svnlook"
 def diff_repos(id, repo1, sub1, repo2, sub2):
 	log(id, "\n*** compare_repos ("+str(id)+"): "+repo1+"/"+sub1+" and "+repo2+"/"+sub2+"\n")
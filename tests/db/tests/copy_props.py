@@ -0,0 +1,98 @@
+#
+#	Test database for rsvndump
+#	written by Jonas Gehring
+#
+
+
+import os
+
+import test_api
+
+
+def info():
+	return "Copies with unchanged and changed properties"
+
+
+def setup(step, log):
+	if step == 0:
+		os.mkdir("trunk")
+		os.mkdir("tags")
+		os.mkdir("trunk/dir1")
+		f = open("trunk/dir1/file1","wb")
+		f.write(b"hello1\n")
+		f = open("trunk/file2","wb")
+		f.write(b"hello2\n")
+		test_api.run("svn", "add", "trunk", "tags", output = log)
+		test_api.run("svn", "propset", "svn:ignore", "*.o", "trunk/dir1", output = log)
+		test_api.run("svn", "propset", "svn:eol-style", "native", "trunk/dir1/file1", output = log)
+		test_api.run("svn", "propset", "svn:keywords", "Id", "trunk/file2", output = log)
+		return True
+	elif step == 1:
+		test_api.run("svn", "up", output = log)
+		test_api.run("svn", "cp", "trunk", "tags/t1", output = log)
+		return True
+	elif step == 2:
+		test_api.run("svn", "propset", "svn:eol-style", "LF", "trunk/dir1/file1", output = log)
+		test_api.run("svn", "propdel", "svn:keywords", "trunk/file2", output = log)
+		return True
+	elif step == 3:
+		# Copy from a revision before the property changes
+		test_api.run("svn", "up", output = log)
+		test_api.run("svn", "cp", "trunk/dir1/file1@1", "tags/file1-old", output = log)
+		test_api.run("svn", "cp", "trunk/file2@1", "tags/file2-old", output = log)
+		return True
+	elif step == 4:
+		test_api.run("svn", "up", output = log)
+		test_api.run("svn", "cp", "trunk/dir1", "tags/dir1", output = log)
+		test_api.run("svn", "propset", "svn:ignore", "*.a", "tags/dir1", output = log)
+		return True
+	else:
+		return False
+
+
+# Returns the header lines of all node records in a dump file, by path
+def node_headers(dump_path):
+	nodes = {}
+	headers = None
+	for line in open(dump_path, "rb"):
+		if line.startswith(b"Node-path: "):
+			headers = []
+			nodes.setdefault(line[11:].strip().decode(), []).append(headers)
+		elif headers is not None:
+			if line == b"\n":
+				headers = None
+			else:
+				headers.append(line)
+	return nodes
+
+
+# Checks whether one of the given node records contains properties
+def has_props(records):
+	return any(line.startswith(b"Prop-content-length: ") for headers in records for line in headers)
+
+
+# Runs the test
+def run(id, args = []):
+	# Set up the test repository
+	test_api.setup_repos(id, setup)
+
+	odump_path = test_api.dump_original(id)
+	rdump_path = test_api.dump_rsvndump(id, args)
+	vdump_path = test_api.dump_reload(id, rdump_path)
+	if not test_api.diff(id, odump_path, vdump_path):
+		return False
+
+	# Properties that match the copy source must not be dumped again
+	nodes = node_headers(rdump_path)
+	if not "tags/t1" in nodes:
+		test_api.log(id, "No record for tags/t1")
+		return False
+	for path in ["tags/t1", "tags/t1/dir1", "tags/t1/dir1/file1", "tags/t1/file2"]:
+		if path in nodes and has_props(nodes[path]):
+			test_api.log(id, "Unchanged properties dumped for "+path)
+			return False
+	for path in ["tags/file2-old", "tags/dir1"]:
+		if not path in nodes or not has_props(nodes[path]):
+			test_api.log(id, "Properties missing for "+path)
+			return False
+	return True
@@ -0,0 +1,52 @@
+#
+#	Test database for rsvndump
+#	written by Jonas Gehring
+#
+
+
+import os
+
+import test_api
+
+
+def info():
+	return "Compressed text deltas"
+
+
+def setup(step, log):
+	if step == 0:
+		os.mkdir("dir1")
+		f = open("dir1/file1","wb")
+		f.write(b"hello1\n" * 2000)
+		f = open("dir1/file2","wb")
+		f.write(os.urandom(16 * 1024))
+		test_api.run("svn", "add", "dir1", output = log)
+		return True
+	elif step == 1:
+		f = open("dir1/file1","ab")
+		f.write(b"hello2\n" * 500)
+		f = open("dir1/file2","ab")
+		f.write(b"hello3\n")
+		return True
+	elif step == 2:
+		test_api.run("svn", "cp", "dir1", "dir2", output = log)
+		f = open("dir2/file1","wb")
+		f.write(b"hello4\n")
+		return True
+	else:
+		return False
+
+
+# Runs the test
+def run(id, args = []):
+	# Set up the test repository
+	test_api.setup_repos(id, setup)
+
+	odump_path = test_api.dump_original(id)
+
+	for format in ["svndiff0", "svndiff1", "svndiff1:0", "svndiff1:9"]:
+		rdump_path = test_api.dump_rsvndump(id, args + ["--deltas", "--delta-format", format])
+		vdump_path = test_api.dump_reload(id, rdump_path)
+		if not test_api.diff(id, odump_path, vdump_path):
+			return False
+	return True
@@ -0,0 +1,105 @@
+#
+#	Test database for rsvndump
+#	written by Jonas Gehring
+#
+
+
+import os, shutil
+
+import test_api
+
+
+def info():
+	return "Include and exclude patterns"
+
+
+def setup(step, log):
+	if step == 0:
+		os.mkdir("dir1")
+		os.mkdir("dir1/sub")
+		os.mkdir("dir1/skip")
+		os.mkdir("dir2")
+		f = open("dir1/file1","wb")
+		f.write(b"hello1\n")
+		f = open("dir1/sub/file2","wb")
+		f.write(b"hello2\n")
+		f = open("dir1/skip/file3","wb")
+		f.write(b"hello3\n")
+		f = open("dir2/file4","wb")
+		f.write(b"hello4\n")
+		test_api.run("svn", "add", "dir1", "dir2", output = log)
+		return True
+	elif step == 1:
+		f = open("dir2/file4","ab")
+		f.write(b"hello5\n")
+		test_api.run("svn", "propset", "prop", "value", "dir2", output = log)
+		return True
+	elif step == 2:
+		os.mkdir("dir3")
+		os.mkdir("dir3/skip")
+		f = open("dir3/skip/file5","wb")
+		f.write(b"hello6\n")
+		test_api.run("svn", "add", "dir3", output = log)
+		test_api.run("svn", "cp", "dir1/sub", "dir3/sub", output = log)
+		f = open("dir1/skip/file3","ab")
+		f.write(b"hello7\n")
+		return True
+	elif step == 3:
+		test_api.run("svn", "cp", "dir1", "dir4", output = log)
+		f = open("dir4/skip/file3","ab")
+		f.write(b"hello8\n")
+		return True
+	elif step == 4:
+		test_api.run("svn", "rm", "dir2/file4", output = log)
+		test_api.run("svn", "rm", "dir4/skip", output = log)
+		f = open("dir3/sub/file2","ab")
+		f.write(b"hello9\n")
+		return True
+	else:
+		return False
+
+
+# Compares a dump created with the given filter options to the original dump
+# filtered by svndumpfilter
+def check(id, args, filter_args):
+	odump_path = test_api.dump_original(id)
+	fdump_path = test_api.dump_filter(id, odump_path, filter_args)
+	os.remove(odump_path)
+	vdump_path = test_api.dump_reload(id, fdump_path)
+	os.remove(fdump_path)
+	shutil.move(vdump_path, vdump_path+".orig")
+
+	rdump_path = test_api.dump_rsvndump(id, args)
+	vdump_path = test_api.dump_reload(id, rdump_path)
+	os.remove(rdump_path)
+	if not test_api.diff(id, vdump_path+".orig", vdump_path):
+		return False
+	os.remove(vdump_path)
+	os.remove(vdump_path+".orig")
+	return True
+
+
+# Runs the test
+def run(id, args = []):
+	# Set up the test repository
+	test_api.setup_repos(id, setup)
+
+	if not check(id, args + ["--exclude", "dir2"], ["exclude", "/dir2"]):
+		return False
+	if not check(id, args + ["--include", "dir1", "--include", "dir3/"], ["include", "/dir1", "/dir3"]):
+		return False
+
+	# Wildcards must give the same result as the matching paths
+	rdump_path = test_api.dump_rsvndump(id, args + ["--exclude", "*/skip"])
+	shutil.move(rdump_path, rdump_path+".orig")
+	rdump_path = test_api.dump_rsvndump(id, args + ["--exclude", "dir1/skip", "--exclude", "dir3/skip", "--exclude", "dir4/skip"])
+	if not test_api.diff(id, rdump_path+".orig", rdump_path):
+		return False
+	os.remove(rdump_path)
+
+	# The partially dumped copy must be loadable
+	rdump_path = rdump_path+".orig"
+	vdump_path = test_api.dump_reload(id, rdump_path)
+	os.remove(vdump_path)
+	os.remove(rdump_path)
+	return True
@@ -0,0 +1,80 @@
+#
+#	Test database for rsvndump
+#	written by Jonas Gehring
+#
+
+
+import os, shutil
+
+import test_api
+
+
+def info():
+	return "Incremental dump test using a saved state"
+
+
+def setup(step, log):
+	if step == 0:
+		os.mkdir("dir1")
+		f = open("dir1/file1", "wb")
+		f.write(b"hello1\n")
+		f.write(b"hello2\n")
+		test_api.run("svn", "add", "dir1", output = log)
+		return True
+	elif step == 1:
+		test_api.run("svn", "propset", "eol-style", "LF", "dir1/file1", output = log)
+		return True
+	elif step == 2:
+		f = open("dir1/file2", "wb")
+		f.write(b"hello3\n")
+		test_api.run("svn", "add", "dir1/file2", output = log)
+		return True
+	elif step == 3:
+		test_api.run("svn", "copy", "dir1", "dir2", output = log)
+		return True
+	elif step == 4:
+		f = open("dir2/file2", "ab")
+		f.write(b"hello4\n")
+		return True
+	elif step == 5:
+		os.mkdir("dir2/sdir1")
+		f = open("dir2/sdir1/file1", "wb")
+		f.write(b"hello5\n")
+		f = open("dir1/file1", "wb")
+		f.write(b"hello6\n")
+		test_api.run("svn", "add", "dir2/sdir1", output = log)
+		return True
+	elif step == 6:
+		f = open("dir2/sdir1/file1", "wb")
+		f.write(b"hello7\n")
+		f = open("dir2/sdir1/file2", "wb")
+		f.write(b"hello8\n")
+		test_api.run("svn", "add", "dir2/sdir1/file2", output = log)
+		return True
+	else:
+		return False
+
+
+# Runs the test
+def run(id, args = []):
+	# Set up the test repository
+	test_api.setup_repos(id, setup)
+
+	rdump_path = test_api.dump_rsvndump(id, args)
+	shutil.move(rdump_path, rdump_path+".orig")
+
+	# With a saved state, previous revisions are known to the incremental
+	# runs, so the output must match the full dump exactly
+	rdump_path = test_api.dump_rsvndump_incremental_state(id, 1, args)
+	if not test_api.diff(id, rdump_path+".orig", rdump_path):
+		return False
+
+	# Starting after a gap must give the same result as starting without
+	# a saved state
+	state = test_api.mktemp(id)
+	os.remove(state)
+	test_api.dump_rsvndump(id, args + ["--revision", "0:2", "--save-state", state])
+	rdump_path = test_api.dump_rsvndump(id, args + ["--incremental", "--revision", "5:HEAD"])
+	shutil.move(rdump_path, rdump_path+".orig")
+	rdump_path = test_api.dump_rsvndump(id, args + ["--incremental", "--revision", "5:HEAD", "--load-state", state])
+	return test_api.diff(id, rdump_path+".orig", rdump_path)
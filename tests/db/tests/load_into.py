@@ -0,0 +1,70 @@
+#
+#	Test database for rsvndump
+#	written by Jonas Gehring
+#
+
+
+import os, shutil
+
+import test_api
+
+
+def info():
+	return "Loading directly into a local repository"
+
+
+def setup(step, log):
+	if step == 0:
+		os.mkdir("dir1")
+		f = open("dir1/file1","wb")
+		f.write(b"hello1\n")
+		f = open("dir1/file2","wb")
+		f.write(b"hello2\n")
+		test_api.run("svn", "add", "dir1", output = log)
+		test_api.run("svn", "propset", "prop", "value", "dir1/file1", output = log)
+		return True
+	elif step == 1:
+		f = open("dir1/file1","ab")
+		f.write(b"hello3\n")
+		test_api.run("svn", "propdel", "prop", "dir1/file1", output = log)
+		test_api.run("svn", "propset", "prop", "value", "dir1/file2", output = log)
+		return True
+	elif step == 2:
+		test_api.run("svn", "cp", "dir1", "dir2", output = log)
+		f = open("dir2/file2","ab")
+		f.write(b"hello4\n")
+		return True
+	elif step == 3:
+		test_api.run("svn", "rm", "dir1/file2", output = log)
+		test_api.run("svn", "rm", "dir2", output = log)
+		return True
+	elif step == 4:
+		test_api.run("svn", "cp", "dir1", "dir2", output = log)
+		return True
+	else:
+		return False
+
+
+# Runs the test
+def run(id, args = []):
+	# Set up the test repository
+	test_api.setup_repos(id, setup)
+
+	odump_path = test_api.dump_original(id)
+	vdump_path = test_api.dump_rsvndump_load(id, args)
+	if not test_api.diff(id, odump_path, vdump_path):
+		return False
+	os.remove(vdump_path)
+
+	# The result must match the one of loading the dumpfile
+	for extra_args in [["--deltas"], ["--prefix", "a/b/"], ["--keep-revnums", "-r", "2:HEAD"]]:
+		rdump_path = test_api.dump_rsvndump(id, args + extra_args)
+		vdump_path = test_api.dump_reload(id, rdump_path)
+		shutil.move(vdump_path, vdump_path+".orig")
+		os.remove(rdump_path)
+		vdump_path = test_api.dump_rsvndump_load(id, args + extra_args)
+		if not test_api.diff(id, vdump_path+".orig", vdump_path):
+			return False
+		os.remove(vdump_path)
+		os.remove(vdump_path+".orig")
+	return True
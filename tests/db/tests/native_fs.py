@@ -0,0 +1,58 @@
+#
+#	Test database for rsvndump
+#	written by Jonas Gehring
+#
+
+
+import os, shutil
+
+import test_api
+
+
+def info():
+	return "Reading local repositories directly"
+
+
+def setup(step, log):
+	if step == 0:
+		os.mkdir("dir1")
+		f = open("dir1/file1","wb")
+		f.write(b"hello1\n")
+		f = open("dir1/file2","wb")
+		f.write(b"hello2\n")
+		test_api.run("svn", "add", "dir1", output = log)
+		return True
+	elif step == 1:
+		f = open("dir1/file1","ab")
+		f.write(b"hello3\n")
+		test_api.run("svn", "propset", "prop", "value", "dir1/file2", output = log)
+		return True
+	elif step == 2:
+		test_api.run("svn", "cp", "dir1", "dir2", output = log)
+		return True
+	elif step == 3:
+		f = open("dir2/file1","ab")
+		f.write(b"hello4\n")
+		test_api.run("svn", "rm", "dir1/file2", output = log)
+		return True
+	else:
+		return False
+
+
+# Runs the test
+def run(id, args = []):
+	# Set up the test repository
+	test_api.setup_repos(id, setup)
+
+	odump_path = test_api.dump_original(id)
+	rdump_path = test_api.dump_rsvndump(id, args + ["--native-fs"])
+	vdump_path = test_api.dump_reload(id, rdump_path)
+	if not test_api.diff(id, odump_path, vdump_path):
+		return False
+
+	# The output for subdirectories must match the one produced using the
+	# repository access layer
+	rdump_path = test_api.dump_rsvndump_sub(id, "dir2", args)
+	shutil.move(rdump_path, rdump_path+".orig")
+	rdump_path = test_api.dump_rsvndump_sub(id, "dir2", args + ["--native-fs"])
+	return test_api.diff(id, rdump_path+".orig", rdump_path)
@@ -0,0 +1,68 @@
+#
+#	Test database for rsvndump
+#	written by Jonas Gehring
+#
+#	Property records are only compacted once a storage segment is mostly
+#	unused, which takes megabytes of properties by default. Build with
+#	CFLAGS="-DSEGMENT_SIZE=4096" in order to compact segments in this test.
+#
+
+
+import os, shutil
+
+import test_api
+
+
+def info():
+	return "Frequently changing properties"
+
+
+def mergeinfo(step, i):
+	return "".join(["/branches/b%d:1-%d\n" % (j, step * 16 + i + 2) for j in range(step * 4 + 20)])
+
+
+def setup(step, log):
+	if step == 0:
+		os.mkdir("dir1")
+		for i in range(16):
+			f = open("dir1/file%d" % i,"wb")
+			f.write(b"hello%d\n" % i)
+		test_api.run("svn", "add", "dir1", output = log)
+		for i in range(16):
+			test_api.run("svn", "propset", "test", "value%d" % i, "dir1/file%d" % i, output = log)
+		return True
+	elif step < 25:
+		# The values of odd files are replaced in every revision, while
+		# the records of even files stay in place
+		for i in range(1, 16, 2):
+			test_api.run("svn", "propset", "svn:mergeinfo", mergeinfo(step, i), "dir1/file%d" % i, output = log)
+		if step % 8 == 0:
+			test_api.run("svn", "up", output = log)
+			test_api.run("svn", "cp", "dir1", "dir%d" % (step // 8 + 1), output = log)
+		return True
+	elif step == 25:
+		# Properties of even files must still be found after compaction
+		for i in range(0, 16, 2):
+			f = open("dir1/file%d" % i,"ab")
+			f.write(b"more\n")
+			test_api.run("svn", "propset", "test2", "value%d" % i, "dir1/file%d" % i, output = log)
+		return True
+	else:
+		return False
+
+
+# Runs the test
+def run(id, args = []):
+	# Set up the test repository
+	test_api.setup_repos(id, setup)
+
+	odump_path = test_api.dump_original(id)
+	rdump_path = test_api.dump_rsvndump(id, args)
+	vdump_path = test_api.dump_reload(id, rdump_path)
+	if not test_api.diff(id, odump_path, vdump_path):
+		return False
+
+	# Compacted segments must be restored from a saved state as well
+	shutil.move(rdump_path, rdump_path+".orig")
+	rdump_path = test_api.dump_rsvndump_incremental_state(id, 5, args)
+	return test_api.diff(id, rdump_path+".orig", rdump_path)
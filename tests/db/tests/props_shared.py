@@ -0,0 +1,56 @@
+#
+#	Test database for rsvndump
+#	written by Jonas Gehring
+#
+
+
+import os
+
+import test_api
+
+
+def info():
+	return "Identical properties on many nodes"
+
+
+def setup(step, log):
+	if step == 0:
+		os.mkdir("dir1")
+		for i in range(10):
+			f = open("dir1/file%d" % i,"wb")
+			f.write(b"hello%d\n" % i)
+		test_api.run("svn", "add", "dir1", output = log)
+		return True
+	elif step == 1:
+		mergeinfo = "/branches/b1:1-100\n/branches/b2:3,5,7-9\n" * 50
+		for i in range(10):
+			test_api.run("svn", "propset", "svn:mergeinfo", mergeinfo, "dir1/file%d" % i, output = log)
+			test_api.run("svn", "propset", "svn:eol-style", "native", "dir1/file%d" % i, output = log)
+		return True
+	elif step == 2:
+		test_api.run("svn", "up", output = log)
+		test_api.run("svn", "cp", "dir1", "dir2", output = log)
+		for i in range(0, 10, 2):
+			test_api.run("svn", "propdel", "svn:eol-style", "dir2/file%d" % i, output = log)
+		return True
+	elif step == 3:
+		# Deleted properties must stay deleted when the node changes again
+		for i in range(0, 10, 2):
+			f = open("dir2/file%d" % i,"ab")
+			f.write(b"more\n")
+			test_api.run("svn", "propset", "test", "value", "dir2/file%d" % i, output = log)
+		return True
+	else:
+		return False
+
+
+# Runs the test
+def run(id, args = []):
+	# Set up the test repository
+	test_api.setup_repos(id, setup)
+
+	odump_path = test_api.dump_original(id)
+	rdump_path = test_api.dump_rsvndump(id, args)
+	vdump_path = test_api.dump_reload(id, rdump_path)
+
+	return test_api.diff(id, odump_path, vdump_path)
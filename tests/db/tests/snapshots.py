@@ -0,0 +1,69 @@
+#
+#	Test database for rsvndump
+#	written by Jonas Gehring
+#
+#	The path repository writes snapshots every 1024 revisions by default.
+#	Build with CFLAGS="-DDEBUG -DDEBUG_PATH_REPO -DSNAPSHOT_INTERVAL=4" in
+#	order to write and check several snapshots with this test.
+#
+
+
+import os, shutil
+
+import test_api
+
+
+def info():
+	return "Path repository snapshots"
+
+
+def setup(step, log):
+	if step == 0:
+		os.mkdir("trunk")
+		os.mkdir("trunk/a")
+		os.mkdir("trunk/a/b")
+		os.mkdir("tags")
+		f = open("trunk/a/b/file", "wb")
+		f.write(b"hello\n")
+		f = open("trunk/a0", "wb")
+		f.write(b"hello0\n")
+		test_api.run("svn", "add", "trunk", "tags", output = log)
+		return True
+	elif step < 18:
+		# Keep adding and removing paths next to each other, with tags
+		# being copied from older revisions
+		if step % 5 == 0:
+			test_api.run("svn", "cp", "trunk", "tags/t%d" % step, output = log)
+		if step % 3 == 0:
+			test_api.run("svn", "rm", "trunk/d%d" % (step - 2), output = log)
+		if step == 11:
+			test_api.run("svn", "rm", "tags/t5", output = log)
+			test_api.run("svn", "cp", "trunk/a", "trunk/ab", output = log)
+			test_api.run("svn", "rm", "trunk/a", output = log)
+		os.mkdir("trunk/d%d" % step)
+		f = open("trunk/d%d/file" % step, "wb")
+		f.write(b"file %d\n" % step)
+		test_api.run("svn", "add", "trunk/d%d" % step, output = log)
+		f = open("trunk/a%s/b/file" % ("b" if step >= 11 else ""), "ab")
+		f.write(b"line %d\n" % step)
+		return True
+	else:
+		return False
+
+
+# Runs the test
+def run(id, args = []):
+	# Set up the test repository
+	test_api.setup_repos(id, setup)
+
+	odump_path = test_api.dump_original(id)
+	rdump_path = test_api.dump_rsvndump(id, args)
+	vdump_path = test_api.dump_reload(id, rdump_path)
+	if not test_api.diff(id, odump_path, vdump_path):
+		return False
+
+	# Restoring the path repository from a saved state in between snapshots
+	# must not change the output
+	shutil.move(rdump_path, rdump_path+".orig")
+	rdump_path = test_api.dump_rsvndump_incremental_state(id, 3, args)
+	return test_api.diff(id, rdump_path+".orig", rdump_path)
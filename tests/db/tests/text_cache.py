@@ -0,0 +1,61 @@
+#
+#	Test database for rsvndump
+#	written by Jonas Gehring
+#
+
+
+import os
+
+import test_api
+
+
+def info():
+	return "Local copies in memory and on disk"
+
+
+def setup(step, log):
+	if step == 0:
+		os.mkdir("dir1")
+		f = open("dir1/small","wb")
+		f.write(b"hello1\n")
+		f = open("dir1/medium","wb")
+		f.write(b"hello2\n" * 300)
+		f = open("dir1/large","wb")
+		f.write(os.urandom(64 * 1024))
+		f = open("dir1/empty","wb")
+		test_api.run("svn", "add", "dir1", output = log)
+		return True
+	elif step == 1:
+		f = open("dir1/small","ab")
+		f.write(b"hello3\n" * 400)
+		f = open("dir1/medium","wb")
+		f.write(b"hello4\n")
+		f = open("dir1/large","ab")
+		f.write(b"hello5\n")
+		return True
+	elif step == 2:
+		test_api.run("svn", "cp", "dir1", "dir2", output = log)
+		return True
+	elif step == 3:
+		f = open("dir2/medium","ab")
+		f.write(b"hello6\n")
+		test_api.run("svn", "rm", "dir1", output = log)
+		return True
+	else:
+		return False
+
+
+# Runs the test
+def run(id, args = []):
+	# Set up the test repository
+	test_api.setup_repos(id, setup)
+
+	odump_path = test_api.dump_original(id)
+
+	# Memory only, mixed and disk only
+	for cache in [["--text-cache-threshold", "1024"], [], ["--text-cache", "0"]]:
+		rdump_path = test_api.dump_rsvndump(id, args + cache)
+		vdump_path = test_api.dump_reload(id, rdump_path)
+		if not test_api.diff(id, odump_path, vdump_path):
+			return False
+	return True
@@ -0,0 +1,60 @@
+#
+#	Test database for rsvndump
+#	written by Jonas Gehring
+#
+
+
+import os
+
+import test_api
+
+
+def info():
+	return "Deltas computed on worker threads"
+
+
+def setup(step, log):
+	if step == 0:
+		os.mkdir("dir1")
+		for i in range(20):
+			f = open("dir1/file%d" % i, "wb")
+			f.write(b"line %d\n" % i * (i * 50))
+		f = open("dir1/large", "wb")
+		f.write(os.urandom(128 * 1024))
+		test_api.run("svn", "add", "dir1", output = log)
+		return True
+	elif step == 1:
+		for i in range(0, 20, 2):
+			f = open("dir1/file%d" % i, "ab")
+			f.write(b"more\n" * i)
+		f = open("dir1/large", "ab")
+		f.write(b"tail\n")
+		return True
+	elif step == 2:
+		test_api.run("svn", "cp", "dir1", "dir2", output = log)
+		f = open("dir2/file3", "wb")
+		f.write(b"replaced\n")
+		return True
+	elif step == 3:
+		test_api.run("svn", "rm", "dir1/file5", output = log)
+		f = open("dir2/file7", "ab")
+		f.write(b"appended\n")
+		return True
+	else:
+		return False
+
+
+# Runs the test
+def run(id, args = []):
+	# Set up the test repository
+	test_api.setup_repos(id, setup)
+
+	odump_path = test_api.dump_original(id)
+
+	# The output must not depend on the number of threads
+	for threads in ["0", "1", "4"]:
+		rdump_path = test_api.dump_rsvndump(id, args + ["--deltas", "--threads", threads])
+		vdump_path = test_api.dump_reload(id, rdump_path)
+		if not test_api.diff(id, odump_path, vdump_path):
+			return False
+	return True